@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// One global descriptor set holding every sampled texture and storage buffer.
+// Shaders index the arrays with a push constant, so a draw binds nothing but
+// its indices. Needs VK_EXT_descriptor_indexing: the bindings are partially
+// bound and update-after-bind, so slots can be written while frames reading
+// other slots are in flight. Slots come from a free-list; a removed slot is
+// only handed out again once the frames that may still read it have completed.
+class BindlessDescriptors {
+public:
+	static const uint32_t TextureBinding = 0;
+	static const uint32_t StorageBufferBinding = 1;
+
+	BindlessDescriptors(VkDevice device, uint32_t textureCapacity, uint32_t bufferCapacity,
+		VkShaderStageFlags stages = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT) :
+		m_Device(device),
+		m_Slots{ FreeList(textureCapacity), FreeList(bufferCapacity) }
+	{
+		VkDescriptorSetLayoutBinding bindings[2] = {};
+		bindings[TextureBinding].binding = TextureBinding;
+		bindings[TextureBinding].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[TextureBinding].descriptorCount = textureCapacity;
+		bindings[TextureBinding].stageFlags = stages;
+		bindings[TextureBinding].pImmutableSamplers = nullptr;
+		bindings[StorageBufferBinding].binding = StorageBufferBinding;
+		bindings[StorageBufferBinding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[StorageBufferBinding].descriptorCount = bufferCapacity;
+		bindings[StorageBufferBinding].stageFlags = stages;
+		bindings[StorageBufferBinding].pImmutableSamplers = nullptr;
+
+		VkDescriptorBindingFlagsEXT bindingFlags[2] = {};
+		for (auto& flags : bindingFlags)
+		{
+			flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+				VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+				VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+		}
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsInfo.bindingCount = 2;
+		bindingFlagsInfo.pBindingFlags = bindingFlags;
+		bindingFlagsInfo.pNext = nullptr;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		layoutInfo.bindingCount = 2;
+		layoutInfo.pBindings = bindings;
+		layoutInfo.pNext = &bindingFlagsInfo;
+		if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &m_Layout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create bindless descriptor set layout.");
+		}
+
+		VkDescriptorPoolSize poolSizes[2] = {};
+		poolSizes[TextureBinding].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[TextureBinding].descriptorCount = textureCapacity;
+		poolSizes[StorageBufferBinding].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[StorageBufferBinding].descriptorCount = bufferCapacity;
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+		poolInfo.maxSets = 1;
+		poolInfo.poolSizeCount = 2;
+		poolInfo.pPoolSizes = poolSizes;
+		poolInfo.pNext = nullptr;
+		if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &m_Pool) != VK_SUCCESS)
+		{
+			vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+			throw std::runtime_error("Can't create bindless descriptor pool.");
+		}
+
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = m_Pool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &m_Layout;
+		allocInfo.pNext = nullptr;
+		if (vkAllocateDescriptorSets(m_Device, &allocInfo, &m_Set) != VK_SUCCESS)
+		{
+			vkDestroyDescriptorPool(m_Device, m_Pool, nullptr);
+			vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+			throw std::runtime_error("Can't allocate bindless descriptor set.");
+		}
+	}
+
+	BindlessDescriptors(const BindlessDescriptors&) = delete;
+	BindlessDescriptors& operator=(const BindlessDescriptors&) = delete;
+
+	~BindlessDescriptors()
+	{
+		vkDestroyDescriptorPool(m_Device, m_Pool, nullptr);
+		vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+	}
+
+	VkDescriptorSetLayout getLayout() const
+	{
+		return m_Layout;
+	}
+
+	VkDescriptorSet getSet() const
+	{
+		return m_Set;
+	}
+
+	// Returns the index shaders use to reach the texture.
+	uint32_t addTexture(VkImageView view, VkSampler sampler,
+		VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	{
+		VkDescriptorImageInfo imageInfo = {};
+		imageInfo.sampler = sampler;
+		imageInfo.imageView = view;
+		imageInfo.imageLayout = layout;
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto index = m_Slots[TextureBinding].acquire("texture");
+		write(TextureBinding, index, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &imageInfo, nullptr);
+		return index;
+	}
+
+	uint32_t addStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE)
+	{
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = buffer;
+		bufferInfo.offset = offset;
+		bufferInfo.range = range;
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto index = m_Slots[StorageBufferBinding].acquire("storage buffer");
+		write(StorageBufferBinding, index, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &bufferInfo);
+		return index;
+	}
+
+	// lastUseSerial is the last frame that may read the slot; the slot is
+	// reused once reclaim() is given a completed serial at or past it.
+	void removeTexture(uint32_t index, uint64_t lastUseSerial)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_PendingFrees.push_back({ lastUseSerial, TextureBinding, index });
+	}
+
+	void removeStorageBuffer(uint32_t index, uint64_t lastUseSerial)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_PendingFrees.push_back({ lastUseSerial, StorageBufferBinding, index });
+	}
+
+	void reclaim(uint64_t completedSerial)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		while (!m_PendingFrees.empty() && m_PendingFrees.front().serial <= completedSerial)
+		{
+			m_Slots[m_PendingFrees.front().binding].release(m_PendingFrees.front().index);
+			m_PendingFrees.pop_front();
+		}
+	}
+
+private:
+	class FreeList {
+	public:
+		explicit FreeList(uint32_t capacity) :
+			m_Capacity(capacity)
+		{
+		}
+
+		uint32_t acquire(const char* kind)
+		{
+			if (!m_Free.empty())
+			{
+				auto index = m_Free.back();
+				m_Free.pop_back();
+				return index;
+			}
+			if (m_Next == m_Capacity)
+			{
+				throw std::runtime_error(std::string("All ") + std::to_string(m_Capacity) + " bindless " + kind + " slots are in use.");
+			}
+			return m_Next++;
+		}
+
+		void release(uint32_t index)
+		{
+			m_Free.push_back(index);
+		}
+
+	private:
+		uint32_t m_Capacity;
+		// Slots below m_Next have been handed out at least once.
+		uint32_t m_Next = 0;
+		std::vector<uint32_t> m_Free;
+	};
+
+	class PendingFree {
+	public:
+		uint64_t serial;
+		uint32_t binding;
+		uint32_t index;
+	};
+
+	VkDevice m_Device;
+	VkDescriptorSetLayout m_Layout = VK_NULL_HANDLE;
+	VkDescriptorPool m_Pool = VK_NULL_HANDLE;
+	VkDescriptorSet m_Set = VK_NULL_HANDLE;
+	// Indexed by binding.
+	FreeList m_Slots[2];
+	// Removals are queued in serial order, so the front is always the oldest.
+	std::deque<PendingFree> m_PendingFrees;
+	std::mutex m_Mutex;
+
+	void write(uint32_t binding, uint32_t index, VkDescriptorType type,
+		const VkDescriptorImageInfo* imageInfo, const VkDescriptorBufferInfo* bufferInfo)
+	{
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = m_Set;
+		write.dstBinding = binding;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.descriptorType = type;
+		write.pImageInfo = imageInfo;
+		write.pBufferInfo = bufferInfo;
+		write.pNext = nullptr;
+		vkUpdateDescriptorSets(m_Device, 1, &write, 0, nullptr);
+	}
+};
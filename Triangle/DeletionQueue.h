@@ -0,0 +1,91 @@
+#pragma once
+
+#include "VulkanHandle.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+
+// Destroys resources once the GPU has finished with them, without waiting for
+// the device to go idle. Each entry is tagged with the first serial (frame
+// number or timeline value) that no longer uses it. collect(completedSerial),
+// called after the fence or semaphore for completedSerial has been waited on,
+// runs every entry whose serial is at most completedSerial + 1. Entries run in
+// the order they were pushed, so only the front of the queue is ever checked.
+// Not thread-safe; push and collect from the thread that submits frames.
+class DeletionQueue {
+public:
+	DeletionQueue() = default;
+
+	DeletionQueue(const DeletionQueue&) = delete;
+	DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+	~DeletionQueue()
+	{
+		flush();
+	}
+
+	// Serials only grow; an earlier one is raised to the last pushed serial so
+	// the queue stays ordered. That only ever destroys later, never sooner.
+	void push(uint64_t firstUnusedSerial, std::function<void()> destroy)
+	{
+		if (!m_Entries.empty())
+		{
+			firstUnusedSerial = std::max(firstUnusedSerial, m_Entries.back().firstUnusedSerial);
+		}
+		m_Entries.push_back({ firstUnusedSerial, std::move(destroy) });
+	}
+
+	// Takes over handle. Empty handles are ignored.
+	template<typename Handle, void (VKAPI_PTR* Destroy)(VkDevice, Handle, const VkAllocationCallbacks*)>
+	void push(uint64_t firstUnusedSerial, UniqueHandle<Handle, Destroy>&& handle)
+	{
+		if (!handle)
+		{
+			return;
+		}
+		auto device = handle.getDevice();
+		auto raw = handle.release();
+		push(firstUnusedSerial, [device, raw]
+		{
+			Destroy(device, raw, nullptr);
+		});
+	}
+
+	// Returns how many entries were destroyed.
+	uint32_t collect(uint64_t completedSerial)
+	{
+		uint32_t count = 0;
+		while (!m_Entries.empty() && (completedSerial == UINT64_MAX || m_Entries.front().firstUnusedSerial <= completedSerial + 1))
+		{
+			// Popped first so a throwing destroy isn't run again.
+			auto destroy = std::move(m_Entries.front().destroy);
+			m_Entries.pop_front();
+			destroy();
+			++count;
+		}
+		return count;
+	}
+
+	// Destroys everything. The caller must know the device is idle.
+	void flush()
+	{
+		collect(UINT64_MAX);
+	}
+
+	size_t size() const
+	{
+		return m_Entries.size();
+	}
+
+private:
+	class Entry {
+	public:
+		uint64_t firstUnusedSerial;
+		std::function<void()> destroy;
+	};
+
+	std::deque<Entry> m_Entries;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Linear allocator for descriptor sets that only live for one frame. Each
+// frame in flight owns a list of pools; beginFrame() resets them with one
+// vkResetDescriptorPool each instead of freeing sets, and the pools are kept
+// for the next use of the slot. A pool is only created when every pool of the
+// frame is full. Not thread-safe: allocate from the recording thread.
+class FrameDescriptorAllocator {
+public:
+	FrameDescriptorAllocator(VkDevice device, uint32_t frameCount,
+		const std::vector<VkDescriptorPoolSize>& poolSizes, uint32_t maxSetsPerPool) :
+		m_Device(device),
+		m_PoolSizes(poolSizes),
+		m_MaxSetsPerPool(maxSetsPerPool),
+		m_Frames(frameCount)
+	{
+	}
+
+	FrameDescriptorAllocator(const FrameDescriptorAllocator&) = delete;
+	FrameDescriptorAllocator& operator=(const FrameDescriptorAllocator&) = delete;
+
+	~FrameDescriptorAllocator()
+	{
+		for (auto& frame : m_Frames)
+		{
+			for (auto pool : frame.pools)
+			{
+				vkDestroyDescriptorPool(m_Device, pool, nullptr);
+			}
+		}
+	}
+
+	// Call once the frame's previous submission has completed.
+	void beginFrame(uint32_t frameIndex)
+	{
+		m_FrameIndex = frameIndex;
+		auto& frame = m_Frames[frameIndex];
+		for (size_t i = 0; i < frame.pools.size() && i <= frame.current; ++i)
+		{
+			vkResetDescriptorPool(m_Device, frame.pools[i], 0);
+		}
+		frame.current = 0;
+		frame.setsInCurrent = 0;
+	}
+
+	// The set is valid until the next beginFrame() for this frame index.
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout)
+	{
+		auto& frame = m_Frames[m_FrameIndex];
+		for (;;)
+		{
+			if (frame.current == frame.pools.size())
+			{
+				frame.pools.push_back(createPool());
+			}
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = frame.pools[frame.current];
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &layout;
+			allocInfo.pNext = nullptr;
+			VkDescriptorSet set;
+			if (vkAllocateDescriptorSets(m_Device, &allocInfo, &set) == VK_SUCCESS)
+			{
+				++frame.setsInCurrent;
+				return set;
+			}
+			// Pre-1.1 drivers don't all return VK_ERROR_OUT_OF_POOL_MEMORY, so any
+			// failure on a pool that already holds sets means "full".
+			if (frame.setsInCurrent == 0)
+			{
+				throw std::runtime_error("Descriptor set doesn't fit in an empty frame descriptor pool.");
+			}
+			++frame.current;
+			frame.setsInCurrent = 0;
+		}
+	}
+
+private:
+	class FramePools {
+	public:
+		std::vector<VkDescriptorPool> pools;
+		// Pools before current are full; pools after it are unused this frame.
+		size_t current = 0;
+		uint32_t setsInCurrent = 0;
+	};
+
+	VkDevice m_Device;
+	std::vector<VkDescriptorPoolSize> m_PoolSizes;
+	uint32_t m_MaxSetsPerPool;
+	std::vector<FramePools> m_Frames;
+	uint32_t m_FrameIndex = 0;
+
+	VkDescriptorPool createPool()
+	{
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = m_MaxSetsPerPool;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(m_PoolSizes.size());
+		poolInfo.pPoolSizes = m_PoolSizes.data();
+		poolInfo.pNext = nullptr;
+		VkDescriptorPool pool;
+		if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create frame descriptor pool.");
+		}
+		return pool;
+	}
+};
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <glm/geometric.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/gtc/matrix_access.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRIANGLE_CULL_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLE_CULL_SSE
+#endif
+
+// Instances for CPU culling, stored as a structure of arrays: each field is
+// one contiguous array, so the frustum test loads several instances per
+// instruction and never touches the transforms of culled instances.
+class InstanceStore {
+public:
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> radius;
+	std::vector<glm::mat4> transforms;
+
+	void reserve(size_t count)
+	{
+		x.reserve(count);
+		y.reserve(count);
+		z.reserve(count);
+		radius.reserve(count);
+		transforms.reserve(count);
+	}
+
+	void add(const glm::vec3& position, float boundingRadius, const glm::mat4& transform)
+	{
+		x.push_back(position.x);
+		y.push_back(position.y);
+		z.push_back(position.z);
+		radius.push_back(boundingRadius);
+		transforms.push_back(transform);
+	}
+
+	uint32_t size() const
+	{
+		return static_cast<uint32_t>(x.size());
+	}
+};
+
+// The same instance as one struct, as a renderer without an SoA store keeps it.
+// Only used as the baseline the SIMD path is measured against.
+class AoSInstance {
+public:
+	glm::vec3 position;
+	float radius;
+	glm::mat4 transform;
+};
+
+// Six planes (a, b, c, d) with inward normals: a point p is inside a plane
+// when a * p.x + b * p.y + c * p.z + d >= 0.
+class Frustum {
+public:
+	glm::vec4 planes[6];
+
+	// Gribb-Hartmann extraction for Vulkan clip space, where depth is [0, 1].
+	static Frustum fromViewProjection(const glm::mat4& viewProjection)
+	{
+		auto row0 = glm::row(viewProjection, 0);
+		auto row1 = glm::row(viewProjection, 1);
+		auto row2 = glm::row(viewProjection, 2);
+		auto row3 = glm::row(viewProjection, 3);
+		Frustum frustum;
+		frustum.planes[0] = row3 + row0;
+		frustum.planes[1] = row3 - row0;
+		frustum.planes[2] = row3 + row1;
+		frustum.planes[3] = row3 - row1;
+		frustum.planes[4] = row2;
+		frustum.planes[5] = row3 - row2;
+		// Normalised so plane distances compare against world-space radii.
+		for (auto& plane : frustum.planes)
+		{
+			auto length = glm::length(glm::vec3(plane));
+			if (length > 0.0f)
+			{
+				plane /= length;
+			}
+		}
+		return frustum;
+	}
+};
+
+// Sphere-frustum culling that writes the indices of visible instances, in
+// order, into a compact list. The SoA path tests 8 instances at a time with
+// AVX, 4 with SSE2, or one at a time on other targets; the choice is made at
+// compile time. cullParallel() splits large stores across a ThreadPool. Plane
+// distances are summed in the same order on every path, so all of them agree
+// exactly with the scalar baseline.
+class FrustumCuller {
+public:
+#if defined(TRIANGLE_CULL_AVX)
+	static const uint32_t Lanes = 8;
+#elif defined(TRIANGLE_CULL_SSE)
+	static const uint32_t Lanes = 4;
+#else
+	static const uint32_t Lanes = 1;
+#endif
+
+	static const char* instructionSet()
+	{
+#if defined(TRIANGLE_CULL_AVX)
+		return "AVX";
+#elif defined(TRIANGLE_CULL_SSE)
+		return "SSE2";
+#else
+		return "scalar";
+#endif
+	}
+
+	// Baseline: one instance at a time, through the AoS layout.
+	static void cullScalar(const std::vector<AoSInstance>& instances, const Frustum& frustum, std::vector<uint32_t>& visible)
+	{
+		visible.clear();
+		for (uint32_t i = 0; i < instances.size(); ++i)
+		{
+			auto& instance = instances[i];
+			bool inside = true;
+			for (auto& plane : frustum.planes)
+			{
+				if (glm::dot(glm::vec3(plane), instance.position) + plane.w < -instance.radius)
+				{
+					inside = false;
+					break;
+				}
+			}
+			if (inside)
+			{
+				visible.push_back(i);
+			}
+		}
+	}
+
+	// Culls instances [first, end) into out, which needs room for end - first
+	// indices. Returns how many were written.
+	static uint32_t cull(const InstanceStore& store, const Frustum& frustum, uint32_t first, uint32_t end, uint32_t* out)
+	{
+		uint32_t count = 0;
+		auto i = first;
+#if defined(TRIANGLE_CULL_AVX)
+		__m256 planes[6][4];
+		for (int p = 0; p < 6; ++p)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+			}
+		}
+		for (; i + 8 <= end; i += 8)
+		{
+			auto x = _mm256_loadu_ps(&store.x[i]);
+			auto y = _mm256_loadu_ps(&store.y[i]);
+			auto z = _mm256_loadu_ps(&store.z[i]);
+			auto negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&store.radius[i]));
+			auto inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p)
+			{
+				auto distance = _mm256_add_ps(_mm256_mul_ps(planes[p][0], x), _mm256_mul_ps(planes[p][1], y));
+				distance = _mm256_add_ps(_mm256_add_ps(distance, _mm256_mul_ps(planes[p][2], z)), planes[p][3]);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+			}
+			count += compact(_mm256_movemask_ps(inside), 8, i, out + count);
+		}
+#elif defined(TRIANGLE_CULL_SSE)
+		__m128 planes[6][4];
+		for (int p = 0; p < 6; ++p)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+			}
+		}
+		for (; i + 4 <= end; i += 4)
+		{
+			auto x = _mm_loadu_ps(&store.x[i]);
+			auto y = _mm_loadu_ps(&store.y[i]);
+			auto z = _mm_loadu_ps(&store.z[i]);
+			auto negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&store.radius[i]));
+			auto inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p)
+			{
+				auto distance = _mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y));
+				distance = _mm_add_ps(_mm_add_ps(distance, _mm_mul_ps(planes[p][2], z)), planes[p][3]);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+			}
+			count += compact(_mm_movemask_ps(inside), 4, i, out + count);
+		}
+#endif
+		// Tail, or everything on targets without SIMD.
+		for (; i < end; ++i)
+		{
+			bool inside = true;
+			for (auto& plane : frustum.planes)
+			{
+				inside &= plane.x * store.x[i] + plane.y * store.y[i] + plane.z * store.z[i] + plane.w >= -store.radius[i];
+			}
+			out[count] = i;
+			count += inside ? 1 : 0;
+		}
+		return count;
+	}
+
+	// Same result as cull() over the whole store. Batches of at least
+	// minBatchSize run on the pool's workers and are then packed in order.
+	static void cullParallel(const InstanceStore& store, const Frustum& frustum, ThreadPool& pool,
+		std::vector<uint32_t>& visible, uint32_t minBatchSize = 16384)
+	{
+		auto itemCount = store.size();
+		visible.resize(itemCount);
+		minBatchSize = std::max(minBatchSize, 1u);
+		auto maxBatches = (itemCount + minBatchSize - 1) / minBatchSize;
+		auto batchCount = std::max(1u, std::min(pool.size(), maxBatches));
+		if (batchCount == 1)
+		{
+			visible.resize(cull(store, frustum, 0, itemCount, visible.data()));
+			return;
+		}
+		// Batches start on a lane boundary so only the last one has a scalar tail.
+		auto batchSize = ((itemCount + batchCount - 1) / batchCount + Lanes - 1) / Lanes * Lanes;
+
+		std::vector<std::future<uint32_t>> futures;
+		futures.reserve(batchCount);
+		for (uint32_t batch = 0; batch < batchCount; ++batch)
+		{
+			auto first = std::min(itemCount, batch * batchSize);
+			auto end = std::min(itemCount, first + batchSize);
+			auto out = visible.data() + first;
+			futures.push_back(pool.submit([&store, &frustum, first, end, out](uint32_t)
+			{
+				return cull(store, frustum, first, end, out);
+			}));
+		}
+		// Each batch wrote at its own first index; slide them down into one list.
+		uint32_t count = 0;
+		for (uint32_t batch = 0; batch < batchCount; ++batch)
+		{
+			auto batchVisible = futures[batch].get();
+			auto first = std::min(itemCount, batch * batchSize);
+			if (count != first)
+			{
+				memmove(visible.data() + count, visible.data() + first, sizeof(uint32_t) * batchVisible);
+			}
+			count += batchVisible;
+		}
+		visible.resize(count);
+	}
+
+private:
+	// Appends base + lane for every set bit of mask without branching per lane.
+	static uint32_t compact(int mask, uint32_t lanes, uint32_t base, uint32_t* out)
+	{
+		uint32_t count = 0;
+		for (uint32_t lane = 0; lane < lanes; ++lane)
+		{
+			out[count] = base + lane;
+			count += (mask >> lane) & 1;
+		}
+		return count;
+	}
+};
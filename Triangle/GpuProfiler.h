@@ -0,0 +1,219 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+// Times GPU work with timestamp queries. Each frame in flight has its own
+// query pool; beginFrame() reads the slot's previous results without
+// VK_QUERY_RESULT_WAIT_BIT, so results arrive maxFramesInFlight frames late
+// and the CPU never stalls on them. Scope names must be string literals or
+// otherwise outlive the profiler. Devices without timestamp support on the
+// queue get a profiler whose methods do nothing.
+class GpuProfiler {
+public:
+	class ScopeStats {
+	public:
+		const char* name;
+		double minMs;
+		double avgMs;
+		double p99Ms;
+		size_t sampleCount;
+	};
+
+	// Stats are taken over this many recent frames per scope.
+	static const size_t WindowSize = 256;
+
+	GpuProfiler(VkDevice device, float timestampPeriod, uint32_t timestampValidBits,
+		uint32_t frameCount, uint32_t maxScopesPerFrame = 32) :
+		m_Device(device),
+		m_TimestampPeriod(timestampPeriod),
+		m_TimestampMask(timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1),
+		m_MaxScopes(maxScopesPerFrame),
+		m_Slots(timestampValidBits != 0 ? frameCount : 0)
+	{
+		VkQueryPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = 2 * m_MaxScopes;
+		poolInfo.pNext = nullptr;
+		for (auto& slot : m_Slots)
+		{
+			if (vkCreateQueryPool(m_Device, &poolInfo, nullptr, &slot.pool) != VK_SUCCESS)
+			{
+				destroyPools();
+				throw std::runtime_error("Can't create timestamp query pool.");
+			}
+			slot.scopeNames.reserve(m_MaxScopes);
+		}
+		m_Timestamps.resize(2 * m_MaxScopes);
+	}
+
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	~GpuProfiler()
+	{
+		destroyPools();
+	}
+
+	bool isEnabled() const
+	{
+		return !m_Slots.empty();
+	}
+
+	// Collects the slot's results from its previous use and resets its pool.
+	// Call right after beginning the slot's command buffer, outside a render pass.
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+	{
+		if (!isEnabled())
+		{
+			return;
+		}
+		m_Current = &m_Slots[frameIndex];
+		collect(*m_Current);
+		m_Current->scopeNames.clear();
+		vkCmdResetQueryPool(commandBuffer, m_Current->pool, 0, 2 * m_MaxScopes);
+	}
+
+	// Returns a scope id for endScope. Scopes past maxScopesPerFrame are dropped.
+	uint32_t beginScope(VkCommandBuffer commandBuffer, const char* name,
+		VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT)
+	{
+		if (!isEnabled() || m_Current->scopeNames.size() == m_MaxScopes)
+		{
+			return UINT32_MAX;
+		}
+		auto scope = static_cast<uint32_t>(m_Current->scopeNames.size());
+		m_Current->scopeNames.push_back(name);
+		vkCmdWriteTimestamp(commandBuffer, stage, m_Current->pool, 2 * scope);
+		return scope;
+	}
+
+	void endScope(VkCommandBuffer commandBuffer, uint32_t scope,
+		VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT)
+	{
+		if (scope == UINT32_MAX)
+		{
+			return;
+		}
+		vkCmdWriteTimestamp(commandBuffer, stage, m_Current->pool, 2 * scope + 1);
+	}
+
+	// Scopes in the order they were first seen.
+	std::vector<ScopeStats> getStats() const
+	{
+		std::vector<ScopeStats> stats;
+		for (auto name : m_ScopeOrder)
+		{
+			auto& series = m_Series.at(name);
+			std::vector<double> samples = series.samples;
+			ScopeStats s = { name, 0.0, 0.0, 0.0, samples.size() };
+			if (!samples.empty())
+			{
+				double sum = 0.0;
+				for (auto sample : samples)
+				{
+					sum += sample;
+				}
+				s.minMs = *std::min_element(samples.begin(), samples.end());
+				s.avgMs = sum / samples.size();
+				auto index = static_cast<size_t>(0.99 * (samples.size() - 1) + 0.5);
+				std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+				s.p99Ms = samples[index];
+			}
+			stats.push_back(s);
+		}
+		return stats;
+	}
+
+private:
+	class Slot {
+	public:
+		VkQueryPool pool = VK_NULL_HANDLE;
+		// Scopes written by the slot's last recorded frame, in query order.
+		std::vector<const char*> scopeNames;
+	};
+
+	class Series {
+	public:
+		std::vector<double> samples;
+		size_t cursor = 0;
+	};
+
+	class NameLess {
+	public:
+		bool operator()(const char* a, const char* b) const
+		{
+			return strcmp(a, b) < 0;
+		}
+	};
+
+	VkDevice m_Device;
+	float m_TimestampPeriod;
+	uint64_t m_TimestampMask;
+	uint32_t m_MaxScopes;
+	std::vector<Slot> m_Slots;
+	Slot* m_Current = nullptr;
+	std::vector<uint64_t> m_Timestamps;
+	std::map<const char*, Series, NameLess> m_Series;
+	std::vector<const char*> m_ScopeOrder;
+
+	void collect(Slot& slot)
+	{
+		if (slot.scopeNames.empty())
+		{
+			return;
+		}
+		auto queryCount = static_cast<uint32_t>(2 * slot.scopeNames.size());
+		// No WAIT_BIT: if the GPU hasn't finished the frame yet, skip its samples rather than block.
+		if (vkGetQueryPoolResults(m_Device, slot.pool, 0, queryCount, sizeof(uint64_t) * queryCount,
+			m_Timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		{
+			return;
+		}
+		for (size_t i = 0; i < slot.scopeNames.size(); ++i)
+		{
+			auto ticks = (m_Timestamps[2 * i + 1] - m_Timestamps[2 * i]) & m_TimestampMask;
+			record(slot.scopeNames[i], ticks * m_TimestampPeriod / 1e6);
+		}
+	}
+
+	void record(const char* name, double ms)
+	{
+		auto it = m_Series.find(name);
+		if (it == m_Series.end())
+		{
+			it = m_Series.emplace(name, Series()).first;
+			it->second.samples.reserve(WindowSize);
+			m_ScopeOrder.push_back(name);
+		}
+		auto& series = it->second;
+		if (series.samples.size() < WindowSize)
+		{
+			series.samples.push_back(ms);
+		}
+		else
+		{
+			series.samples[series.cursor] = ms;
+			series.cursor = (series.cursor + 1) % WindowSize;
+		}
+	}
+
+	void destroyPools()
+	{
+		for (auto& slot : m_Slots)
+		{
+			if (slot.pool != VK_NULL_HANDLE)
+			{
+				vkDestroyQueryPool(m_Device, slot.pool, nullptr);
+				slot.pool = VK_NULL_HANDLE;
+			}
+		}
+	}
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a, fed one field at a time. Shader cache file names are built
+// from it, so the bytes each call feeds in must stay the same across builds
+// and hosts.
+class Fnv1a {
+public:
+	static const uint64_t OffsetBasis = 14695981039346656037ull;
+	static const uint64_t Prime = 1099511628211ull;
+
+	explicit Fnv1a(uint64_t hash = OffsetBasis) :
+		m_Hash(hash)
+	{
+	}
+
+	Fnv1a& bytes(const void* data, size_t size)
+	{
+		auto p = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			m_Hash = (m_Hash ^ p[i]) * Prime;
+		}
+		return *this;
+	}
+
+	// Least significant byte first, whatever the host's byte order.
+	Fnv1a& value(uint64_t value)
+	{
+		for (int byte = 0; byte < 8; ++byte)
+		{
+			m_Hash = (m_Hash ^ ((value >> (byte * 8)) & 0xff)) * Prime;
+		}
+		return *this;
+	}
+
+	// Followed by a NUL, so that ("ab", "c") and ("a", "bc") hash differently.
+	Fnv1a& field(const std::string& text)
+	{
+		bytes(text.data(), text.size());
+		m_Hash = (m_Hash ^ 0) * Prime;
+		return *this;
+	}
+
+	uint64_t get() const
+	{
+		return m_Hash;
+	}
+
+private:
+	uint64_t m_Hash;
+};
@@ -0,0 +1,447 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Linear resources (buffers, linear images) and optimal-tiling images must not
+// share a bufferImageGranularity page, so they are sub-allocated from separate blocks.
+enum class ResourceKind {
+	Linear,
+	Optimal
+};
+
+class MemoryAllocation {
+public:
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	uint32_t memoryType = 0;
+	// Persistent mapping of this allocation for host-visible memory, otherwise nullptr.
+	void* mapped = nullptr;
+
+	bool isValid() const
+	{
+		return memory != VK_NULL_HANDLE;
+	}
+
+private:
+	friend class DeviceMemoryAllocator;
+	// Owning block, or nullptr for a dedicated allocation.
+	void* m_Block = nullptr;
+};
+
+class MemoryHeapStats {
+public:
+	uint32_t blockCount = 0;
+	uint32_t dedicatedCount = 0;
+	uint32_t allocationCount = 0;
+	// Bytes obtained from vkAllocateMemory, and the highest that has ever been.
+	VkDeviceSize reservedBytes = 0;
+	VkDeviceSize peakReservedBytes = 0;
+	// Bytes handed out to resources, including alignment padding.
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize freeBytes = 0;
+	VkDeviceSize largestFreeRange = 0;
+
+	// 0 when all free space in the blocks is one range, approaching 1 as it splinters.
+	double fragmentation() const
+	{
+		return freeBytes == 0 ? 0.0 : 1.0 - static_cast<double>(largestFreeRange) / freeBytes;
+	}
+};
+
+// Sub-allocates device memory from large per-memory-type blocks, so the number
+// of vkAllocateMemory calls stays far below maxMemoryAllocationCount. Free
+// space in a block is tracked by offset (for coalescing) and by size (for an
+// O(log n) best-fit search). Requests of at least half a block, or marked
+// dedicated, get their own VkDeviceMemory. Host-visible blocks are mapped once
+// for their lifetime. All methods are thread-safe.
+class DeviceMemoryAllocator {
+public:
+	static const VkDeviceSize DefaultBlockSize = 64ull * 1024 * 1024;
+
+	DeviceMemoryAllocator(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties,
+		const VkPhysicalDeviceLimits& limits, VkDeviceSize blockSize = DefaultBlockSize) :
+		m_Device(device),
+		m_MemoryProperties(memoryProperties),
+		m_MaxAllocationCount(limits.maxMemoryAllocationCount),
+		m_BlockSize(blockSize),
+		m_HeapPeaks(memoryProperties.memoryHeapCount, 0),
+		m_HeapReserved(memoryProperties.memoryHeapCount, 0)
+	{
+	}
+
+	DeviceMemoryAllocator(const DeviceMemoryAllocator&) = delete;
+	DeviceMemoryAllocator& operator=(const DeviceMemoryAllocator&) = delete;
+
+	~DeviceMemoryAllocator()
+	{
+		for (auto& block : m_Blocks)
+		{
+			if (block->mapped != nullptr)
+			{
+				vkUnmapMemory(m_Device, block->memory);
+			}
+			vkFreeMemory(m_Device, block->memory, nullptr);
+		}
+	}
+
+	// Picks a memory type allowed by typeBits that has all required flags,
+	// preferring one that also has the preferred flags.
+	uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0) const
+	{
+		auto fallback = UINT32_MAX;
+		for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; ++i)
+		{
+			auto flags = m_MemoryProperties.memoryTypes[i].propertyFlags;
+			if (!(typeBits & (1u << i)) || (flags & required) != required)
+			{
+				continue;
+			}
+			if ((flags & preferred) == preferred)
+			{
+				return i;
+			}
+			if (fallback == UINT32_MAX)
+			{
+				fallback = i;
+			}
+		}
+		if (fallback == UINT32_MAX)
+		{
+			throw std::runtime_error("No suitable memory type.");
+		}
+		return fallback;
+	}
+
+	VkMemoryPropertyFlags getMemoryTypeFlags(uint32_t memoryType) const
+	{
+		return m_MemoryProperties.memoryTypes[memoryType].propertyFlags;
+	}
+
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags required,
+		VkMemoryPropertyFlags preferred, ResourceKind kind, bool dedicated = false)
+	{
+		auto memoryType = findMemoryType(requirements.memoryTypeBits, required, preferred);
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (dedicated || requirements.size >= blockSizeFor(memoryType) / 2)
+		{
+			return allocateDedicated(requirements.size, memoryType);
+		}
+
+		for (auto& block : m_Blocks)
+		{
+			if (block->memoryType == memoryType && block->kind == kind)
+			{
+				MemoryAllocation allocation;
+				if (block->allocate(requirements.size, requirements.alignment, allocation))
+				{
+					return allocation;
+				}
+			}
+		}
+
+		auto& block = createBlock(memoryType, kind);
+		MemoryAllocation allocation;
+		if (!block.allocate(requirements.size, requirements.alignment, allocation))
+		{
+			throw std::runtime_error("Allocation does not fit in a fresh memory block.");
+		}
+		return allocation;
+	}
+
+	void free(MemoryAllocation& allocation)
+	{
+		if (!allocation.isValid())
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (allocation.m_Block == nullptr)
+		{
+			if (allocation.mapped != nullptr)
+			{
+				vkUnmapMemory(m_Device, allocation.memory);
+			}
+			vkFreeMemory(m_Device, allocation.memory, nullptr);
+			auto heap = heapOf(allocation.memoryType);
+			m_HeapReserved[heap] -= allocation.size;
+			--m_DedicatedByHeap[heap].count;
+			m_DedicatedByHeap[heap].bytes -= allocation.size;
+			--m_AllocationCount;
+		}
+		else
+		{
+			auto block = static_cast<Block*>(allocation.m_Block);
+			block->free(allocation.offset, allocation.size);
+			releaseIfRedundant(block);
+		}
+		allocation = MemoryAllocation();
+	}
+
+	std::vector<MemoryHeapStats> getHeapStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		std::vector<MemoryHeapStats> stats(m_MemoryProperties.memoryHeapCount);
+		for (auto& block : m_Blocks)
+		{
+			auto& heap = stats[heapOf(block->memoryType)];
+			++heap.blockCount;
+			heap.allocationCount += block->allocationCount;
+			heap.usedBytes += block->size - block->freeBytes;
+			heap.freeBytes += block->freeBytes;
+			if (!block->freeBySize.empty())
+			{
+				heap.largestFreeRange = std::max(heap.largestFreeRange, block->freeBySize.rbegin()->first);
+			}
+		}
+		for (uint32_t i = 0; i < stats.size(); ++i)
+		{
+			stats[i].reservedBytes = m_HeapReserved[i];
+			stats[i].peakReservedBytes = m_HeapPeaks[i];
+		}
+		for (auto& dedicated : m_DedicatedByHeap)
+		{
+			stats[dedicated.first].dedicatedCount = dedicated.second.count;
+			stats[dedicated.first].allocationCount += dedicated.second.count;
+			stats[dedicated.first].usedBytes += dedicated.second.bytes;
+		}
+		return stats;
+	}
+
+	// Sum of the per-heap peaks, an upper bound on the peak device memory footprint.
+	VkDeviceSize getPeakReservedBytes()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		VkDeviceSize peak = 0;
+		for (auto p : m_HeapPeaks)
+		{
+			peak += p;
+		}
+		return peak;
+	}
+
+private:
+	class Block {
+	public:
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint32_t memoryType = 0;
+		ResourceKind kind = ResourceKind::Linear;
+		void* mapped = nullptr;
+		uint32_t allocationCount = 0;
+		VkDeviceSize freeBytes = 0;
+		// offset -> size, and size -> offset for best fit.
+		std::map<VkDeviceSize, VkDeviceSize> freeByOffset;
+		std::multimap<VkDeviceSize, VkDeviceSize> freeBySize;
+
+		void addFreeRange(VkDeviceSize offset, VkDeviceSize rangeSize)
+		{
+			freeByOffset[offset] = rangeSize;
+			freeBySize.emplace(rangeSize, offset);
+		}
+
+		void removeFreeRange(VkDeviceSize offset, VkDeviceSize rangeSize)
+		{
+			freeByOffset.erase(offset);
+			auto range = freeBySize.equal_range(rangeSize);
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				if (it->second == offset)
+				{
+					freeBySize.erase(it);
+					break;
+				}
+			}
+		}
+
+		bool allocate(VkDeviceSize requestSize, VkDeviceSize alignment, MemoryAllocation& allocation)
+		{
+			alignment = std::max<VkDeviceSize>(alignment, 1);
+			// Smallest range that still fits once its start is aligned up.
+			for (auto it = freeBySize.lower_bound(requestSize); it != freeBySize.end(); ++it)
+			{
+				auto rangeOffset = it->second;
+				auto rangeSize = it->first;
+				auto alignedOffset = (rangeOffset + alignment - 1) / alignment * alignment;
+				auto padding = alignedOffset - rangeOffset;
+				if (padding + requestSize > rangeSize)
+				{
+					continue;
+				}
+				removeFreeRange(rangeOffset, rangeSize);
+				if (padding > 0)
+				{
+					addFreeRange(rangeOffset, padding);
+				}
+				auto tail = rangeSize - padding - requestSize;
+				if (tail > 0)
+				{
+					addFreeRange(alignedOffset + requestSize, tail);
+				}
+				freeBytes -= requestSize;
+				++allocationCount;
+
+				allocation.memory = memory;
+				allocation.offset = alignedOffset;
+				allocation.size = requestSize;
+				allocation.memoryType = memoryType;
+				allocation.mapped = mapped != nullptr ? static_cast<char*>(mapped) + alignedOffset : nullptr;
+				allocation.m_Block = this;
+				return true;
+			}
+			return false;
+		}
+
+		void free(VkDeviceSize offset, VkDeviceSize rangeSize)
+		{
+			freeBytes += rangeSize;
+			--allocationCount;
+			// Merge with the free neighbours on either side.
+			auto next = freeByOffset.lower_bound(offset);
+			if (next != freeByOffset.end() && next->first == offset + rangeSize)
+			{
+				rangeSize += next->second;
+				removeFreeRange(next->first, next->second);
+			}
+			auto prev = freeByOffset.lower_bound(offset);
+			if (prev != freeByOffset.begin())
+			{
+				--prev;
+				if (prev->first + prev->second == offset)
+				{
+					offset = prev->first;
+					rangeSize += prev->second;
+					removeFreeRange(prev->first, prev->second);
+				}
+			}
+			addFreeRange(offset, rangeSize);
+		}
+	};
+
+	class DedicatedTotals {
+	public:
+		uint32_t count = 0;
+		VkDeviceSize bytes = 0;
+	};
+
+	VkDevice m_Device;
+	VkPhysicalDeviceMemoryProperties m_MemoryProperties;
+	uint32_t m_MaxAllocationCount;
+	VkDeviceSize m_BlockSize;
+	std::mutex m_Mutex;
+	std::vector<std::unique_ptr<Block>> m_Blocks;
+	std::vector<VkDeviceSize> m_HeapPeaks;
+	std::vector<VkDeviceSize> m_HeapReserved;
+	std::map<uint32_t, DedicatedTotals> m_DedicatedByHeap;
+	uint32_t m_AllocationCount = 0;
+
+	uint32_t heapOf(uint32_t memoryType) const
+	{
+		return m_MemoryProperties.memoryTypes[memoryType].heapIndex;
+	}
+
+	bool isHostVisible(uint32_t memoryType) const
+	{
+		return (m_MemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+	}
+
+	// Small heaps (e.g. 256 MiB BAR windows) get proportionally smaller blocks.
+	VkDeviceSize blockSizeFor(uint32_t memoryType) const
+	{
+		auto heapSize = m_MemoryProperties.memoryHeaps[heapOf(memoryType)].size;
+		return std::min(m_BlockSize, std::max<VkDeviceSize>(heapSize / 8, 1024 * 1024));
+	}
+
+	VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType, void** mapped)
+	{
+		if (m_AllocationCount >= m_MaxAllocationCount)
+		{
+			throw std::runtime_error("maxMemoryAllocationCount reached.");
+		}
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryType;
+		allocInfo.pNext = nullptr;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		if (vkAllocateMemory(m_Device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't allocate " + std::to_string(size) + " bytes of device memory.");
+		}
+		*mapped = nullptr;
+		if (isHostVisible(memoryType) && vkMapMemory(m_Device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS)
+		{
+			vkFreeMemory(m_Device, memory, nullptr);
+			throw std::runtime_error("Can't map host-visible memory.");
+		}
+		++m_AllocationCount;
+		auto heap = heapOf(memoryType);
+		m_HeapReserved[heap] += size;
+		m_HeapPeaks[heap] = std::max(m_HeapPeaks[heap], m_HeapReserved[heap]);
+		return memory;
+	}
+
+	MemoryAllocation allocateDedicated(VkDeviceSize size, uint32_t memoryType)
+	{
+		MemoryAllocation allocation;
+		allocation.memory = allocateMemory(size, memoryType, &allocation.mapped);
+		allocation.offset = 0;
+		allocation.size = size;
+		allocation.memoryType = memoryType;
+		auto& totals = m_DedicatedByHeap[heapOf(memoryType)];
+		++totals.count;
+		totals.bytes += size;
+		return allocation;
+	}
+
+	Block& createBlock(uint32_t memoryType, ResourceKind kind)
+	{
+		auto block = std::make_unique<Block>();
+		block->size = blockSizeFor(memoryType);
+		block->memoryType = memoryType;
+		block->kind = kind;
+		block->memory = allocateMemory(block->size, memoryType, &block->mapped);
+		block->freeBytes = block->size;
+		block->addFreeRange(0, block->size);
+		m_Blocks.push_back(std::move(block));
+		return *m_Blocks.back();
+	}
+
+	// Frees an empty block unless it is the last one of its type and kind, so
+	// a steady allocate/free pattern doesn't bounce on vkAllocateMemory.
+	void releaseIfRedundant(Block* block)
+	{
+		if (block->allocationCount != 0)
+		{
+			return;
+		}
+		auto sameKind = std::count_if(m_Blocks.begin(), m_Blocks.end(), [block](const std::unique_ptr<Block>& other)
+		{
+			return other->memoryType == block->memoryType && other->kind == block->kind;
+		});
+		if (sameKind <= 1)
+		{
+			return;
+		}
+		if (block->mapped != nullptr)
+		{
+			vkUnmapMemory(m_Device, block->memory);
+		}
+		vkFreeMemory(m_Device, block->memory, nullptr);
+		m_HeapReserved[heapOf(block->memoryType)] -= block->size;
+		--m_AllocationCount;
+		m_Blocks.erase(std::find_if(m_Blocks.begin(), m_Blocks.end(), [block](const std::unique_ptr<Block>& other)
+		{
+			return other.get() == block;
+		}));
+	}
+};
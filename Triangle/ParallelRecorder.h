@@ -0,0 +1,172 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include <vector>
+
+// Splits a frame's draws into batches recorded as secondary command buffers
+// on a ThreadPool. Every worker has its own VkCommandPool per frame in flight;
+// beginFrame() resets the frame's pools in one call instead of freeing
+// buffers, and buffers are reused, so steady-state recording allocates no
+// Vulkan objects.
+class ParallelRecorder {
+public:
+	ParallelRecorder(VkDevice device, uint32_t queueFamily, uint32_t frameCount, ThreadPool& workerPool) :
+		m_Device(device),
+		m_WorkerPool(workerPool),
+		m_Frames(frameCount, std::vector<WorkerContext>(workerPool.size()))
+	{
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.pNext = nullptr;
+		for (auto& workers : m_Frames)
+		{
+			for (auto& worker : workers)
+			{
+				if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &worker.pool) != VK_SUCCESS)
+				{
+					destroyPools();
+					throw std::runtime_error("Can't create recording command pool.");
+				}
+			}
+		}
+	}
+
+	ParallelRecorder(const ParallelRecorder&) = delete;
+	ParallelRecorder& operator=(const ParallelRecorder&) = delete;
+
+	~ParallelRecorder()
+	{
+		destroyPools();
+	}
+
+	// Call once the frame's previous submission has completed.
+	void beginFrame(uint32_t frameIndex)
+	{
+		m_FrameIndex = frameIndex;
+		for (auto& worker : m_Frames[frameIndex])
+		{
+			vkResetCommandPool(m_Device, worker.pool, 0);
+			worker.usedBuffers = 0;
+		}
+	}
+
+	// Records itemCount items in batches of at least minBatchSize, calling
+	// record(commandBuffer, firstItem, endItem) on the workers. Returns the
+	// secondary buffers in item order, ready for vkCmdExecuteCommands.
+	template<typename Record>
+	std::vector<VkCommandBuffer> record(const VkCommandBufferInheritanceInfo& inheritance, uint32_t itemCount,
+		uint32_t minBatchSize, Record record)
+	{
+		minBatchSize = std::max(minBatchSize, 1u);
+		auto maxBatches = (itemCount + minBatchSize - 1) / minBatchSize;
+		auto batchCount = std::max(1u, std::min(m_WorkerPool.size(), maxBatches));
+		auto batchSize = (itemCount + batchCount - 1) / batchCount;
+
+		std::vector<std::future<VkCommandBuffer>> futures;
+		futures.reserve(batchCount);
+		for (uint32_t batch = 0; batch < batchCount; ++batch)
+		{
+			auto first = std::min(itemCount, batch * batchSize);
+			auto end = std::min(itemCount, first + batchSize);
+			futures.push_back(m_WorkerPool.submit([this, inheritance, first, end, record](uint32_t workerIndex)
+			{
+				auto commandBuffer = acquireBuffer(m_Frames[m_FrameIndex][workerIndex]);
+				VkCommandBufferBeginInfo beginInfo = {};
+				beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+				beginInfo.pInheritanceInfo = &inheritance;
+				beginInfo.pNext = nullptr;
+				if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Can't begin secondary command buffer.");
+				}
+				record(commandBuffer, first, end);
+				if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Can't record secondary command buffer.");
+				}
+				return commandBuffer;
+			}));
+		}
+
+		// Collect every batch before rethrowing, so no task still uses the pools.
+		std::vector<VkCommandBuffer> commandBuffers;
+		std::exception_ptr error;
+		for (auto& future : futures)
+		{
+			try
+			{
+				commandBuffers.push_back(future.get());
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+		}
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+		return commandBuffers;
+	}
+
+private:
+	class WorkerContext {
+	public:
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> buffers;
+		size_t usedBuffers = 0;
+	};
+
+	VkDevice m_Device;
+	ThreadPool& m_WorkerPool;
+	// Indexed [frame][worker].
+	std::vector<std::vector<WorkerContext>> m_Frames;
+	uint32_t m_FrameIndex = 0;
+
+	// Only called on the worker owning context, so no locking is needed.
+	VkCommandBuffer acquireBuffer(WorkerContext& context)
+	{
+		if (context.usedBuffers == context.buffers.size())
+		{
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = context.pool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+			allocInfo.pNext = nullptr;
+			VkCommandBuffer commandBuffer;
+			if (vkAllocateCommandBuffers(m_Device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Can't allocate secondary command buffer.");
+			}
+			context.buffers.push_back(commandBuffer);
+		}
+		return context.buffers[context.usedBuffers++];
+	}
+
+	void destroyPools()
+	{
+		for (auto& workers : m_Frames)
+		{
+			for (auto& worker : workers)
+			{
+				if (worker.pool != VK_NULL_HANDLE)
+				{
+					vkDestroyCommandPool(m_Device, worker.pool, nullptr);
+					worker.pool = VK_NULL_HANDLE;
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "Hash.h"
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Everything a graphics pipeline is built from, reduced to plain values. Shaders
+// are identified by a hash of their SPIR-V and the render pass by its
+// compatibility class, so two requests that would produce interchangeable
+// pipelines have equal keys even if they came from different handles.
+// Viewport and scissor are always dynamic and are not part of the key.
+class PipelineKey {
+public:
+	uint64_t vertexShader = 0;
+	uint64_t fragmentShader = 0;
+	uint64_t vertexLayout = 0;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkCullModeFlags cullMode = VK_CULL_MODE_NONE;
+	VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	VkBool32 blendEnable = VK_FALSE;
+	VkBlendFactor srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	VkBlendFactor dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+	VkBool32 depthTestEnable = VK_FALSE;
+	VkBool32 depthWriteEnable = VK_FALSE;
+	VkCompareOp depthCompareOp = VK_COMPARE_OP_NEVER;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	uint64_t renderPassClass = 0;
+	uint32_t subpass = 0;
+
+	// Clears state the pipeline ignores: cull mode and front face without
+	// polygons, blend factors without blending and depth state without a test.
+	void normalize()
+	{
+		if (topology != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST && topology != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP &&
+			topology != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN && topology != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST_WITH_ADJACENCY &&
+			topology != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP_WITH_ADJACENCY)
+		{
+			cullMode = VK_CULL_MODE_NONE;
+		}
+		if (cullMode == VK_CULL_MODE_NONE)
+		{
+			frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		}
+		if (!blendEnable)
+		{
+			srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+			dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+		}
+		if (!depthTestEnable)
+		{
+			depthWriteEnable = VK_FALSE;
+			depthCompareOp = VK_COMPARE_OP_NEVER;
+		}
+	}
+
+	bool operator==(const PipelineKey& other) const
+	{
+		return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader &&
+			vertexLayout == other.vertexLayout && topology == other.topology && cullMode == other.cullMode &&
+			frontFace == other.frontFace && blendEnable == other.blendEnable &&
+			srcColorBlendFactor == other.srcColorBlendFactor && dstColorBlendFactor == other.dstColorBlendFactor &&
+			depthTestEnable == other.depthTestEnable && depthWriteEnable == other.depthWriteEnable &&
+			depthCompareOp == other.depthCompareOp && samples == other.samples &&
+			renderPassClass == other.renderPassClass && subpass == other.subpass;
+	}
+
+	// Hashes the vertex input layout field by field, so struct padding never matters.
+	static uint64_t hashVertexLayout(const std::vector<VkVertexInputBindingDescription>& bindings,
+		const std::vector<VkVertexInputAttributeDescription>& attributes)
+	{
+		Fnv1a hash;
+		hash.value(bindings.size()).value(attributes.size());
+		for (auto& binding : bindings)
+		{
+			hash.value(binding.binding).value(binding.stride).value(binding.inputRate);
+		}
+		for (auto& attribute : attributes)
+		{
+			hash.value(attribute.location).value(attribute.binding).value(attribute.format).value(attribute.offset);
+		}
+		return hash.get();
+	}
+};
+
+class PipelineKeyHash {
+public:
+	size_t operator()(const PipelineKey& key) const
+	{
+		uint64_t values[] = {
+			key.vertexShader, key.fragmentShader, key.vertexLayout,
+			static_cast<uint64_t>(key.topology), key.cullMode, static_cast<uint64_t>(key.frontFace),
+			key.blendEnable, static_cast<uint64_t>(key.srcColorBlendFactor), static_cast<uint64_t>(key.dstColorBlendFactor),
+			key.depthTestEnable, key.depthWriteEnable, static_cast<uint64_t>(key.depthCompareOp),
+			static_cast<uint64_t>(key.samples), key.renderPassClass, key.subpass
+		};
+		Fnv1a hash;
+		for (auto value : values)
+		{
+			hash.value(value);
+		}
+		return static_cast<size_t>(hash.get());
+	}
+};
+
+// Graphics pipelines by PipelineKey. The first request for a key builds the
+// pipeline; every later one, from any thread, gets the same one back from a
+// hash map lookup without calling the driver. Entries are futures, so a
+// pipeline still compiling on a worker is shared rather than built twice.
+// The library owns its pipelines and destroys each one once in destroy().
+class PipelineLibrary {
+public:
+	explicit PipelineLibrary(VkDevice device) :
+		m_Device(device)
+	{
+	}
+
+	PipelineLibrary(const PipelineLibrary&) = delete;
+	PipelineLibrary& operator=(const PipelineLibrary&) = delete;
+
+	~PipelineLibrary()
+	{
+		destroy();
+	}
+
+	// Returns the pipeline for key, calling launch() on a miss to start
+	// building it. launch runs under the library's lock, so it should only
+	// hand the work to another thread (e.g. ThreadPool::submit).
+	std::shared_future<VkPipeline> request(const PipelineKey& key, const std::function<std::shared_future<VkPipeline>()>& launch)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto found = m_Pipelines.find(key);
+		if (found != m_Pipelines.end())
+		{
+			++m_Hits;
+			return found->second;
+		}
+		++m_Misses;
+		auto pipeline = launch();
+		m_Pipelines.emplace(key, pipeline);
+		return pipeline;
+	}
+
+	// Returns the pipeline for key, calling build() on this thread on a miss.
+	// Other threads asking for the same key meanwhile wait for this build.
+	VkPipeline get(const PipelineKey& key, const std::function<VkPipeline()>& build)
+	{
+		std::promise<VkPipeline> promise;
+		bool built = false;
+		auto pipeline = request(key, [&]
+		{
+			built = true;
+			return promise.get_future().share();
+		});
+		if (built)
+		{
+			try
+			{
+				promise.set_value(build());
+			}
+			catch (...)
+			{
+				// Leave the error with any waiters but let a later request try again.
+				promise.set_exception(std::current_exception());
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Pipelines.erase(key);
+				throw;
+			}
+		}
+		return pipeline.get();
+	}
+
+	// Removes the pipeline for key and hands it to the caller, who destroys it
+	// once nothing uses it. Returns VK_NULL_HANDLE if there is none.
+	VkPipeline evict(const PipelineKey& key)
+	{
+		std::shared_future<VkPipeline> pipeline;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			auto found = m_Pipelines.find(key);
+			if (found == m_Pipelines.end())
+			{
+				return VK_NULL_HANDLE;
+			}
+			pipeline = std::move(found->second);
+			m_Pipelines.erase(found);
+		}
+		try
+		{
+			return pipeline.get();
+		}
+		catch (const std::exception&)
+		{
+			return VK_NULL_HANDLE;
+		}
+	}
+
+	// Whether any pipeline is still being compiled, i.e. shader modules may be in use.
+	bool isBuilding() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (auto& entry : m_Pipelines)
+		{
+			if (entry.second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint32_t size() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return static_cast<uint32_t>(m_Pipelines.size());
+	}
+
+	uint64_t hits() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Hits;
+	}
+
+	uint64_t misses() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Misses;
+	}
+
+	// Waits for pipelines still compiling and destroys them all.
+	void destroy()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (auto& entry : m_Pipelines)
+		{
+			// A failed compile rethrows here; there is nothing to destroy for it.
+			try
+			{
+				vkDestroyPipeline(m_Device, entry.second.get(), nullptr);
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << e.what() << std::endl;
+			}
+		}
+		m_Pipelines.clear();
+	}
+
+private:
+	VkDevice m_Device;
+	mutable std::mutex m_Mutex;
+	std::unordered_map<PipelineKey, std::shared_future<VkPipeline>, PipelineKeyHash> m_Pipelines;
+	uint64_t m_Hits = 0;
+	uint64_t m_Misses = 0;
+};
@@ -0,0 +1,1518 @@
+#pragma once
+
+#include "DeletionQueue.h"
+#include "GpuProfiler.h"
+#include "Hash.h"
+#include "MemoryAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// How a pass uses a resource. Each access implies the pipeline stages, access
+// mask and, for images, the layout the graph synchronises it with.
+enum class RenderGraphAccess {
+	ColorAttachment,
+	DepthAttachment,
+	DepthReadOnly,
+	InputAttachment,
+	// Target of a multisampled colour attachment, resolved at the end of the subpass.
+	ResolveAttachment,
+	SampledFragment,
+	SampledCompute,
+	StorageReadCompute,
+	// Read-write storage access from a compute shader.
+	StorageWriteCompute,
+	VertexBuffer,
+	IndexBuffer,
+	IndirectBuffer,
+	TransferRead,
+	TransferWrite
+};
+
+enum class RenderGraphPassType {
+	Raster,
+	Compute,
+	Transfer
+};
+
+// Frame graph for one queue. Passes declare the resources they read and
+// write; compile() then
+// * drops passes that contribute nothing to an imported resource,
+// * orders the rest by their dependencies, preferring orders that keep
+//   raster passes next to each other,
+// * merges neighbouring raster passes that only share attachments into the
+//   subpasses of one render pass, with subpass dependencies between them,
+// * plans the pipeline barriers and layout transitions every other
+//   dependency needs, batched into one vkCmdPipelineBarrier per step, and
+// * places transient images whose lifetimes don't overlap in the same memory,
+//   except those only used as attachments inside one render pass: they are
+//   created TRANSIENT_ATTACHMENT and get LAZILY_ALLOCATED memory where the
+//   device has it, so their contents need never leave tile memory.
+// Everything is recorded for one queue. Transient images are shared by all
+// frames in flight, so their first use waits for the previous frame's uses
+// of the same memory.
+// Imported images and buffers are bound to this frame's handles before
+// execute(). Pass and resource names must be string literals or otherwise
+// outlive the graph; pass names are used as GpuProfiler scopes.
+class RenderGraph {
+public:
+	typedef uint32_t ResourceId;
+	typedef uint32_t PassId;
+
+	class PassBuilder {
+	public:
+		PassBuilder(RenderGraph& graph, PassId pass) :
+			m_Graph(graph),
+			m_Pass(pass)
+		{
+		}
+
+		// The attachment is loaded if it has contents, otherwise left undefined.
+		PassBuilder& color(ResourceId image)
+		{
+			m_Graph.addUse(m_Pass, image, RenderGraphAccess::ColorAttachment, nullptr);
+			return *this;
+		}
+
+		PassBuilder& clearColor(ResourceId image, const VkClearColorValue& value)
+		{
+			VkClearValue clear = {};
+			clear.color = value;
+			m_Graph.addUse(m_Pass, image, RenderGraphAccess::ColorAttachment, &clear);
+			return *this;
+		}
+
+		PassBuilder& depth(ResourceId image)
+		{
+			m_Graph.addUse(m_Pass, image, RenderGraphAccess::DepthAttachment, nullptr);
+			return *this;
+		}
+
+		PassBuilder& clearDepth(ResourceId image, const VkClearDepthStencilValue& value)
+		{
+			VkClearValue clear = {};
+			clear.depthStencil = value;
+			m_Graph.addUse(m_Pass, image, RenderGraphAccess::DepthAttachment, &clear);
+			return *this;
+		}
+
+		// Resolves the multisampled colour attachment source into target.
+		PassBuilder& resolve(ResourceId source, ResourceId target)
+		{
+			m_Graph.addUse(m_Pass, target, RenderGraphAccess::ResolveAttachment, nullptr);
+			m_Graph.m_Passes[m_Pass].uses.back().resolveSource = source;
+			return *this;
+		}
+
+		PassBuilder& read(ResourceId resource, RenderGraphAccess access)
+		{
+			if (describe(access).write)
+			{
+				throw std::runtime_error("Render graph read declared with a write access.");
+			}
+			m_Graph.addUse(m_Pass, resource, access, nullptr);
+			return *this;
+		}
+
+		PassBuilder& write(ResourceId resource, RenderGraphAccess access)
+		{
+			if (!describe(access).write)
+			{
+				throw std::runtime_error("Render graph write declared with a read access.");
+			}
+			m_Graph.addUse(m_Pass, resource, access, nullptr);
+			return *this;
+		}
+
+		// The pass's subpass is recorded from secondary command buffers.
+		PassBuilder& secondaryCommandBuffers()
+		{
+			m_Graph.m_Passes[m_Pass].contents = VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS;
+			return *this;
+		}
+
+		PassId id() const
+		{
+			return m_Pass;
+		}
+
+	private:
+		RenderGraph& m_Graph;
+		PassId m_Pass;
+	};
+
+	RenderGraph(VkDevice device, DeviceMemoryAllocator& allocator) :
+		m_Device(device),
+		m_Allocator(allocator)
+	{
+	}
+
+	RenderGraph(const RenderGraph&) = delete;
+	RenderGraph& operator=(const RenderGraph&) = delete;
+
+	~RenderGraph()
+	{
+		m_Retired.flush();
+		destroyTransients();
+		for (auto& step : m_Steps)
+		{
+			for (auto& framebuffer : step.framebuffers)
+			{
+				vkDestroyFramebuffer(m_Device, framebuffer.second, nullptr);
+			}
+			if (step.renderPass != VK_NULL_HANDLE)
+			{
+				vkDestroyRenderPass(m_Device, step.renderPass, nullptr);
+			}
+		}
+	}
+
+	// availableStage is where the image becomes usable, e.g. the stage a
+	// swap chain acquire semaphore is waited at. After its last use the image
+	// is left in finalLayout.
+	ResourceId importImage(const char* name, VkFormat format, VkSampleCountFlagBits samples,
+		VkImageLayout initialLayout, VkImageLayout finalLayout,
+		VkPipelineStageFlags availableStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.image = true;
+		resource.imported = true;
+		resource.format = format;
+		resource.samples = samples;
+		resource.initialLayout = initialLayout;
+		resource.finalLayout = finalLayout;
+		resource.availableStage = availableStage;
+		return addResource(resource);
+	}
+
+	ResourceId importBuffer(const char* name)
+	{
+		Resource resource;
+		resource.name = name;
+		return addResource(resource);
+	}
+
+	// An image the graph owns, the size of the graph's extent, whose contents
+	// don't outlive the frame. Its memory may be shared with other transients.
+	ResourceId createImage(const char* name, VkFormat format, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.image = true;
+		resource.format = format;
+		resource.samples = samples;
+		return addResource(resource);
+	}
+
+	PassBuilder addPass(const char* name, RenderGraphPassType type, std::function<void(VkCommandBuffer)> record)
+	{
+		if (m_Compiled)
+		{
+			throw std::runtime_error("Render graph passes must be added before compile().");
+		}
+		Pass pass;
+		pass.name = name;
+		pass.type = type;
+		pass.record = std::move(record);
+		m_Passes.push_back(std::move(pass));
+		return PassBuilder(*this, static_cast<PassId>(m_Passes.size() - 1));
+	}
+
+	// Builds the schedule and render passes, and the transient images at extent.
+	void compile(VkExtent2D extent)
+	{
+		if (m_Compiled)
+		{
+			throw std::runtime_error("Render graph is already compiled.");
+		}
+		cullPasses();
+		schedulePasses();
+		createRenderPasses();
+		m_Compiled = true;
+		m_Extent = extent;
+		createTransients();
+		planBarriers();
+
+		uint32_t renderPasses = 0;
+		uint32_t barriers = 0;
+		for (auto& step : m_Steps)
+		{
+			renderPasses += step.renderPass != VK_NULL_HANDLE ? 1 : 0;
+			barriers += static_cast<uint32_t>(step.barriers.size());
+		}
+		std::cout << "Compiled render graph: " << m_Order.size() << " of " << m_Passes.size() << " passes in "
+			<< m_Steps.size() << " steps, " << renderPasses << " render passes, " << barriers << " barriers." << std::endl;
+	}
+
+	// Recreates the transient images at extent. Framebuffers and images in use
+	// by frames before firstUnusedSerial are released by collect().
+	void setExtent(VkExtent2D extent, uint64_t firstUnusedSerial)
+	{
+		for (auto& step : m_Steps)
+		{
+			for (auto& framebuffer : step.framebuffers)
+			{
+				m_Retired.push(firstUnusedSerial, UniqueFramebuffer(m_Device, framebuffer.second));
+			}
+			step.framebuffers.clear();
+		}
+		for (auto& resource : m_Resources)
+		{
+			if (!resource.imported && resource.image && resource.handle != VK_NULL_HANDLE)
+			{
+				m_Retired.push(firstUnusedSerial, UniqueImageView(m_Device, resource.view));
+				m_Retired.push(firstUnusedSerial, UniqueImage(m_Device, resource.handle));
+				resource.handle = VK_NULL_HANDLE;
+				resource.view = VK_NULL_HANDLE;
+			}
+		}
+		for (auto& allocation : m_TransientMemory)
+		{
+			m_Retired.push(firstUnusedSerial, [this, allocation]() mutable
+			{
+				m_Allocator.free(allocation);
+			});
+		}
+		m_TransientMemory.clear();
+
+		m_Extent = extent;
+		createTransients();
+		planBarriers();
+	}
+
+	// Destroys what setExtent() retired once every frame before its
+	// firstUnusedSerial has completed.
+	void collect(uint64_t completedSerial)
+	{
+		m_Retired.collect(completedSerial);
+	}
+
+	void bindImage(ResourceId resource, VkImage image, VkImageView view)
+	{
+		auto& r = m_Resources.at(resource);
+		if (!r.imported || !r.image)
+		{
+			throw std::runtime_error(std::string("Render graph resource ") + r.name + " is not an imported image.");
+		}
+		r.handle = image;
+		r.view = view;
+	}
+
+	void bindBuffer(ResourceId resource, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE)
+	{
+		auto& r = m_Resources.at(resource);
+		if (r.image)
+		{
+			throw std::runtime_error(std::string("Render graph resource ") + r.name + " is not a buffer.");
+		}
+		r.buffer = buffer;
+		r.offset = offset;
+		r.size = size;
+	}
+
+	// Records every scheduled pass with its barriers. Each step gets a
+	// profiler scope named after its first pass.
+	void execute(VkCommandBuffer commandBuffer, GpuProfiler* profiler = nullptr)
+	{
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		for (size_t s = 0; s < m_Steps.size(); ++s)
+		{
+			auto& step = m_Steps[s];
+			auto scope = profiler != nullptr ? profiler->beginScope(commandBuffer, m_Passes[step.passes[0]].name) : UINT32_MAX;
+			if (!step.barriers.empty())
+			{
+				imageBarriers.clear();
+				bufferBarriers.clear();
+				for (auto& planned : step.barriers)
+				{
+					appendBarrier(planned, imageBarriers, bufferBarriers);
+				}
+				vkCmdPipelineBarrier(commandBuffer, step.srcStages, step.dstStages, 0, 0, nullptr,
+					static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+					static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+			}
+			if (step.renderPass == VK_NULL_HANDLE)
+			{
+				m_Passes[step.passes[0]].record(commandBuffer);
+			}
+			else
+			{
+				VkRenderPassBeginInfo beginInfo = {};
+				beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+				beginInfo.renderPass = step.renderPass;
+				beginInfo.framebuffer = getFramebuffer(step);
+				beginInfo.renderArea.offset = { 0, 0 };
+				beginInfo.renderArea.extent = m_Extent;
+				beginInfo.clearValueCount = static_cast<uint32_t>(step.clearValues.size());
+				beginInfo.pClearValues = step.clearValues.data();
+				beginInfo.pNext = nullptr;
+				for (size_t i = 0; i < step.passes.size(); ++i)
+				{
+					auto& pass = m_Passes[step.passes[i]];
+					if (i == 0)
+					{
+						vkCmdBeginRenderPass(commandBuffer, &beginInfo, pass.contents);
+					}
+					else
+					{
+						vkCmdNextSubpass(commandBuffer, pass.contents);
+					}
+					pass.record(commandBuffer);
+				}
+				vkCmdEndRenderPass(commandBuffer);
+			}
+			if (profiler != nullptr)
+			{
+				profiler->endScope(commandBuffer, scope);
+			}
+		}
+	}
+
+	// For pipelines and secondary command buffer inheritance.
+	VkRenderPass getRenderPass(PassId pass) const
+	{
+		return m_Steps.at(stepOf(pass)).renderPass;
+	}
+
+	uint32_t getSubpass(PassId pass) const
+	{
+		return m_Passes.at(pass).subpass;
+	}
+
+	// Equal for render passes a pipeline can be used with interchangeably:
+	// a hash of the attachment formats and sample counts and of the subpass
+	// references, leaving out load/store ops and layouts.
+	uint64_t getRenderPassCompatibility(PassId pass) const
+	{
+		return m_Steps.at(stepOf(pass)).compatibility;
+	}
+
+	// Framebuffer of the pass's render pass for the currently bound images.
+	VkFramebuffer getFramebuffer(PassId pass)
+	{
+		return getFramebuffer(m_Steps.at(stepOf(pass)));
+	}
+
+	// Bytes of transient image memory, and what it would take without aliasing.
+	VkDeviceSize getTransientBytes() const
+	{
+		return m_TransientBytes;
+	}
+
+	VkDeviceSize getUnaliasedTransientBytes() const
+	{
+		return m_UnaliasedTransientBytes;
+	}
+
+	// Transient images bound to lazily allocated memory, which isn't in the counts above.
+	uint32_t getLazyTransientCount() const
+	{
+		return m_LazyTransientCount;
+	}
+
+private:
+	class AccessInfo {
+	public:
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;
+		bool write;
+		bool attachment;
+		VkImageUsageFlags imageUsage;
+	};
+
+	class Use {
+	public:
+		PassId pass;
+		ResourceId resource;
+		RenderGraphAccess access;
+		bool clear;
+		VkClearValue clearValue;
+		// For ResolveAttachment, the colour attachment resolved into this one.
+		ResourceId resolveSource;
+	};
+
+	class Pass {
+	public:
+		const char* name;
+		RenderGraphPassType type;
+		std::function<void(VkCommandBuffer)> record;
+		VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE;
+		std::vector<Use> uses;
+		bool live = false;
+		uint32_t step = UINT32_MAX;
+		uint32_t subpass = 0;
+	};
+
+	class Resource {
+	public:
+		const char* name;
+		bool image = false;
+		bool imported = false;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+		VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags availableStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		VkImageUsageFlags usage = 0;
+		// Bound by the caller for imports, created by the graph for transients.
+		VkImage handle = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = VK_WHOLE_SIZE;
+		// First and last step using the resource.
+		uint32_t firstStep = UINT32_MAX;
+		uint32_t lastStep = 0;
+		// Transients bound to overlapping memory, and the stages and writes of
+		// every use in a frame, which the first use has to wait for.
+		std::vector<ResourceId> sharesMemoryWith;
+		VkPipelineStageFlags frameStages = 0;
+		VkAccessFlags frameWriteAccess = 0;
+	};
+
+	class PlannedBarrier {
+	public:
+		ResourceId resource;
+		VkAccessFlags srcAccess;
+		VkAccessFlags dstAccess;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+	};
+
+	// One pass, or a render pass whose subpasses are passes.
+	class Step {
+	public:
+		std::vector<PassId> passes;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		uint64_t compatibility = 0;
+		// Framebuffer attachment order.
+		std::vector<ResourceId> attachments;
+		std::vector<VkClearValue> clearValues;
+		// Whether each attachment is loaded; the others start undefined.
+		std::vector<bool> loads;
+		std::map<std::vector<VkImageView>, VkFramebuffer> framebuffers;
+		std::vector<PlannedBarrier> barriers;
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+	};
+
+	class ResourceState {
+	public:
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags writeStages = 0;
+		VkAccessFlags writeAccess = 0;
+		// Stages that read since the last write, and those the write was made visible to.
+		VkPipelineStageFlags readStages = 0;
+		VkPipelineStageFlags visibleStages = 0;
+		VkAccessFlags visibleAccess = 0;
+	};
+
+	VkDevice m_Device;
+	DeviceMemoryAllocator& m_Allocator;
+	std::vector<Pass> m_Passes;
+	std::vector<Resource> m_Resources;
+	std::vector<PassId> m_Order;
+	std::vector<Step> m_Steps;
+	bool m_Compiled = false;
+	VkExtent2D m_Extent = {};
+	std::vector<MemoryAllocation> m_TransientMemory;
+	VkDeviceSize m_TransientBytes = 0;
+	VkDeviceSize m_UnaliasedTransientBytes = 0;
+	uint32_t m_LazyTransientCount = 0;
+	DeletionQueue m_Retired;
+
+	static AccessInfo describe(RenderGraphAccess access)
+	{
+		switch (access)
+		{
+		case RenderGraphAccess::ColorAttachment:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, true, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+		case RenderGraphAccess::DepthAttachment:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true, true, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+		case RenderGraphAccess::DepthReadOnly:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false, true, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+		case RenderGraphAccess::InputAttachment:
+			return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, true, VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT };
+		case RenderGraphAccess::ResolveAttachment:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, true, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+		case RenderGraphAccess::SampledFragment:
+			return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false, VK_IMAGE_USAGE_SAMPLED_BIT };
+		case RenderGraphAccess::SampledCompute:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, false, VK_IMAGE_USAGE_SAMPLED_BIT };
+		case RenderGraphAccess::StorageReadCompute:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_GENERAL, false, false, VK_IMAGE_USAGE_STORAGE_BIT };
+		case RenderGraphAccess::StorageWriteCompute:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_GENERAL, true, false, VK_IMAGE_USAGE_STORAGE_BIT };
+		case RenderGraphAccess::VertexBuffer:
+			return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED, false, false, 0 };
+		case RenderGraphAccess::IndexBuffer:
+			return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED, false, false, 0 };
+		case RenderGraphAccess::IndirectBuffer:
+			return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED, false, false, 0 };
+		case RenderGraphAccess::TransferRead:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false, false, VK_IMAGE_USAGE_TRANSFER_SRC_BIT };
+		case RenderGraphAccess::TransferWrite:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true, false, VK_IMAGE_USAGE_TRANSFER_DST_BIT };
+		}
+		throw std::runtime_error("Unknown render graph access.");
+	}
+
+	static VkAccessFlags writeBits(VkAccessFlags access)
+	{
+		return access & (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+	}
+
+	static bool hasStencil(VkFormat format)
+	{
+		return format == VK_FORMAT_S8_UINT || format == VK_FORMAT_D16_UNORM_S8_UINT ||
+			format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+	}
+
+	static VkImageAspectFlags aspectOf(VkFormat format)
+	{
+		switch (format)
+		{
+		case VK_FORMAT_D16_UNORM:
+		case VK_FORMAT_X8_D24_UNORM_PACK32:
+		case VK_FORMAT_D32_SFLOAT:
+			return VK_IMAGE_ASPECT_DEPTH_BIT;
+		case VK_FORMAT_S8_UINT:
+			return VK_IMAGE_ASPECT_STENCIL_BIT;
+		case VK_FORMAT_D16_UNORM_S8_UINT:
+		case VK_FORMAT_D24_UNORM_S8_UINT:
+		case VK_FORMAT_D32_SFLOAT_S8_UINT:
+			return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+		default:
+			return VK_IMAGE_ASPECT_COLOR_BIT;
+		}
+	}
+
+	ResourceId addResource(const Resource& resource)
+	{
+		if (m_Compiled)
+		{
+			throw std::runtime_error("Render graph resources must be added before compile().");
+		}
+		m_Resources.push_back(resource);
+		return static_cast<ResourceId>(m_Resources.size() - 1);
+	}
+
+	void addUse(PassId pass, ResourceId resource, RenderGraphAccess access, const VkClearValue* clear)
+	{
+		auto& r = m_Resources.at(resource);
+		auto info = describe(access);
+		if (info.attachment && m_Passes[pass].type != RenderGraphPassType::Raster)
+		{
+			throw std::runtime_error(std::string("Pass ") + m_Passes[pass].name + " uses an attachment but isn't a raster pass.");
+		}
+		bool imageOnly = info.attachment || info.imageUsage == VK_IMAGE_USAGE_SAMPLED_BIT;
+		bool bufferOnly = info.imageUsage == 0;
+		if (r.image ? bufferOnly : imageOnly)
+		{
+			throw std::runtime_error(std::string("Render graph resource ") + r.name + " doesn't support that access.");
+		}
+		for (auto& use : m_Passes[pass].uses)
+		{
+			if (use.resource == resource)
+			{
+				throw std::runtime_error(std::string("Pass ") + m_Passes[pass].name + " uses " + r.name + " twice.");
+			}
+		}
+		Use use = {};
+		use.pass = pass;
+		use.resource = resource;
+		use.access = access;
+		use.clear = clear != nullptr;
+		use.resolveSource = UINT32_MAX;
+		if (clear != nullptr)
+		{
+			use.clearValue = *clear;
+		}
+		m_Passes[pass].uses.push_back(use);
+		r.usage |= info.imageUsage;
+	}
+
+	const Use* findUse(PassId pass, ResourceId resource) const
+	{
+		for (auto& use : m_Passes[pass].uses)
+		{
+			if (use.resource == resource)
+			{
+				return &use;
+			}
+		}
+		return nullptr;
+	}
+
+	// Passes that write an imported resource are live, and so is every pass
+	// writing something a live pass reads.
+	void cullPasses()
+	{
+		std::vector<bool> needed(m_Resources.size(), false);
+		for (size_t r = 0; r < m_Resources.size(); ++r)
+		{
+			needed[r] = m_Resources[r].imported;
+		}
+		for (size_t p = m_Passes.size(); p-- > 0;)
+		{
+			auto& pass = m_Passes[p];
+			for (auto& use : pass.uses)
+			{
+				pass.live = pass.live || (describe(use.access).write && needed[use.resource]);
+			}
+			if (!pass.live)
+			{
+				continue;
+			}
+			for (auto& use : pass.uses)
+			{
+				// Read-write accesses need the earlier contents, unless they clear or overwrite them.
+				auto info = describe(use.access);
+				bool overwrites = use.clear || use.access == RenderGraphAccess::ResolveAttachment;
+				if (!info.write || (info.attachment ? !overwrites : info.access != writeBits(info.access)))
+				{
+					needed[use.resource] = true;
+				}
+			}
+		}
+	}
+
+	// Whether pass can become another subpass after the passes in group:
+	// everything they share must be attachments, or reads in the same layout.
+	bool canMerge(const std::vector<PassId>& group, PassId pass) const
+	{
+		if (group.empty() || m_Passes[pass].type != RenderGraphPassType::Raster ||
+			m_Passes[group.back()].type != RenderGraphPassType::Raster)
+		{
+			return false;
+		}
+		for (auto& use : m_Passes[pass].uses)
+		{
+			auto info = describe(use.access);
+			for (auto other : group)
+			{
+				auto otherUse = findUse(other, use.resource);
+				if (otherUse == nullptr)
+				{
+					continue;
+				}
+				auto otherInfo = describe(otherUse->access);
+				if (info.attachment && otherInfo.attachment)
+				{
+					continue;
+				}
+				if (info.write || otherInfo.write || info.layout != otherInfo.layout)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Topological order of the live passes. Dependencies only run from earlier
+	// to later declarations, so declaration order is always valid. Among the
+	// passes that are ready, one that merges into the current render pass wins;
+	// otherwise compute and transfer passes go first, so that raster passes
+	// waiting on them can still end up next to each other.
+	void schedulePasses()
+	{
+		std::vector<std::vector<PassId>> successors(m_Passes.size());
+		std::vector<uint32_t> pending(m_Passes.size(), 0);
+		for (ResourceId r = 0; r < m_Resources.size(); ++r)
+		{
+			std::vector<const Use*> uses;
+			for (auto& pass : m_Passes)
+			{
+				auto use = pass.live ? findUse(static_cast<PassId>(&pass - m_Passes.data()), r) : nullptr;
+				if (use != nullptr)
+				{
+					uses.push_back(use);
+				}
+			}
+			for (size_t j = 0; j < uses.size(); ++j)
+			{
+				auto later = describe(uses[j]->access);
+				for (size_t i = 0; i < j; ++i)
+				{
+					auto earlier = describe(uses[i]->access);
+					if (earlier.write || later.write || (m_Resources[r].image && earlier.layout != later.layout))
+					{
+						successors[uses[i]->pass].push_back(uses[j]->pass);
+						++pending[uses[j]->pass];
+					}
+				}
+			}
+		}
+
+		std::vector<PassId> ready;
+		for (PassId p = 0; p < m_Passes.size(); ++p)
+		{
+			if (m_Passes[p].live && pending[p] == 0)
+			{
+				ready.push_back(p);
+			}
+		}
+		std::vector<PassId> group;
+		while (!ready.empty())
+		{
+			std::sort(ready.begin(), ready.end());
+			auto next = std::find_if(ready.begin(), ready.end(), [&](PassId p)
+			{
+				return canMerge(group, p);
+			});
+			if (next == ready.end())
+			{
+				next = std::find_if(ready.begin(), ready.end(), [&](PassId p)
+				{
+					return m_Passes[p].type != RenderGraphPassType::Raster;
+				});
+			}
+			if (next == ready.end())
+			{
+				next = ready.begin();
+			}
+			auto pass = *next;
+			ready.erase(next);
+			if (canMerge(group, pass))
+			{
+				group.push_back(pass);
+			}
+			else
+			{
+				if (!group.empty())
+				{
+					addStep(group);
+				}
+				group.assign(1, pass);
+			}
+			m_Order.push_back(pass);
+			for (auto successor : successors[pass])
+			{
+				if (--pending[successor] == 0)
+				{
+					ready.push_back(successor);
+				}
+			}
+		}
+		if (!group.empty())
+		{
+			addStep(group);
+		}
+	}
+
+	void addStep(const std::vector<PassId>& passes)
+	{
+		auto index = static_cast<uint32_t>(m_Steps.size());
+		Step step;
+		step.passes = passes;
+		for (uint32_t i = 0; i < passes.size(); ++i)
+		{
+			m_Passes[passes[i]].step = index;
+			m_Passes[passes[i]].subpass = i;
+			for (auto& use : m_Passes[passes[i]].uses)
+			{
+				auto& resource = m_Resources[use.resource];
+				auto info = describe(use.access);
+				resource.firstStep = std::min(resource.firstStep, index);
+				resource.lastStep = std::max(resource.lastStep, index);
+				resource.frameStages |= info.stages;
+				resource.frameWriteAccess |= writeBits(info.access);
+			}
+		}
+		m_Steps.push_back(std::move(step));
+	}
+
+	uint32_t stepOf(PassId pass) const
+	{
+		auto step = m_Passes.at(pass).step;
+		if (step == UINT32_MAX)
+		{
+			throw std::runtime_error(std::string("Pass ") + m_Passes[pass].name + " was culled or the graph isn't compiled.");
+		}
+		return step;
+	}
+
+	// One render pass per raster step. Attachments are moved into their first
+	// layout by a barrier before the render pass begins, so the render pass
+	// itself only needs dependencies between its subpasses.
+	void createRenderPasses()
+	{
+		for (uint32_t s = 0; s < m_Steps.size(); ++s)
+		{
+			auto& step = m_Steps[s];
+			if (m_Passes[step.passes[0]].type != RenderGraphPassType::Raster)
+			{
+				continue;
+			}
+			std::vector<VkAttachmentDescription> attachments;
+			std::vector<std::vector<VkAttachmentReference>> colorRefs(step.passes.size());
+			std::vector<std::vector<VkAttachmentReference>> inputRefs(step.passes.size());
+			std::vector<std::vector<VkAttachmentReference>> resolveRefs(step.passes.size());
+			std::vector<VkAttachmentReference> depthRefs(step.passes.size(), { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+			for (uint32_t i = 0; i < step.passes.size(); ++i)
+			{
+				for (auto& use : m_Passes[step.passes[i]].uses)
+				{
+					auto info = describe(use.access);
+					if (!info.attachment)
+					{
+						continue;
+					}
+					auto found = std::find(step.attachments.begin(), step.attachments.end(), use.resource);
+					auto index = static_cast<uint32_t>(found - step.attachments.begin());
+					if (found == step.attachments.end())
+					{
+						step.attachments.push_back(use.resource);
+						attachments.push_back(describeAttachment(s, use));
+						step.clearValues.push_back(use.clearValue);
+						step.loads.push_back(attachments.back().loadOp == VK_ATTACHMENT_LOAD_OP_LOAD);
+					}
+					VkAttachmentReference ref = { index, info.layout };
+					// Last use in the step decides the layout the render pass leaves.
+					auto& resource = m_Resources[use.resource];
+					attachments[index].finalLayout = resource.imported && resource.lastStep == s ? resource.finalLayout : info.layout;
+					if (use.access == RenderGraphAccess::ColorAttachment)
+					{
+						colorRefs[i].push_back(ref);
+					}
+					else if (use.access == RenderGraphAccess::InputAttachment)
+					{
+						inputRefs[i].push_back(ref);
+					}
+					else if (use.access == RenderGraphAccess::ResolveAttachment)
+					{
+						continue;
+					}
+					else
+					{
+						depthRefs[i] = ref;
+					}
+				}
+			}
+
+			// Resolve references run parallel to the colour references.
+			for (uint32_t i = 0; i < step.passes.size(); ++i)
+			{
+				for (auto& use : m_Passes[step.passes[i]].uses)
+				{
+					if (use.access != RenderGraphAccess::ResolveAttachment)
+					{
+						continue;
+					}
+					auto source = std::find(step.attachments.begin(), step.attachments.end(), use.resolveSource) - step.attachments.begin();
+					auto target = std::find(step.attachments.begin(), step.attachments.end(), use.resource) - step.attachments.begin();
+					auto color = std::find_if(colorRefs[i].begin(), colorRefs[i].end(), [&](const VkAttachmentReference& ref)
+					{
+						return ref.attachment == source;
+					});
+					if (color == colorRefs[i].end() || m_Resources[use.resolveSource].samples == VK_SAMPLE_COUNT_1_BIT ||
+						m_Resources[use.resource].samples != VK_SAMPLE_COUNT_1_BIT)
+					{
+						throw std::runtime_error(std::string("Pass ") + m_Passes[step.passes[i]].name +
+							" must resolve a multisampled colour attachment of its own into a single-sample image.");
+					}
+					resolveRefs[i].resize(colorRefs[i].size(), { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+					resolveRefs[i][color - colorRefs[i].begin()] = { static_cast<uint32_t>(target), describe(use.access).layout };
+				}
+			}
+
+			std::vector<VkSubpassDescription> subpasses(step.passes.size());
+			for (uint32_t i = 0; i < step.passes.size(); ++i)
+			{
+				subpasses[i] = {};
+				subpasses[i].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+				subpasses[i].colorAttachmentCount = static_cast<uint32_t>(colorRefs[i].size());
+				subpasses[i].pColorAttachments = colorRefs[i].data();
+				subpasses[i].pResolveAttachments = resolveRefs[i].empty() ? nullptr : resolveRefs[i].data();
+				subpasses[i].inputAttachmentCount = static_cast<uint32_t>(inputRefs[i].size());
+				subpasses[i].pInputAttachments = inputRefs[i].data();
+				subpasses[i].pDepthStencilAttachment = depthRefs[i].attachment != VK_ATTACHMENT_UNUSED ? &depthRefs[i] : nullptr;
+			}
+			auto dependencies = getSubpassDependencies(step);
+			step.compatibility = hashCompatibility(attachments, colorRefs, inputRefs, resolveRefs, depthRefs);
+
+			VkRenderPassCreateInfo createInfo = {};
+			createInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+			createInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			createInfo.pAttachments = attachments.data();
+			createInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+			createInfo.pSubpasses = subpasses.data();
+			createInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+			createInfo.pDependencies = dependencies.data();
+			createInfo.pNext = nullptr;
+			if (vkCreateRenderPass(m_Device, &createInfo, nullptr, &step.renderPass) != VK_SUCCESS)
+			{
+				throw std::runtime_error(std::string("Can't create render pass for ") + m_Passes[step.passes[0]].name + ".");
+			}
+		}
+	}
+
+	// 64-bit FNV-1a over everything render pass compatibility depends on.
+	static uint64_t hashCompatibility(const std::vector<VkAttachmentDescription>& attachments,
+		const std::vector<std::vector<VkAttachmentReference>>& colorRefs,
+		const std::vector<std::vector<VkAttachmentReference>>& inputRefs,
+		const std::vector<std::vector<VkAttachmentReference>>& resolveRefs,
+		const std::vector<VkAttachmentReference>& depthRefs)
+	{
+		Fnv1a hash;
+		auto mix = [&hash](uint64_t value)
+		{
+			hash.value(value);
+		};
+		mix(attachments.size());
+		for (auto& attachment : attachments)
+		{
+			mix(attachment.format);
+			mix(attachment.samples);
+		}
+		for (size_t i = 0; i < colorRefs.size(); ++i)
+		{
+			for (auto refs : { &colorRefs[i], &inputRefs[i], &resolveRefs[i] })
+			{
+				mix(refs->size());
+				for (auto& ref : *refs)
+				{
+					mix(ref.attachment);
+				}
+			}
+			mix(depthRefs[i].attachment);
+		}
+		return hash.get();
+	}
+
+	// Load from the first use in the step: clear if asked, load if an earlier
+	// step wrote the image (or it was imported with contents), else don't care.
+	// Stored only if a later step or the importer reads it.
+	VkAttachmentDescription describeAttachment(uint32_t step, const Use& use) const
+	{
+		auto& resource = m_Resources[use.resource];
+		bool hasContents = resource.imported && resource.initialLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+		for (uint32_t s = 0; s < step && !hasContents; ++s)
+		{
+			for (auto pass : m_Steps[s].passes)
+			{
+				auto earlier = findUse(pass, use.resource);
+				hasContents = hasContents || (earlier != nullptr && describe(earlier->access).write);
+			}
+		}
+		VkAttachmentDescription attachment = {};
+		attachment.format = resource.format;
+		attachment.samples = resource.samples;
+		attachment.loadOp = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR :
+			hasContents && use.access != RenderGraphAccess::ResolveAttachment ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.storeOp = resource.imported || resource.lastStep > step ?
+			VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.stencilLoadOp = hasStencil(resource.format) ? attachment.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = hasStencil(resource.format) ? attachment.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = describe(use.access).layout;
+		attachment.finalLayout = attachment.initialLayout;
+		return attachment;
+	}
+
+	// A dependency from every earlier subpass that used an attachment to a
+	// later one that writes it, reads what it wrote, or changes its layout.
+	std::vector<VkSubpassDependency> getSubpassDependencies(const Step& step) const
+	{
+		std::vector<VkSubpassDependency> dependencies;
+		for (uint32_t j = 1; j < step.passes.size(); ++j)
+		{
+			for (auto& use : m_Passes[step.passes[j]].uses)
+			{
+				auto later = describe(use.access);
+				for (uint32_t i = 0; i < j; ++i)
+				{
+					auto earlierUse = findUse(step.passes[i], use.resource);
+					if (earlierUse == nullptr)
+					{
+						continue;
+					}
+					auto earlier = describe(earlierUse->access);
+					if (!earlier.write && !later.write && earlier.layout == later.layout)
+					{
+						continue;
+					}
+					auto existing = std::find_if(dependencies.begin(), dependencies.end(), [&](const VkSubpassDependency& d)
+					{
+						return d.srcSubpass == i && d.dstSubpass == j;
+					});
+					if (existing == dependencies.end())
+					{
+						VkSubpassDependency dependency = {};
+						dependency.srcSubpass = i;
+						dependency.dstSubpass = j;
+						dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+						dependencies.push_back(dependency);
+						existing = dependencies.end() - 1;
+					}
+					existing->srcStageMask |= earlier.stages;
+					existing->srcAccessMask |= writeBits(earlier.access);
+					existing->dstStageMask |= later.stages;
+					existing->dstAccessMask |= later.access;
+				}
+			}
+		}
+		return dependencies;
+	}
+
+	// Creates every transient image at m_Extent and packs them into one
+	// allocation: each image takes the lowest offset that doesn't overlap an
+	// image whose lifetime overlaps its own.
+	void createTransients()
+	{
+		m_TransientBytes = 0;
+		m_UnaliasedTransientBytes = 0;
+		m_LazyTransientCount = 0;
+		std::vector<ResourceId> transients;
+		std::vector<VkMemoryRequirements> requirements(m_Resources.size());
+		uint32_t typeBits = ~0u;
+		for (ResourceId r = 0; r < m_Resources.size(); ++r)
+		{
+			auto& resource = m_Resources[r];
+			resource.sharesMemoryWith.clear();
+			if (resource.imported || !resource.image || resource.firstStep == UINT32_MAX)
+			{
+				continue;
+			}
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = resource.format;
+			imageInfo.extent = { m_Extent.width, m_Extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = resource.samples;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = resource.usage | (isTileOnly(r) ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageInfo.pNext = nullptr;
+			if (vkCreateImage(m_Device, &imageInfo, nullptr, &resource.handle) != VK_SUCCESS)
+			{
+				throw std::runtime_error(std::string("Can't create render graph image ") + resource.name + ".");
+			}
+			vkGetImageMemoryRequirements(m_Device, resource.handle, &requirements[r]);
+			if (isTileOnly(r))
+			{
+				auto memoryType = m_Allocator.findMemoryType(requirements[r].memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+				if ((m_Allocator.getMemoryTypeFlags(memoryType) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0)
+				{
+					// Only backed by physical memory if the tile contents ever have to spill.
+					m_TransientMemory.push_back(m_Allocator.allocate(requirements[r], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, ResourceKind::Optimal, true));
+					bindTransient(r, m_TransientMemory.back(), 0);
+					++m_LazyTransientCount;
+					continue;
+				}
+			}
+			typeBits &= requirements[r].memoryTypeBits;
+			m_UnaliasedTransientBytes += requirements[r].size;
+			transients.push_back(r);
+		}
+		if (transients.empty())
+		{
+			if (m_LazyTransientCount > 0)
+			{
+				std::cout << "Render graph: " << m_LazyTransientCount << " transient images in lazily allocated memory." << std::endl;
+			}
+			return;
+		}
+
+		std::vector<VkDeviceSize> offsets(m_Resources.size(), 0);
+		if (typeBits == 0)
+		{
+			// No memory type suits every image: give each its own memory.
+			for (auto r : transients)
+			{
+				m_TransientMemory.push_back(m_Allocator.allocate(requirements[r], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+					ResourceKind::Optimal));
+				bindTransient(r, m_TransientMemory.back(), 0);
+				m_TransientBytes += requirements[r].size;
+			}
+			return;
+		}
+
+		std::sort(transients.begin(), transients.end(), [&](ResourceId a, ResourceId b)
+		{
+			return requirements[a].size > requirements[b].size;
+		});
+		VkMemoryRequirements combined = {};
+		combined.memoryTypeBits = typeBits;
+		combined.alignment = 1;
+		std::vector<ResourceId> placed;
+		for (auto r : transients)
+		{
+			auto& resource = m_Resources[r];
+			auto alignment = requirements[r].alignment;
+			auto size = requirements[r].size;
+			auto overlapsLifetime = [&](ResourceId other)
+			{
+				return m_Resources[other].firstStep <= resource.lastStep && resource.firstStep <= m_Resources[other].lastStep;
+			};
+			// Candidates are 0 and the end of every image live at the same time.
+			std::vector<VkDeviceSize> candidates(1, 0);
+			for (auto other : placed)
+			{
+				if (overlapsLifetime(other))
+				{
+					candidates.push_back((offsets[other] + requirements[other].size + alignment - 1) / alignment * alignment);
+				}
+			}
+			std::sort(candidates.begin(), candidates.end());
+			for (auto candidate : candidates)
+			{
+				bool fits = true;
+				for (auto other : placed)
+				{
+					if (overlapsLifetime(other) && candidate < offsets[other] + requirements[other].size &&
+						offsets[other] < candidate + size)
+					{
+						fits = false;
+						break;
+					}
+				}
+				if (fits)
+				{
+					offsets[r] = candidate;
+					break;
+				}
+			}
+			for (auto other : placed)
+			{
+				if (!overlapsLifetime(other) && offsets[r] < offsets[other] + requirements[other].size &&
+					offsets[other] < offsets[r] + size)
+				{
+					resource.sharesMemoryWith.push_back(other);
+					m_Resources[other].sharesMemoryWith.push_back(r);
+				}
+			}
+			placed.push_back(r);
+			combined.size = std::max(combined.size, offsets[r] + size);
+			combined.alignment = std::max(combined.alignment, alignment);
+		}
+		m_TransientMemory.push_back(m_Allocator.allocate(combined, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, ResourceKind::Optimal));
+		for (auto r : transients)
+		{
+			bindTransient(r, m_TransientMemory.back(), offsets[r]);
+		}
+		m_TransientBytes = combined.size;
+		std::cout << "Render graph: " << transients.size() << " transient images in " << m_TransientBytes / 1024
+			<< " KiB (" << m_UnaliasedTransientBytes / 1024 << " KiB without aliasing), "
+			<< m_LazyTransientCount << " in lazily allocated memory." << std::endl;
+	}
+
+	// Whether the image is only used as an attachment within one render pass,
+	// so it is never loaded from or stored to memory.
+	bool isTileOnly(ResourceId r) const
+	{
+		auto& resource = m_Resources[r];
+		if (resource.imported || resource.firstStep != resource.lastStep ||
+			m_Steps[resource.firstStep].renderPass == VK_NULL_HANDLE)
+		{
+			return false;
+		}
+		for (auto pass : m_Steps[resource.firstStep].passes)
+		{
+			auto use = findUse(pass, r);
+			if (use != nullptr && !describe(use->access).attachment)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void bindTransient(ResourceId r, const MemoryAllocation& memory, VkDeviceSize offset)
+	{
+		auto& resource = m_Resources[r];
+		if (vkBindImageMemory(m_Device, resource.handle, memory.memory, memory.offset + offset) != VK_SUCCESS)
+		{
+			throw std::runtime_error(std::string("Can't bind render graph image ") + resource.name + ".");
+		}
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = resource.handle;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = resource.format;
+		viewInfo.components = {
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY };
+		viewInfo.subresourceRange.aspectMask = aspectOf(resource.format);
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		viewInfo.pNext = nullptr;
+		if (vkCreateImageView(m_Device, &viewInfo, nullptr, &resource.view) != VK_SUCCESS)
+		{
+			throw std::runtime_error(std::string("Can't create view of render graph image ") + resource.name + ".");
+		}
+	}
+
+	void destroyTransients()
+	{
+		for (auto& resource : m_Resources)
+		{
+			if (!resource.imported && resource.image)
+			{
+				vkDestroyImageView(m_Device, resource.view, nullptr);
+				vkDestroyImage(m_Device, resource.handle, nullptr);
+				resource.view = VK_NULL_HANDLE;
+				resource.handle = VK_NULL_HANDLE;
+			}
+		}
+		for (auto& allocation : m_TransientMemory)
+		{
+			m_Allocator.free(allocation);
+		}
+		m_TransientMemory.clear();
+	}
+
+	// Updates state for a use and reports the dependency it needs, if any.
+	// discard means the previous contents aren't needed, so an image may
+	// start from UNDEFINED.
+	bool transition(ResourceState& state, bool image, const AccessInfo& use, bool discard, VkPipelineStageFlags& srcStages,
+		VkAccessFlags& srcAccess, VkImageLayout& oldLayout)
+	{
+		bool layoutChange = image && state.layout != use.layout;
+		bool needed;
+		oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+		if (use.write || layoutChange)
+		{
+			// Wait for the last write and every read since, and flush the write.
+			srcStages = state.writeStages | state.readStages;
+			srcAccess = state.writeAccess;
+			needed = srcStages != 0 || layoutChange;
+			state.writeStages = use.stages;
+			state.writeAccess = writeBits(use.access);
+			state.readStages = use.write ? 0 : use.stages;
+			state.visibleStages = use.stages;
+			state.visibleAccess = use.access;
+		}
+		else
+		{
+			// A read only waits if the last write isn't visible to it yet.
+			srcStages = state.writeStages;
+			srcAccess = state.writeAccess;
+			needed = state.writeStages != 0 &&
+				((use.stages & ~state.visibleStages) != 0 || (use.access & ~state.visibleAccess) != 0);
+			state.readStages |= use.stages;
+			if (needed)
+			{
+				state.visibleStages |= use.stages;
+				state.visibleAccess |= use.access;
+			}
+		}
+		if (image)
+		{
+			state.layout = use.layout;
+		}
+		if (srcStages == 0)
+		{
+			srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		}
+		return needed;
+	}
+
+	// Walks the steps in order and records the barrier each one needs before it.
+	void planBarriers()
+	{
+		std::vector<ResourceState> states(m_Resources.size());
+		for (ResourceId r = 0; r < m_Resources.size(); ++r)
+		{
+			auto& resource = m_Resources[r];
+			if (resource.imported)
+			{
+				states[r].layout = resource.initialLayout;
+				if (resource.availableStage != VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT)
+				{
+					states[r].writeStages = resource.availableStage;
+				}
+			}
+		}
+		for (uint32_t s = 0; s < m_Steps.size(); ++s)
+		{
+			auto& step = m_Steps[s];
+			step.barriers.clear();
+			step.srcStages = 0;
+			step.dstStages = 0;
+			std::vector<ResourceId> seen;
+			for (auto pass : step.passes)
+			{
+				for (auto& use : m_Passes[pass].uses)
+				{
+					auto& resource = m_Resources[use.resource];
+					auto& state = states[use.resource];
+					auto info = describe(use.access);
+					bool first = std::find(seen.begin(), seen.end(), use.resource) == seen.end();
+					seen.push_back(use.resource);
+					if (!first && info.attachment)
+					{
+						// Later subpass uses are covered by the render pass's dependencies.
+						VkPipelineStageFlags ignoredStages;
+						VkAccessFlags ignoredAccess;
+						VkImageLayout ignoredLayout;
+						transition(state, resource.image, info, false, ignoredStages, ignoredAccess, ignoredLayout);
+						continue;
+					}
+					bool discard = false;
+					if (!resource.imported && resource.image && resource.firstStep == s)
+					{
+						// A transient's first use starts from nothing, but waits for every use of
+						// its memory, here or by the previous frame, before it.
+						discard = true;
+						state.writeStages = resource.frameStages;
+						state.writeAccess = resource.frameWriteAccess;
+						for (auto other : resource.sharesMemoryWith)
+						{
+							state.writeStages |= m_Resources[other].frameStages;
+							state.writeAccess |= m_Resources[other].frameWriteAccess;
+						}
+					}
+					if (info.attachment)
+					{
+						auto index = std::find(step.attachments.begin(), step.attachments.end(), use.resource) - step.attachments.begin();
+						discard = discard || !step.loads[index];
+					}
+					PlannedBarrier barrier = {};
+					barrier.resource = use.resource;
+					VkPipelineStageFlags srcStages;
+					if (transition(state, resource.image, info, discard, srcStages, barrier.srcAccess, barrier.oldLayout))
+					{
+						barrier.dstAccess = info.access;
+						barrier.newLayout = resource.image ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+						step.barriers.push_back(barrier);
+						step.srcStages |= srcStages;
+						step.dstStages |= info.stages;
+					}
+				}
+			}
+			if (step.renderPass == VK_NULL_HANDLE)
+			{
+				continue;
+			}
+			// The render pass leaves each attachment in its final layout.
+			for (auto r : step.attachments)
+			{
+				auto& resource = m_Resources[r];
+				if (resource.imported && resource.lastStep == s)
+				{
+					states[r].layout = resource.finalLayout;
+				}
+			}
+		}
+	}
+
+	void appendBarrier(const PlannedBarrier& planned, std::vector<VkImageMemoryBarrier>& imageBarriers,
+		std::vector<VkBufferMemoryBarrier>& bufferBarriers) const
+	{
+		auto& resource = m_Resources[planned.resource];
+		if (resource.image)
+		{
+			if (resource.handle == VK_NULL_HANDLE)
+			{
+				throw std::runtime_error(std::string("Render graph image ") + resource.name + " is not bound.");
+			}
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = planned.srcAccess;
+			barrier.dstAccessMask = planned.dstAccess;
+			barrier.oldLayout = planned.oldLayout;
+			barrier.newLayout = planned.newLayout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = resource.handle;
+			barrier.subresourceRange.aspectMask = aspectOf(resource.format);
+			barrier.subresourceRange.baseMipLevel = 0;
+			barrier.subresourceRange.levelCount = 1;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = 1;
+			barrier.pNext = nullptr;
+			imageBarriers.push_back(barrier);
+		}
+		else
+		{
+			if (resource.buffer == VK_NULL_HANDLE)
+			{
+				throw std::runtime_error(std::string("Render graph buffer ") + resource.name + " is not bound.");
+			}
+			VkBufferMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = planned.srcAccess;
+			barrier.dstAccessMask = planned.dstAccess;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = resource.buffer;
+			barrier.offset = resource.offset;
+			barrier.size = resource.size;
+			barrier.pNext = nullptr;
+			bufferBarriers.push_back(barrier);
+		}
+	}
+
+	VkFramebuffer getFramebuffer(Step& step)
+	{
+		std::vector<VkImageView> views;
+		for (auto r : step.attachments)
+		{
+			if (m_Resources[r].view == VK_NULL_HANDLE)
+			{
+				throw std::runtime_error(std::string("Render graph image ") + m_Resources[r].name + " is not bound.");
+			}
+			views.push_back(m_Resources[r].view);
+		}
+		auto found = step.framebuffers.find(views);
+		if (found != step.framebuffers.end())
+		{
+			return found->second;
+		}
+		VkFramebufferCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		createInfo.renderPass = step.renderPass;
+		createInfo.attachmentCount = static_cast<uint32_t>(views.size());
+		createInfo.pAttachments = views.data();
+		createInfo.width = m_Extent.width;
+		createInfo.height = m_Extent.height;
+		createInfo.layers = 1;
+		createInfo.pNext = nullptr;
+		VkFramebuffer framebuffer;
+		if (vkCreateFramebuffer(m_Device, &createInfo, nullptr, &framebuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Trouble creating render graph framebuffer.");
+		}
+		step.framebuffers.emplace(views, framebuffer);
+		return framebuffer;
+	}
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "Hash.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Read-only view of a SPIR-V module. Either a memory-mapped .spv file or an
+// array compiled into the binary; in both cases the words are used in place,
+// with no heap copy. Mapped views start on a page boundary, so the uint32_t
+// alignment vkCreateShaderModule needs is guaranteed.
+class ShaderBlob {
+public:
+	static const uint32_t SpirvMagic = 0x07230203;
+
+	ShaderBlob() = default;
+
+	ShaderBlob(const ShaderBlob&) = delete;
+	ShaderBlob& operator=(const ShaderBlob&) = delete;
+
+	ShaderBlob(ShaderBlob&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	ShaderBlob& operator=(ShaderBlob&& other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			m_Code = std::exchange(other.m_Code, nullptr);
+			m_Size = std::exchange(other.m_Size, 0);
+			m_Mapped = std::exchange(other.m_Mapped, false);
+		}
+		return *this;
+	}
+
+	~ShaderBlob()
+	{
+		release();
+	}
+
+	// Wraps SPIR-V embedded in the binary. The array must outlive the blob.
+	static ShaderBlob fromMemory(const uint32_t* code, size_t sizeInBytes)
+	{
+		ShaderBlob blob;
+		blob.m_Code = code;
+		blob.m_Size = sizeInBytes;
+		blob.validate("<embedded>");
+		return blob;
+	}
+
+	static ShaderBlob map(const std::filesystem::path& path)
+	{
+		ShaderBlob blob;
+#ifdef _WIN32
+		HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("ShaderBlob: Can't open file " + path.string() + ".");
+		}
+		LARGE_INTEGER fileSize = {};
+		GetFileSizeEx(file, &fileSize);
+		HANDLE mapping = fileSize.QuadPart > 0 ?
+			CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		// The view keeps the file alive; the handles are not needed past this point.
+		CloseHandle(file);
+		if (mapping == nullptr)
+		{
+			throw std::runtime_error("ShaderBlob: Can't map file " + path.string() + ".");
+		}
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (view == nullptr)
+		{
+			throw std::runtime_error("ShaderBlob: Can't map file " + path.string() + ".");
+		}
+		blob.m_Size = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			throw std::runtime_error("ShaderBlob: Can't open file " + path.string() + ".");
+		}
+		struct stat st = {};
+		fstat(fd, &st);
+		void* view = st.st_size > 0 ?
+			mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		close(fd);
+		if (view == MAP_FAILED)
+		{
+			throw std::runtime_error("ShaderBlob: Can't map file " + path.string() + ".");
+		}
+		blob.m_Size = static_cast<size_t>(st.st_size);
+#endif
+		blob.m_Code = static_cast<const uint32_t*>(view);
+		blob.m_Mapped = true;
+		blob.validate(path.string());
+		return blob;
+	}
+
+	const uint32_t* code() const
+	{
+		return m_Code;
+	}
+
+	size_t size() const
+	{
+		return m_Size;
+	}
+
+	// 64-bit FNV-1a of the SPIR-V words. Identifies the module's content, so
+	// pipelines built from equal modules can be shared.
+	uint64_t hash() const
+	{
+		return Fnv1a().bytes(m_Code, m_Size).get();
+	}
+
+private:
+	const uint32_t* m_Code = nullptr;
+	size_t m_Size = 0;
+	bool m_Mapped = false;
+
+	void validate(const std::string& name)
+	{
+		if (m_Size < sizeof(uint32_t) || m_Size % sizeof(uint32_t) != 0 || m_Code[0] != SpirvMagic)
+		{
+			throw std::runtime_error("ShaderBlob: " + name + " is not a SPIR-V module.");
+		}
+	}
+
+	void release()
+	{
+		if (m_Mapped)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(m_Code);
+#else
+			munmap(const_cast<uint32_t*>(m_Code), m_Size);
+#endif
+		}
+		m_Code = nullptr;
+		m_Size = 0;
+		m_Mapped = false;
+	}
+};
+
+// Directory holding the running executable, so data files next to it are
+// found no matter what the working directory is.
+inline std::filesystem::path getExecutableDirectory()
+{
+#ifdef _WIN32
+	wchar_t buffer[MAX_PATH];
+	DWORD length = GetModuleFileNameW(nullptr, buffer, MAX_PATH);
+	if (length > 0 && length < MAX_PATH)
+	{
+		return std::filesystem::path(buffer).parent_path();
+	}
+#else
+	std::error_code ec;
+	auto exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+	if (!ec)
+	{
+		return exe.parent_path();
+	}
+#endif
+	return std::filesystem::current_path();
+}
+
+// Per-user directory for generated files such as compiled shaders, which may
+// not be writable next to the executable: %LOCALAPPDATA% on Windows,
+// ~/Library/Caches on macOS and $XDG_CACHE_HOME or ~/.cache elsewhere, falling
+// back to the temporary directory.
+inline std::filesystem::path getCacheDirectory()
+{
+#if defined(_WIN32)
+	auto base = std::getenv("LOCALAPPDATA");
+	if (base != nullptr && *base != '\0')
+	{
+		return std::filesystem::path(base) / "VulkanTutorial";
+	}
+#elif defined(__APPLE__)
+	auto base = std::getenv("HOME");
+	if (base != nullptr && *base != '\0')
+	{
+		return std::filesystem::path(base) / "Library" / "Caches" / "VulkanTutorial";
+	}
+#else
+	auto base = std::getenv("XDG_CACHE_HOME");
+	if (base != nullptr && *base != '\0')
+	{
+		return std::filesystem::path(base) / "VulkanTutorial";
+	}
+	base = std::getenv("HOME");
+	if (base != nullptr && *base != '\0')
+	{
+		return std::filesystem::path(base) / ".cache" / "VulkanTutorial";
+	}
+#endif
+	std::error_code ec;
+	auto temp = std::filesystem::temp_directory_path(ec);
+	return (ec ? std::filesystem::current_path() : temp) / "VulkanTutorial";
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "Hash.h"
+#include "ShaderBlob.h"
+
+#include <shaderc/shaderc.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Identifies the shaderc build, which shaderc can't report about itself. The
+// CMake build passes a hash of the shaderc_combined library it links.
+#ifndef TRIANGLE_SHADERC_VERSION
+#error "Define TRIANGLE_SHADERC_VERSION to a string that changes with the linked shaderc."
+#endif
+
+// Compiles GLSL to SPIR-V in process with shaderc. Results are stored in
+// cacheDir as <hash>.spv, keyed on the source text, the defines and the
+// compiler version, so an unchanged shader only costs reading and hashing its
+// source. Shaders using #include are not tracked beyond their top-level file.
+class ShaderCompiler {
+public:
+	using Defines = std::vector<std::pair<std::string, std::string>>;
+
+	ShaderCompiler(std::filesystem::path sourceDir, std::filesystem::path cacheDir) :
+		m_SourceDir(std::move(sourceDir)),
+		m_CacheDir(std::move(cacheDir))
+	{
+		// The SPIR-V version is what the compiler targets, so it is keyed on as well
+		// as the compiler build and the optimisation level.
+		unsigned int version = 0;
+		unsigned int revision = 0;
+		shaderc_get_spv_version(&version, &revision);
+		m_CompilerVersion = std::string("shaderc ") + TRIANGLE_SHADERC_VERSION + " SPIR-V " + std::to_string(version) +
+			"." + std::to_string(revision) + " O" + std::to_string(static_cast<int>(OptimizationLevel));
+		std::filesystem::create_directories(m_CacheDir);
+	}
+
+	// sourceName is relative to the source directory, e.g. "shader.vert".
+	// The stage is taken from the extension.
+	ShaderBlob compile(const std::string& sourceName, const Defines& defines = {})
+	{
+		auto source = readSource(m_SourceDir / sourceName);
+		auto hash = hashKey(sourceName, source, defines);
+		auto cachePath = m_CacheDir / (toHex(hash) + ".spv");
+		if (std::filesystem::exists(cachePath))
+		{
+			std::cout << "Shader cache hit " << sourceName << std::endl;
+			return ShaderBlob::map(cachePath);
+		}
+
+		shaderc::CompileOptions options;
+		options.SetOptimizationLevel(OptimizationLevel);
+		for (auto& define : defines)
+		{
+			options.AddMacroDefinition(define.first, define.second);
+		}
+		auto result = m_Compiler.CompileGlslToSpv(source, stageFromName(sourceName), sourceName.c_str(), options);
+		if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+		{
+			throw std::runtime_error("ShaderCompiler: " + result.GetErrorMessage());
+		}
+		std::vector<uint32_t> spirv(result.cbegin(), result.cend());
+
+		// Rename into place so concurrent runs never see a partial file.
+		auto tmpPath = cachePath;
+		tmpPath += ".tmp";
+		{
+			std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+			if (!file)
+			{
+				throw std::runtime_error("ShaderCompiler: Can't write " + tmpPath.string() + ".");
+			}
+		}
+		std::filesystem::rename(tmpPath, cachePath);
+		std::cout << "Compiled shader " << sourceName << std::endl;
+		return ShaderBlob::map(cachePath);
+	}
+
+private:
+	static constexpr shaderc_optimization_level OptimizationLevel = shaderc_optimization_level_performance;
+
+	shaderc::Compiler m_Compiler;
+	std::filesystem::path m_SourceDir;
+	std::filesystem::path m_CacheDir;
+	std::string m_CompilerVersion;
+
+	static std::string readSource(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("ShaderCompiler: Can't open file " + path.string() + ".");
+		}
+		std::ostringstream contents;
+		contents << file.rdbuf();
+		return contents.str();
+	}
+
+	static shaderc_shader_kind stageFromName(const std::string& name)
+	{
+		auto extension = std::filesystem::path(name).extension().string();
+		if (extension == ".vert") return shaderc_vertex_shader;
+		if (extension == ".frag") return shaderc_fragment_shader;
+		if (extension == ".comp") return shaderc_compute_shader;
+		if (extension == ".geom") return shaderc_geometry_shader;
+		if (extension == ".tesc") return shaderc_tess_control_shader;
+		if (extension == ".tese") return shaderc_tess_evaluation_shader;
+		throw std::runtime_error("ShaderCompiler: Unknown shader stage for " + name + ".");
+	}
+
+	// Fields are NUL-terminated, so that ("ab", "c") and ("a", "bc") hash differently.
+	uint64_t hashKey(const std::string& sourceName, const std::string& source, const Defines& defines) const
+	{
+		Fnv1a hash;
+		hash.field(m_CompilerVersion).field(sourceName).field(source);
+		for (auto& define : defines)
+		{
+			hash.field(define.first).field(define.second);
+		}
+		return hash.get();
+	}
+
+	static std::string toHex(uint64_t value)
+	{
+		const char* digits = "0123456789abcdef";
+		std::string hex(16, '0');
+		for (int i = 15; i >= 0; --i)
+		{
+			hex[i] = digits[value & 0xf];
+			value >>= 4;
+		}
+		return hex;
+	}
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Reports files in one directory that have been written since the last
+// poll(). On Linux it reads inotify events from a non-blocking descriptor,
+// so a poll with nothing to report is a single read() that returns EAGAIN.
+// Elsewhere it compares modification times, at most every ScanInterval.
+// Only complete writes are reported: a file closed after writing, or one
+// renamed into the directory, which is how most editors save.
+class ShaderWatcher {
+public:
+	explicit ShaderWatcher(std::filesystem::path directory) :
+		m_Directory(std::move(directory))
+	{
+#ifdef __linux__
+		m_Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (m_Fd < 0)
+		{
+			throw std::runtime_error(std::string("ShaderWatcher: Can't create inotify instance: ") + strerror(errno) + ".");
+		}
+		if (inotify_add_watch(m_Fd, m_Directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			auto error = errno;
+			close(m_Fd);
+			throw std::runtime_error("ShaderWatcher: Can't watch " + m_Directory.string() + ": " + strerror(error) + ".");
+		}
+#else
+		if (!std::filesystem::is_directory(m_Directory))
+		{
+			throw std::runtime_error("ShaderWatcher: " + m_Directory.string() + " is not a directory.");
+		}
+		scan();
+#endif
+	}
+
+	ShaderWatcher(const ShaderWatcher&) = delete;
+	ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+	~ShaderWatcher()
+	{
+#ifdef __linux__
+		close(m_Fd);
+#endif
+	}
+
+	const std::filesystem::path& directory() const
+	{
+		return m_Directory;
+	}
+
+	// Names, relative to the directory, of files written since the last call.
+	// Never blocks.
+	std::vector<std::string> poll()
+	{
+		std::vector<std::string> changed;
+#ifdef __linux__
+		alignas(inotify_event) char buffer[4096];
+		for (;;)
+		{
+			auto length = read(m_Fd, buffer, sizeof(buffer));
+			if (length <= 0)
+			{
+				break;
+			}
+			for (char* p = buffer; p < buffer + length; )
+			{
+				auto event = reinterpret_cast<const inotify_event*>(p);
+				if (event->len > 0 && !(event->mask & IN_ISDIR))
+				{
+					changed.push_back(event->name);
+				}
+				p += sizeof(inotify_event) + event->len;
+			}
+		}
+#else
+		auto now = std::chrono::steady_clock::now();
+		if (now - m_LastScan < ScanInterval)
+		{
+			return changed;
+		}
+		m_LastScan = now;
+		changed = scan();
+#endif
+		// Editors often write a file more than once per save.
+		std::sort(changed.begin(), changed.end());
+		changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+		return changed;
+	}
+
+private:
+	std::filesystem::path m_Directory;
+#ifdef __linux__
+	int m_Fd = -1;
+#else
+	static constexpr std::chrono::milliseconds ScanInterval{ 250 };
+	std::map<std::string, std::filesystem::file_time_type> m_WriteTimes;
+	std::chrono::steady_clock::time_point m_LastScan = std::chrono::steady_clock::now();
+
+	// Records every file's write time and returns the files whose time changed.
+	std::vector<std::string> scan()
+	{
+		std::vector<std::string> changed;
+		std::error_code error;
+		for (auto& entry : std::filesystem::directory_iterator(m_Directory, error))
+		{
+			if (!entry.is_regular_file(error))
+			{
+				continue;
+			}
+			auto name = entry.path().filename().string();
+			auto writeTime = entry.last_write_time(error);
+			auto found = m_WriteTimes.find(name);
+			if (found != m_WriteTimes.end() && found->second != writeTime)
+			{
+				changed.push_back(name);
+			}
+			m_WriteTimes[name] = writeTime;
+		}
+		return changed;
+	}
+#endif
+};
@@ -1,3 +1,9 @@
-C:\VulkanSDK\1.1.106.0\Bin\glslangValidator.exe -V shader.frag
-C:\VulkanSDK\1.1.106.0\Bin\glslangValidator.exe -V shader.vert
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V -o shader.frag.spv shader.frag
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V -o shader.vert.spv shader.vert
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V -o instanced.vert.spv instanced.vert
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V -o cull.comp.spv cull.comp
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V --vn shaderFragSpv -o shader.frag.spv.h shader.frag
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V --vn shaderVertSpv -o shader.vert.spv.h shader.vert
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V --vn instancedVertSpv -o instanced.vert.spv.h instanced.vert
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V --vn cullCompSpv -o cull.comp.spv.h cull.comp
 pause
\ No newline at end of file
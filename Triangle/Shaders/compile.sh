@@ -0,0 +1,12 @@
+#!/bin/sh
+# Offline counterpart of compile.bat. Not needed when building with
+# TRIANGLE_RUNTIME_SHADERS, which compiles the GLSL at startup.
+set -e
+cd "$(dirname "$0")"
+for src in shader.vert shader.frag instanced.vert cull.comp; do
+	glslangValidator -V -o "$src.spv" "$src"
+done
+glslangValidator -V --vn shaderVertSpv -o shader.vert.spv.h shader.vert
+glslangValidator -V --vn shaderFragSpv -o shader.frag.spv.h shader.frag
+glslangValidator -V --vn instancedVertSpv -o instanced.vert.spv.h instanced.vert
+glslangValidator -V --vn cullCompSpv -o cull.comp.spv.h cull.comp
@@ -0,0 +1,18 @@
+#version 450
+
+layout(set = 1, binding = 0) uniform FrameUniforms
+{
+    mat4 viewProjection;
+} frame;
+
+layout(location = 0) in vec2 inPosition;
+// xy: position relative to the camera, z: scale. Written by cull.comp.
+layout(location = 1) in vec4 inInstance;
+
+layout(location = 0) out vec2 outUV;
+
+void main()
+{
+    gl_Position = frame.viewProjection * vec4(inPosition * inInstance.z + inInstance.xy, 0.0, 1.0);
+    outUV = inPosition + vec2(0.5);
+}
\ No newline at end of file
@@ -1,9 +1,26 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+// The bindless set (BindlessDescriptors.h); indices come from push constants.
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+layout(set = 0, binding = 1) readonly buffer Palette
+{
+    vec4 colors[];
+} palettes[];
+
+layout(push_constant) uniform DrawConstants
+{
+    uint textureIndex;
+    uint paletteIndex;
+    uint colorIndex;
+} draw;
+
+layout(location = 0) in vec2 inUV;
 
 layout(location = 0) out vec4 outColor;
 
 void main()
 {
-    outColor = vec4(1.0, 0.0, 0.0, 1.0);
+    outColor = texture(textures[draw.textureIndex], inUV) * palettes[draw.paletteIndex].colors[draw.colorIndex];
 }
\ No newline at end of file
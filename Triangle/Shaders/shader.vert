@@ -1,12 +1,22 @@
 #version 450
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// Set 1 lives in the uniform ring (UniformRing.h), bound with dynamic offsets.
+layout(set = 1, binding = 0) uniform FrameUniforms
+{
+    mat4 viewProjection;
+} frame;
+
+layout(set = 1, binding = 1) uniform ObjectUniforms
+{
+    mat4 model;
+} object;
+
+layout(location = 0) in vec2 inPosition;
+
+layout(location = 0) out vec2 outUV;
 
 void main()
 {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+    gl_Position = frame.viewProjection * object.model * vec4(inPosition, 0.0, 1.0);
+    outUV = inPosition + vec2(0.5);
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+
+// Hands out ranges of a persistently mapped staging buffer in ring order.
+// Ranges allocated since the last submit() are tagged with that submission's
+// serial and become reusable once reclaim() is given a completed serial at or
+// past it, so uploads never allocate and only wait when the ring is full.
+class StagingRing {
+public:
+	StagingRing(void* mapped, VkDeviceSize capacity) :
+		m_Mapped(static_cast<uint8_t*>(mapped)),
+		m_Capacity(capacity)
+	{
+	}
+
+	// Returns false when the ring has no room until more submissions complete.
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+	{
+		if (size > m_Capacity)
+		{
+			return false;
+		}
+		auto aligned = (m_Head + alignment - 1) / alignment * alignment;
+		VkDeviceSize consumed = 0;
+		if (m_Used == 0 || m_Head > m_Tail)
+		{
+			// Free space is [head, capacity) followed by [0, tail).
+			if (aligned + size <= m_Capacity)
+			{
+				offset = aligned;
+				consumed = aligned + size - m_Head;
+			}
+			else if (size <= m_Tail || m_Used == 0)
+			{
+				offset = 0;
+				consumed = m_Capacity - m_Head + size;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else if (aligned + size <= m_Tail)
+		{
+			offset = aligned;
+			consumed = aligned + size - m_Head;
+		}
+		else
+		{
+			return false;
+		}
+		m_Head = offset + size;
+		m_Used += consumed;
+		m_Pending += consumed;
+		return true;
+	}
+
+	void* data(VkDeviceSize offset) const
+	{
+		return m_Mapped + offset;
+	}
+
+	// Tags everything allocated since the previous submit() with serial.
+	void submit(uint64_t serial)
+	{
+		if (m_Pending == 0)
+		{
+			return;
+		}
+		m_InFlight.push_back({ serial, m_Pending, m_Head });
+		m_Pending = 0;
+	}
+
+	void reclaim(uint64_t completedSerial)
+	{
+		while (!m_InFlight.empty() && m_InFlight.front().serial <= completedSerial)
+		{
+			m_Used -= m_InFlight.front().bytes;
+			m_Tail = m_InFlight.front().end;
+			m_InFlight.pop_front();
+		}
+		if (m_Used == 0)
+		{
+			m_Head = 0;
+			m_Tail = 0;
+		}
+	}
+
+	VkDeviceSize capacity() const
+	{
+		return m_Capacity;
+	}
+
+	// Bytes in flight or awaiting submit, including padding and wrap waste.
+	VkDeviceSize used() const
+	{
+		return m_Used;
+	}
+
+private:
+	class Submission {
+	public:
+		uint64_t serial;
+		VkDeviceSize bytes;
+		VkDeviceSize end;
+	};
+
+	uint8_t* m_Mapped;
+	VkDeviceSize m_Capacity;
+	VkDeviceSize m_Head = 0;
+	VkDeviceSize m_Tail = 0;
+	VkDeviceSize m_Used = 0;
+	VkDeviceSize m_Pending = 0;
+	std::deque<Submission> m_InFlight;
+};
@@ -0,0 +1,625 @@
+// CPU-only tests for the header-only subsystems. The Vulkan entry points the
+// headers call are defined below as fakes that hand out handles and record
+// what they were given, so no loader, device or window is needed.
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include "DeletionQueue.h"
+#include "FrustumCuller.h"
+#include "Hash.h"
+#include "PipelineLibrary.h"
+#include "RenderGraph.h"
+#include "StagingRing.h"
+#include "ThreadPool.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+class FakeDevice {
+public:
+	int renderPasses = 0;
+	int framebuffers = 0;
+	int images = 0;
+	int imageViews = 0;
+	int memoryObjects = 0;
+	int destroyedBuffers = 0;
+	std::vector<VkImage> createdImages;
+	std::map<VkImage, VkDeviceSize> imageSizes;
+	std::map<VkImage, std::pair<VkDeviceMemory, VkDeviceSize>> imageBindings;
+	uint64_t nextHandle = 0;
+};
+
+FakeDevice g_Device;
+int g_Failures = 0;
+
+// Non-dispatchable handles are pointers on 64-bit targets and uint64_t on
+// 32-bit ones; either way a fresh non-zero value will do.
+template<typename Handle>
+Handle makeHandle()
+{
+	auto value = ++g_Device.nextHandle;
+	Handle handle = {};
+	memcpy(&handle, &value, sizeof(handle) < sizeof(value) ? sizeof(handle) : sizeof(value));
+	return handle;
+}
+
+void check(bool condition, const std::string& what)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		++g_Failures;
+	}
+}
+
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateRenderPass(VkDevice, const VkRenderPassCreateInfo*, const VkAllocationCallbacks*, VkRenderPass* renderPass)
+{
+	++g_Device.renderPasses;
+	*renderPass = makeHandle<VkRenderPass>();
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyRenderPass(VkDevice, VkRenderPass renderPass, const VkAllocationCallbacks*)
+{
+	g_Device.renderPasses -= renderPass != VK_NULL_HANDLE ? 1 : 0;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateFramebuffer(VkDevice, const VkFramebufferCreateInfo*, const VkAllocationCallbacks*, VkFramebuffer* framebuffer)
+{
+	++g_Device.framebuffers;
+	*framebuffer = makeHandle<VkFramebuffer>();
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyFramebuffer(VkDevice, VkFramebuffer framebuffer, const VkAllocationCallbacks*)
+{
+	g_Device.framebuffers -= framebuffer != VK_NULL_HANDLE ? 1 : 0;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateImage(VkDevice, const VkImageCreateInfo* createInfo, const VkAllocationCallbacks*, VkImage* image)
+{
+	++g_Device.images;
+	*image = makeHandle<VkImage>();
+	g_Device.createdImages.push_back(*image);
+	g_Device.imageSizes[*image] = static_cast<VkDeviceSize>(createInfo->extent.width) * createInfo->extent.height * 4;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyImage(VkDevice, VkImage image, const VkAllocationCallbacks*)
+{
+	g_Device.images -= image != VK_NULL_HANDLE ? 1 : 0;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateImageView(VkDevice, const VkImageViewCreateInfo*, const VkAllocationCallbacks*, VkImageView* view)
+{
+	++g_Device.imageViews;
+	*view = makeHandle<VkImageView>();
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyImageView(VkDevice, VkImageView view, const VkAllocationCallbacks*)
+{
+	g_Device.imageViews -= view != VK_NULL_HANDLE ? 1 : 0;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetImageMemoryRequirements(VkDevice, VkImage image, VkMemoryRequirements* requirements)
+{
+	requirements->size = g_Device.imageSizes[image];
+	requirements->alignment = 4096;
+	requirements->memoryTypeBits = 1;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkBindImageMemory(VkDevice, VkImage image, VkDeviceMemory memory, VkDeviceSize offset)
+{
+	g_Device.imageBindings[image] = { memory, offset };
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkAllocateMemory(VkDevice, const VkMemoryAllocateInfo*, const VkAllocationCallbacks*, VkDeviceMemory* memory)
+{
+	++g_Device.memoryObjects;
+	*memory = makeHandle<VkDeviceMemory>();
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkFreeMemory(VkDevice, VkDeviceMemory memory, const VkAllocationCallbacks*)
+{
+	g_Device.memoryObjects -= memory != VK_NULL_HANDLE ? 1 : 0;
+}
+
+// The fake device has no host-visible memory, so nothing is ever mapped.
+VKAPI_ATTR VkResult VKAPI_CALL vkMapMemory(VkDevice, VkDeviceMemory, VkDeviceSize, VkDeviceSize, VkMemoryMapFlags, void**)
+{
+	return VK_ERROR_MEMORY_MAP_FAILED;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkUnmapMemory(VkDevice, VkDeviceMemory)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdPipelineBarrier(VkCommandBuffer, VkPipelineStageFlags, VkPipelineStageFlags, VkDependencyFlags,
+	uint32_t, const VkMemoryBarrier*, uint32_t, const VkBufferMemoryBarrier*, uint32_t, const VkImageMemoryBarrier*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdBeginRenderPass(VkCommandBuffer, const VkRenderPassBeginInfo*, VkSubpassContents)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdNextSubpass(VkCommandBuffer, VkSubpassContents)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdEndRenderPass(VkCommandBuffer)
+{
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateQueryPool(VkDevice, const VkQueryPoolCreateInfo*, const VkAllocationCallbacks*, VkQueryPool* pool)
+{
+	*pool = makeHandle<VkQueryPool>();
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyQueryPool(VkDevice, VkQueryPool, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdResetQueryPool(VkCommandBuffer, VkQueryPool, uint32_t, uint32_t)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdWriteTimestamp(VkCommandBuffer, VkPipelineStageFlagBits, VkQueryPool, uint32_t)
+{
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkGetQueryPoolResults(VkDevice, VkQueryPool, uint32_t, uint32_t, size_t, void*, VkDeviceSize, VkQueryResultFlags)
+{
+	return VK_NOT_READY;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyBuffer(VkDevice, VkBuffer buffer, const VkAllocationCallbacks*)
+{
+	g_Device.destroyedBuffers += buffer != VK_NULL_HANDLE ? 1 : 0;
+}
+
+// Referenced by the handle aliases in VulkanHandle.h.
+VKAPI_ATTR void VKAPI_CALL vkDestroySampler(VkDevice, VkSampler, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyPipeline(VkDevice, VkPipeline, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyPipelineLayout(VkDevice, VkPipelineLayout, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyPipelineCache(VkDevice, VkPipelineCache, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyShaderModule(VkDevice, VkShaderModule, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyDescriptorSetLayout(VkDevice, VkDescriptorSetLayout, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyDescriptorPool(VkDevice, VkDescriptorPool, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyCommandPool(VkDevice, VkCommandPool, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroySwapchainKHR(VkDevice, VkSwapchainKHR, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroySemaphore(VkDevice, VkSemaphore, const VkAllocationCallbacks*)
+{
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyFence(VkDevice, VkFence, const VkAllocationCallbacks*)
+{
+}
+
+namespace {
+
+// One 1 GiB device-local heap, without lazily allocated memory.
+std::unique_ptr<DeviceMemoryAllocator> makeAllocator(VkDeviceSize blockSize = 64ull * 1024 * 1024)
+{
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	memoryProperties.memoryTypeCount = 1;
+	memoryProperties.memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	memoryProperties.memoryTypes[0].heapIndex = 0;
+	memoryProperties.memoryHeapCount = 1;
+	memoryProperties.memoryHeaps[0].size = 1ull << 30;
+	VkPhysicalDeviceLimits limits = {};
+	limits.maxMemoryAllocationCount = 4096;
+	return std::make_unique<DeviceMemoryAllocator>(VK_NULL_HANDLE, memoryProperties, limits, blockSize);
+}
+
+void testRenderGraphSchedule()
+{
+	auto allocator = makeAllocator();
+	std::vector<std::string> recorded;
+	auto recorder = [&recorded](const char* name)
+	{
+		return [&recorded, name](VkCommandBuffer)
+		{
+			recorded.push_back(name);
+		};
+	};
+	{
+		RenderGraph graph(VK_NULL_HANDLE, *allocator);
+		auto backbuffer = graph.importImage("backbuffer", VK_FORMAT_B8G8R8A8_UNORM, VK_SAMPLE_COUNT_1_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		auto albedo = graph.createImage("albedo", VK_FORMAT_R16G16B16A16_SFLOAT);
+		auto depth = graph.createImage("depth", VK_FORMAT_D32_SFLOAT);
+		auto unused = graph.createImage("unused", VK_FORMAT_R16G16B16A16_SFLOAT);
+		auto blurred = graph.createImage("blurred", VK_FORMAT_R16G16B16A16_SFLOAT);
+		auto instances = graph.importBuffer("instances");
+		auto drawCommand = graph.importBuffer("drawCommand");
+
+		graph.addPass("reset", RenderGraphPassType::Transfer, recorder("reset"))
+			.write(drawCommand, RenderGraphAccess::TransferWrite);
+		graph.addPass("cull", RenderGraphPassType::Compute, recorder("cull"))
+			.read(instances, RenderGraphAccess::StorageReadCompute)
+			.write(drawCommand, RenderGraphAccess::StorageWriteCompute);
+		auto debug = graph.addPass("debug", RenderGraphPassType::Raster, recorder("debug"))
+			.clearColor(unused, { { 0.0f, 0.0f, 0.0f, 0.0f } });
+		auto gbuffer = graph.addPass("gbuffer", RenderGraphPassType::Raster, recorder("gbuffer"))
+			.read(drawCommand, RenderGraphAccess::IndirectBuffer)
+			.clearColor(albedo, { { 0.0f, 0.0f, 0.0f, 0.0f } })
+			.clearDepth(depth, { 1.0f, 0 });
+		graph.addPass("blur", RenderGraphPassType::Compute, recorder("blur"))
+			.write(blurred, RenderGraphAccess::StorageWriteCompute);
+		auto lighting = graph.addPass("lighting", RenderGraphPassType::Raster, recorder("lighting"))
+			.read(albedo, RenderGraphAccess::InputAttachment)
+			.read(depth, RenderGraphAccess::DepthReadOnly)
+			.read(blurred, RenderGraphAccess::SampledFragment)
+			.clearColor(backbuffer, { { 0.0f, 0.0f, 0.0f, 1.0f } });
+		graph.compile({ 256, 256 });
+
+		graph.bindImage(backbuffer, makeHandle<VkImage>(), makeHandle<VkImageView>());
+		graph.bindBuffer(instances, makeHandle<VkBuffer>());
+		graph.bindBuffer(drawCommand, makeHandle<VkBuffer>());
+		graph.execute(VK_NULL_HANDLE);
+
+		// debug only writes an image nothing reads, so it and its image are dropped.
+		bool debugCulled = false;
+		try
+		{
+			graph.getRenderPass(debug.id());
+		}
+		catch (const std::exception&)
+		{
+			debugCulled = true;
+		}
+		check(debugCulled, "pass without an imported output is culled");
+		check(g_Device.images == 3, "culled pass's transient image is never created");
+
+		// The independent blur is moved ahead so gbuffer and lighting can share a render pass.
+		std::vector<std::string> expected = { "reset", "cull", "blur", "gbuffer", "lighting" };
+		check(recorded == expected, "passes are recorded in dependency order with raster passes together");
+		check(graph.getRenderPass(gbuffer.id()) == graph.getRenderPass(lighting.id()), "gbuffer and lighting share a render pass");
+		check(graph.getSubpass(gbuffer.id()) == 0 && graph.getSubpass(lighting.id()) == 1, "lighting is the second subpass");
+		check(g_Device.renderPasses == 1, "one render pass is created");
+
+		// Resizing retires the old images until their last frame completes.
+		graph.setExtent({ 128, 128 }, 10);
+		check(g_Device.images == 6, "resized images coexist with the retired ones");
+		graph.collect(8);
+		check(g_Device.images == 6, "retired images outlive frames still in flight");
+		graph.collect(9);
+		check(g_Device.images == 3, "retired images are destroyed once their frames complete");
+	}
+	allocator.reset();
+	check(g_Device.renderPasses == 0 && g_Device.framebuffers == 0 && g_Device.images == 0 &&
+		g_Device.imageViews == 0 && g_Device.memoryObjects == 0, "render graph releases everything it created");
+}
+
+void testRenderGraphAliasing()
+{
+	auto allocator = makeAllocator();
+	{
+		RenderGraph graph(VK_NULL_HANDLE, *allocator);
+		auto backbuffer = graph.importImage("backbuffer", VK_FORMAT_B8G8R8A8_UNORM, VK_SAMPLE_COUNT_1_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		// A chain of compute passes: each image is dead once the next pass has read it.
+		const char* names[] = { "blur0", "blur1", "blur2", "blur3" };
+		std::vector<RenderGraph::ResourceId> chain;
+		for (auto name : names)
+		{
+			chain.push_back(graph.createImage(name, VK_FORMAT_R16G16B16A16_SFLOAT));
+		}
+		graph.addPass("blur0", RenderGraphPassType::Compute, [](VkCommandBuffer) {})
+			.write(chain[0], RenderGraphAccess::StorageWriteCompute);
+		for (size_t i = 1; i < chain.size(); ++i)
+		{
+			graph.addPass(names[i], RenderGraphPassType::Compute, [](VkCommandBuffer) {})
+				.read(chain[i - 1], RenderGraphAccess::SampledCompute)
+				.write(chain[i], RenderGraphAccess::StorageWriteCompute);
+		}
+		graph.addPass("composite", RenderGraphPassType::Raster, [](VkCommandBuffer) {})
+			.read(chain.back(), RenderGraphAccess::SampledFragment)
+			.clearColor(backbuffer, { { 0.0f, 0.0f, 0.0f, 1.0f } });
+		g_Device.createdImages.clear();
+		graph.compile({ 256, 256 });
+
+		// Transients are created in resource order, so createdImages[i] is chain[i].
+		check(g_Device.createdImages.size() == chain.size(), "every chained image is created");
+		if (g_Device.createdImages.size() != chain.size())
+		{
+			return;
+		}
+		const VkDeviceSize imageSize = 256 * 256 * 4;
+		check(graph.getUnaliasedTransientBytes() == chain.size() * imageSize, "unaliased size is the sum of the images");
+		check(graph.getTransientBytes() == 2 * imageSize, "at most two chained images are live at once");
+		for (size_t a = 0; a < chain.size(); ++a)
+		{
+			for (size_t b = a + 1; b < chain.size(); ++b)
+			{
+				auto& first = g_Device.imageBindings[g_Device.createdImages[a]];
+				auto& second = g_Device.imageBindings[g_Device.createdImages[b]];
+				auto overlaps = first.first == second.first &&
+					first.second < second.second + imageSize && second.second < first.second + imageSize;
+				// Neighbours in the chain are live in the same pass.
+				if (b == a + 1)
+				{
+					check(!overlaps, std::string(names[a]) + " and " + names[b] + " don't share memory while both are live");
+				}
+			}
+		}
+		auto& blur0 = g_Device.imageBindings[g_Device.createdImages[0]];
+		auto& blur2 = g_Device.imageBindings[g_Device.createdImages[2]];
+		check(blur0 == blur2, "blur2 reuses blur0's memory");
+	}
+	allocator.reset();
+	check(g_Device.images == 0 && g_Device.memoryObjects == 0, "aliased images and their memory are released");
+}
+
+void testMemoryAllocatorBlocks()
+{
+	const VkDeviceSize blockSize = 1024 * 1024;
+	auto memoryObjects = g_Device.memoryObjects;
+	auto allocator = makeAllocator(blockSize);
+	auto allocate = [&allocator](VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind)
+	{
+		VkMemoryRequirements requirements = {};
+		requirements.size = size;
+		requirements.alignment = alignment;
+		requirements.memoryTypeBits = 1;
+		return allocator->allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, kind);
+	};
+
+	auto a = allocate(100, 1, ResourceKind::Linear);
+	auto b = allocate(100, 256, ResourceKind::Linear);
+	// [100, 256) is left free as padding, but too small once aligned up.
+	auto c = allocate(100, 256, ResourceKind::Linear);
+	check(a.offset == 0 && b.offset == 256 && c.offset == 512, "offsets are aligned up past the padding");
+	check(a.memory == b.memory && b.memory == c.memory, "small requests share a block");
+
+	allocator->free(a);
+	allocator->free(c);
+	check(allocator->getHeapStats()[0].fragmentation() > 0.0, "freeing around a live range splits the free space");
+	allocator->free(b);
+	auto stats = allocator->getHeapStats()[0];
+	check(stats.blockCount == 1 && stats.allocationCount == 0, "the last empty block is kept");
+	check(stats.freeBytes == blockSize && stats.largestFreeRange == blockSize,
+		"freeing A, C, then B merges the block back into one free range");
+
+	auto linear = allocate(100, 1, ResourceKind::Linear);
+	auto optimal = allocate(100, 1, ResourceKind::Optimal);
+	check(linear.memory != optimal.memory && allocator->getHeapStats()[0].blockCount == 2,
+		"linear and optimal requests of the same memory type never share a block");
+	allocator->free(optimal);
+
+	auto dedicated = allocate(blockSize / 2, 1, ResourceKind::Linear);
+	stats = allocator->getHeapStats()[0];
+	check(dedicated.memory != linear.memory && stats.dedicatedCount == 1 && stats.blockCount == 2,
+		"a request of half a block or more gets dedicated memory");
+	allocator->free(dedicated);
+	check(allocator->getHeapStats()[0].dedicatedCount == 0, "freeing dedicated memory updates the stats");
+
+	// Two just under half a block fill the first block, so the third opens a second one.
+	allocator->free(linear);
+	auto half = blockSize / 2 - 1;
+	auto first = allocate(half, 1, ResourceKind::Linear);
+	auto second = allocate(half, 1, ResourceKind::Linear);
+	auto objectsBeforeThird = g_Device.memoryObjects;
+	auto third = allocate(half, 1, ResourceKind::Linear);
+	check(third.memory != first.memory && g_Device.memoryObjects == objectsBeforeThird + 1,
+		"a full block makes the allocator open another");
+	allocator->free(third);
+	check(g_Device.memoryObjects == objectsBeforeThird, "an empty block is freed while another of its kind remains");
+	allocator->free(first);
+	allocator->free(second);
+	check(g_Device.memoryObjects == objectsBeforeThird, "the last block of its kind is kept when it empties");
+
+	allocator.reset();
+	check(g_Device.memoryObjects == memoryObjects, "the allocator frees its blocks");
+}
+
+void testStagingRingWrap()
+{
+	std::vector<uint8_t> memory(256);
+	StagingRing ring(memory.data(), memory.size());
+	VkDeviceSize offset = 0;
+	check(!ring.allocate(257, 1, offset), "a range larger than the ring is refused");
+
+	check(ring.allocate(100, 1, offset) && offset == 0, "first range starts at 0");
+	ring.submit(1);
+	check(ring.allocate(100, 1, offset) && offset == 100, "second range follows the first");
+	ring.submit(2);
+	check(!ring.allocate(100, 1, offset), "a full ring refuses until a submission completes");
+
+	// Submission 1 completing frees [0, 100): too little at the end, so wrap.
+	ring.reclaim(1);
+	check(ring.allocate(100, 1, offset) && offset == 0, "allocation wraps to the start");
+	check(ring.data(offset) == memory.data(), "data() addresses the mapped memory");
+	check(ring.used() == 256, "the skipped end of the ring counts as used");
+	ring.submit(3);
+	check(!ring.allocate(1, 1, offset), "the wrapped head stops at the tail");
+
+	ring.reclaim(2);
+	check(ring.allocate(50, 16, offset) && offset == 112, "allocation after the head is aligned up");
+	ring.submit(4);
+	ring.reclaim(3);
+	check(ring.used() == 62, "only the last submission's bytes remain in use");
+	ring.reclaim(4);
+	check(ring.used() == 0, "everything is reclaimed");
+	check(ring.allocate(256, 1, offset) && offset == 0, "an empty ring hands out its whole capacity");
+}
+
+void testFrustumCullerMatchesScalar()
+{
+	auto viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f) *
+		glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -10.0f));
+	auto frustum = Frustum::fromViewProjection(viewProjection);
+
+	// An odd count leaves a scalar tail after the SIMD batches.
+	const uint32_t count = 10007;
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+	std::uniform_real_distribution<float> radius(0.0f, 2.0f);
+	InstanceStore store;
+	std::vector<AoSInstance> aos;
+	store.reserve(count);
+	aos.reserve(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		glm::vec3 center(position(random), position(random), position(random));
+		auto r = radius(random);
+		auto transform = glm::translate(glm::mat4(1.0f), center);
+		store.add(center, r, transform);
+		aos.push_back({ center, r, transform });
+	}
+
+	std::vector<uint32_t> scalar;
+	FrustumCuller::cullScalar(aos, frustum, scalar);
+	check(!scalar.empty() && scalar.size() < count, "the frustum keeps some instances and culls others");
+
+	std::vector<uint32_t> simd(count);
+	simd.resize(FrustumCuller::cull(store, frustum, 0, count, simd.data()));
+	check(simd == scalar, std::string(FrustumCuller::instructionSet()) + " culling matches the scalar baseline");
+
+	ThreadPool pool(4);
+	std::vector<uint32_t> parallel;
+	FrustumCuller::cullParallel(store, frustum, pool, parallel, 64);
+	check(parallel == scalar, "parallel culling matches the scalar baseline");
+}
+
+void testPipelineKeyNormalize()
+{
+	PipelineKey a;
+	a.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+	a.cullMode = VK_CULL_MODE_BACK_BIT;
+	a.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	a.srcColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+	a.depthWriteEnable = VK_TRUE;
+	PipelineKey b;
+	b.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+	check(!(a == b), "keys differ before normalize()");
+	a.normalize();
+	b.normalize();
+	check(a == b && PipelineKeyHash()(a) == PipelineKeyHash()(b), "state the pipeline ignores doesn't split keys");
+
+	PipelineKey culled;
+	culled.cullMode = VK_CULL_MODE_BACK_BIT;
+	culled.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	culled.normalize();
+	check(culled.cullMode == VK_CULL_MODE_BACK_BIT && culled.frontFace == VK_FRONT_FACE_CLOCKWISE,
+		"state triangles use is kept");
+}
+
+void testFnv1a()
+{
+	check(Fnv1a().get() == Fnv1a::OffsetBasis, "empty input hashes to the offset basis");
+	check(Fnv1a().bytes("a", 1).get() == 0xaf63dc4c8601ec8cull &&
+		Fnv1a().bytes("foobar", 6).get() == 0x85944171f73967e8ull, "bytes match the reference vectors");
+	const uint8_t littleEndian[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+	check(Fnv1a().value(0x0807060504030201ull).get() == Fnv1a().bytes(littleEndian, 8).get(),
+		"values hash least significant byte first");
+	check(Fnv1a().field("ab").field("c").get() != Fnv1a().field("a").field("bc").get(),
+		"field boundaries change the hash");
+}
+
+void testDeletionQueueOrder()
+{
+	std::vector<int> destroyed;
+	DeletionQueue queue;
+	queue.push(5, [&destroyed] { destroyed.push_back(0); });
+	// An earlier serial is raised to 5 so entries still run in push order.
+	queue.push(3, [&destroyed] { destroyed.push_back(1); });
+	queue.push(7, [&destroyed] { destroyed.push_back(2); });
+	queue.push(7, UniqueBuffer(VK_NULL_HANDLE, makeHandle<VkBuffer>()));
+	queue.push(8, UniqueBuffer());
+	check(queue.size() == 4, "empty handles aren't queued");
+
+	check(queue.collect(3) == 0 && destroyed.empty(), "nothing runs while serial 5 may still be in use");
+	check(queue.collect(4) == 2, "entries for serial 5 run once serial 4 completes");
+	check(destroyed == std::vector<int>({ 0, 1 }), "entries run in push order");
+	auto buffersBefore = g_Device.destroyedBuffers;
+	check(queue.collect(6) == 2 && destroyed.back() == 2, "later entries run once their serial is reached");
+	check(g_Device.destroyedBuffers == buffersBefore + 1, "queued handles are destroyed");
+
+	queue.push(100, [&destroyed] { destroyed.push_back(3); });
+	queue.flush();
+	check(queue.size() == 0 && destroyed.back() == 3, "flush() runs everything");
+}
+
+}
+
+int main()
+{
+	std::pair<const char*, std::function<void()>> tests[] = {
+		{ "render graph schedule", testRenderGraphSchedule },
+		{ "render graph aliasing", testRenderGraphAliasing },
+		{ "memory allocator blocks", testMemoryAllocatorBlocks },
+		{ "staging ring wrap-around", testStagingRingWrap },
+		{ "frustum culler", testFrustumCullerMatchesScalar },
+		{ "pipeline key normalize", testPipelineKeyNormalize },
+		{ "fnv-1a", testFnv1a },
+		{ "deletion queue order", testDeletionQueueOrder }
+	};
+	for (auto& test : tests)
+	{
+		std::cout << "Running " << test.first << "." << std::endl;
+		try
+		{
+			test.second();
+		}
+		catch (const std::exception& e)
+		{
+			check(false, std::string(test.first) + " threw: " + e.what());
+		}
+	}
+	if (g_Failures > 0)
+	{
+		std::cerr << g_Failures << " checks failed." << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "All tests passed." << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads draining a FIFO of tasks. Tasks receive the
+// index of the worker running them, so callers can keep per-worker state
+// (pipeline caches, command pools) without locking. Work that must not wait
+// behind long background jobs belongs on a separate pool.
+class ThreadPool {
+public:
+	// threadInit, if set, runs on each worker before it takes any task, e.g. to
+	// lower the thread's priority.
+	explicit ThreadPool(uint32_t threadCount, std::function<void()> threadInit = nullptr)
+	{
+		threadCount = std::max(threadCount, 1u);
+		for (uint32_t i = 0; i < threadCount; ++i)
+		{
+			m_Workers.emplace_back([this, i, threadInit]
+			{
+				if (threadInit)
+				{
+					threadInit();
+				}
+				workerLoop(i);
+			});
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopping = true;
+		}
+		m_TaskAvailable.notify_all();
+		for (auto& worker : m_Workers)
+		{
+			worker.join();
+		}
+	}
+
+	// Worker count for a pool that leaves the calling thread one core.
+	static uint32_t defaultThreadCount()
+	{
+		auto cores = std::thread::hardware_concurrency();
+		return cores > 1 ? cores - 1 : 1;
+	}
+
+	uint32_t size() const
+	{
+		return static_cast<uint32_t>(m_Workers.size());
+	}
+
+	// task is called as task(workerIndex).
+	template<typename Task>
+	auto submit(Task&& task) -> std::future<std::invoke_result_t<Task, uint32_t>>
+	{
+		using Result = std::invoke_result_t<Task, uint32_t>;
+		auto packaged = std::make_shared<std::packaged_task<Result(uint32_t)>>(std::forward<Task>(task));
+		auto future = packaged->get_future();
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Tasks.emplace_back([packaged](uint32_t workerIndex) { (*packaged)(workerIndex); });
+		}
+		m_TaskAvailable.notify_one();
+		return future;
+	}
+
+	// Blocks until the queue is empty and no task is running.
+	void waitIdle()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Idle.wait(lock, [this] { return m_Tasks.empty() && m_Running == 0; });
+	}
+
+private:
+	std::vector<std::thread> m_Workers;
+	std::deque<std::function<void(uint32_t)>> m_Tasks;
+	std::mutex m_Mutex;
+	std::condition_variable m_TaskAvailable;
+	std::condition_variable m_Idle;
+	uint32_t m_Running = 0;
+	bool m_Stopping = false;
+
+	void workerLoop(uint32_t workerIndex)
+	{
+		for (;;)
+		{
+			std::function<void(uint32_t)> task;
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_TaskAvailable.wait(lock, [this] { return m_Stopping || !m_Tasks.empty(); });
+				if (m_Tasks.empty())
+				{
+					return;
+				}
+				task = std::move(m_Tasks.front());
+				m_Tasks.pop_front();
+				++m_Running;
+			}
+			// Exceptions are captured by the packaged_task and surface through the future.
+			task(workerIndex);
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				--m_Running;
+				if (m_Tasks.empty() && m_Running == 0)
+				{
+					m_Idle.notify_all();
+				}
+			}
+		}
+	}
+};
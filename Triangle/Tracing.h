@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records named begin/end spans and exports them in the Chrome trace event
+// format (chrome://tracing, ui.perfetto.dev). Each thread appends to its own
+// buffer, so a span costs two clock reads and a vector push with no locking;
+// the lock is only taken the first time a thread records anything.
+// Span names must be string literals or otherwise outlive the tracer.
+class Tracer {
+public:
+	class Event {
+	public:
+		const char* name;
+		uint64_t beginNs;
+		uint64_t endNs;
+		uint32_t threadIndex;
+	};
+
+	// Per-thread cap so a long run with per-frame spans can't grow without bound.
+	static const size_t MaxEventsPerThread = 1 << 20;
+
+	static Tracer& instance()
+	{
+		static Tracer tracer;
+		return tracer;
+	}
+
+	void setEnabled(bool enabled)
+	{
+		m_Enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	bool isEnabled() const
+	{
+		return m_Enabled.load(std::memory_order_relaxed);
+	}
+
+	// Nanoseconds since the tracer was created.
+	uint64_t now() const
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - m_Epoch).count());
+	}
+
+	void record(const char* name, uint64_t beginNs, uint64_t endNs)
+	{
+		auto& buffer = threadBuffer();
+		if (buffer.events.size() >= MaxEventsPerThread)
+		{
+			++buffer.dropped;
+			return;
+		}
+		buffer.events.push_back({ name, beginNs, endNs, buffer.threadIndex });
+	}
+
+	// Copies out every recorded span. Spans still being recorded on other
+	// threads may be missed, so call this once worker threads are idle.
+	std::vector<Event> events()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		std::vector<Event> all;
+		for (auto& buffer : m_Buffers)
+		{
+			all.insert(all.end(), buffer->events.begin(), buffer->events.end());
+		}
+		return all;
+	}
+
+	bool writeChromeTrace(const std::string& path)
+	{
+		std::ofstream file(path, std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+		// Timestamps are in microseconds; keep nanosecond resolution.
+		file.setf(std::ios::fixed);
+		file.precision(3);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		auto first = true;
+		size_t dropped = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			for (auto& buffer : m_Buffers)
+			{
+				dropped += buffer->dropped;
+			}
+		}
+		for (auto& event : events())
+		{
+			file << (first ? "\n" : ",\n");
+			first = false;
+			file << "{\"name\":\"" << escape(event.name) << "\",\"ph\":\"X\",\"pid\":1"
+				<< ",\"tid\":" << event.threadIndex
+				<< ",\"ts\":" << event.beginNs / 1000.0
+				<< ",\"dur\":" << (event.endNs - event.beginNs) / 1000.0 << "}";
+		}
+		file << "\n],\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+		return static_cast<bool>(file);
+	}
+
+	// Escapes text for use inside a JSON string.
+	static std::string escape(const char* text)
+	{
+		std::string escaped;
+		for (; *text != '\0'; ++text)
+		{
+			auto c = static_cast<unsigned char>(*text);
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+				escaped += *text;
+			}
+			else if (c < 0x20)
+			{
+				const char* digits = "0123456789abcdef";
+				escaped += "\\u00";
+				escaped += digits[c >> 4];
+				escaped += digits[c & 0xf];
+			}
+			else
+			{
+				escaped += *text;
+			}
+		}
+		return escaped;
+	}
+
+private:
+	class ThreadBuffer {
+	public:
+		std::vector<Event> events;
+		uint32_t threadIndex = 0;
+		size_t dropped = 0;
+	};
+
+	std::chrono::steady_clock::time_point m_Epoch = std::chrono::steady_clock::now();
+	std::atomic<bool> m_Enabled{ true };
+	std::mutex m_Mutex;
+	// Owned here rather than by the threads so spans survive worker shutdown.
+	std::vector<std::unique_ptr<ThreadBuffer>> m_Buffers;
+
+	ThreadBuffer& threadBuffer()
+	{
+		thread_local ThreadBuffer* buffer = nullptr;
+		if (buffer == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Buffers.push_back(std::make_unique<ThreadBuffer>());
+			buffer = m_Buffers.back().get();
+			buffer->threadIndex = static_cast<uint32_t>(m_Buffers.size());
+			buffer->events.reserve(1024);
+		}
+		return *buffer;
+	}
+};
+
+class TraceScope {
+public:
+	explicit TraceScope(const char* name) :
+		m_Name(name),
+		m_Enabled(Tracer::instance().isEnabled()),
+		m_BeginNs(m_Enabled ? Tracer::instance().now() : 0)
+	{
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+	~TraceScope()
+	{
+		if (m_Enabled)
+		{
+			auto& tracer = Tracer::instance();
+			tracer.record(m_Name, m_BeginNs, tracer.now());
+		}
+	}
+
+private:
+	const char* m_Name;
+	bool m_Enabled;
+	uint64_t m_BeginNs;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+// Runs call() inside a span, e.g. traceCall("vkCreateDevice", [&] { return vkCreateDevice(...); }).
+template<typename Call>
+auto traceCall(const char* name, Call&& call)
+{
+	TRACE_SCOPE(name);
+	return call();
+}
@@ -1,23 +1,137 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "BindlessDescriptors.h"
+#include "DeletionQueue.h"
+#include "DescriptorAllocator.h"
+#include "FrustumCuller.h"
+#include "GpuProfiler.h"
+#include "MemoryAllocator.h"
+#include "ParallelRecorder.h"
+#include "PipelineLibrary.h"
+#include "RenderGraph.h"
+#include "ShaderBlob.h"
+#include "ShaderWatcher.h"
+#include "StagingRing.h"
+#include "ThreadPool.h"
+#include "Tracing.h"
+#include "UniformRing.h"
+#include "VulkanHandle.h"
+#if defined(TRIANGLE_RUNTIME_SHADERS)
+#include "ShaderCompiler.h"
+#elif defined(TRIANGLE_EMBED_SHADERS)
+// Generated by Shaders/compile.bat (glslangValidator --vn).
+#include "Shaders/shader.vert.spv.h"
+#include "Shaders/shader.frag.spv.h"
+#include "Shaders/instanced.vert.spv.h"
+#include "Shaders/cull.comp.spv.h"
+#endif
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char** environ;
+#endif
+
 #include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <functional>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 class QueueFamilyIndices {
 public:
 	std::optional<uint32_t> m_GraphicsFamily;
 	std::optional<uint32_t> m_PresentFamily;
-	bool isComplete() {
+	// Dedicated families when the device has them, otherwise the graphics family.
+	std::optional<uint32_t> m_TransferFamily;
+	std::optional<uint32_t> m_ComputeFamily;
+	bool isComplete() const {
 		return m_GraphicsFamily.has_value() && m_PresentFamily.has_value();
 	}
+	bool hasDedicatedTransfer() const {
+		return m_TransferFamily.has_value() && m_TransferFamily != m_GraphicsFamily;
+	}
+	bool hasDedicatedCompute() const {
+		return m_ComputeFamily.has_value() && m_ComputeFamily != m_GraphicsFamily;
+	}
+};
+
+enum class QueueType {
+	Graphics,
+	Compute,
+	Transfer
+};
+
+// One-shot command buffer submitted on the transfer or compute queue.
+class AsyncSubmission {
+public:
+	VkCommandPool pool = VK_NULL_HANDLE;
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	// Empty once the submission has been retired and the fence recycled.
+	UniqueFence fence;
+	uint64_t serial = 0;
+};
+
+// A copy out of the staging ring, recorded by the next flushUploads().
+class PendingUpload {
+public:
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkBufferCopy region = {};
+	// The queue that first reads the buffer, and where.
+	QueueType dstQueue = QueueType::Graphics;
+	VkPipelineStageFlags dstStage = 0;
+	VkAccessFlags dstAccess = 0;
+};
+
+// A copy out of the staging ring that replaces mip 0 of a 2D color image.
+class PendingImageUpload {
+public:
+	VkImage image = VK_NULL_HANDLE;
+	VkBufferImageCopy region = {};
+	// Where the graphics queue first samples the image.
+	VkPipelineStageFlags dstStage = 0;
+};
+
+// Acquire halves of ownership transfers, recorded by the next command buffer
+// on the destination queue.
+class PendingAcquires {
+public:
+	std::vector<VkBufferMemoryBarrier> buffers;
+	std::vector<VkImageMemoryBarrier> images;
+	VkPipelineStageFlags stages = 0;
 };
 
 class SwapChainSupportDetails {
@@ -27,10 +141,318 @@ public:
 	std::vector<VkPresentModeKHR> presentModes;
 };
 
+// What the swap chain and frame pacing optimise for.
+enum class PresentPolicy {
+	// Shortest input-to-present time: IMMEDIATE or MAILBOX, fewest images,
+	// and the CPU waits for the previous frame before sampling input.
+	LowLatency,
+	// Highest frame rate without tearing: MAILBOX, one spare image, and
+	// maxFramesInFlight frames queued.
+	Throughput,
+	// FIFO (vsync) with the fewest images, so the GPU idles between vblanks.
+	PowerSaving
+};
+
+class ApplicationOptions {
+public:
+	// Render into offscreen images instead of a GLFW window and swap chain.
+	// Needs no display, so it runs on build machines with a software ICD (lavapipe).
+	bool headless = false;
+	// Window size, or the offscreen image size when headless.
+	uint32_t width = 800;
+	uint32_t height = 600;
+	// Number of frames the CPU may record ahead of the GPU.
+	uint32_t maxFramesInFlight = 2;
+	// Stop after this many frames; 0 runs until the window is closed.
+	// Headless runs always stop, so they default to a fixed count.
+	uint32_t frameCount = 0;
+	// Pipeline cache blob loaded at startup and written back at exit. Empty disables it.
+	std::string pipelineCachePath = "pipeline_cache.bin";
+	// Worker threads for per-frame jobs such as parallel recording and culling; 0 picks one per spare core.
+	uint32_t workerThreads = 0;
+	// Lower-priority threads that compile pipelines in the background; 0 picks half the spare cores.
+	uint32_t compileThreads = 0;
+	// Extra pipeline variants compiled on the compile pool at startup.
+	uint32_t pipelineVariants = 0;
+	// Chrome trace of startup phases written at exit. Empty disables the export.
+	std::string tracePath;
+	// Device index or part of its name; overrides scoring. Falls back to $TRIANGLE_DEVICE.
+	std::string device;
+	// KiB streamed through the staging ring every frame to load-test uploads; 0 disables it.
+	uint32_t uploadKiB = 0;
+	// Instances drawn through the GPU culling path; 0 draws the single triangle.
+	uint32_t instanceCount = 0;
+	// Draw each instance with its own vkCmdDrawIndexed, recorded across the
+	// worker pool into secondary command buffers, instead of culling on the GPU.
+	bool cpuDraws = false;
+	// With cpuDraws, frustum-cull the instances on the CPU every frame and only draw the visible ones.
+	bool cpuCull = false;
+	// Cull on a dedicated compute queue family, when the device has one, instead
+	// of in the graphics command buffer.
+	bool asyncCompute = true;
+	PresentPolicy presentPolicy = PresentPolicy::Throughput;
+	// Samples per pixel, clamped to what the device supports. Above 1, the scene is drawn into a
+	// multisampled image that is resolved into the swap chain image at the end of the subpass.
+	uint32_t samples = 1;
+	// Depth-test against a depth attachment.
+	bool depth = false;
+	// GLSL directory watched for edits to the graphics shaders, which are then
+	// recompiled and swapped in while running. Empty disables it.
+	std::string watchShadersPath;
+	// JSON report of startup, frame and memory metrics written after the run. Empty disables it.
+	std::string benchmarkPath;
+};
+
+enum class BlendMode {
+	Opaque,
+	Alpha,
+	Additive
+};
+
+class PipelineDesc {
+public:
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	BlendMode blendMode = BlendMode::Opaque;
+	// VK_NULL_HANDLE uses the main render pass.
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	uint32_t subpass = 0;
+	// Adds the per-instance vertex binding and uses instanced.vert.
+	bool instanced = false;
+};
+
+// Shader modules graphics pipelines are built from, with the hashes of their
+// SPIR-V for PipelineKey. Doesn't own the modules, so it can be copied to the
+// threads that build pipelines.
+class PipelineShaderHandles {
+public:
+	VkShaderModule vertex = VK_NULL_HANDLE;
+	VkShaderModule instancedVertex = VK_NULL_HANDLE;
+	VkShaderModule fragment = VK_NULL_HANDLE;
+	uint64_t vertexHash = 0;
+	uint64_t instancedVertexHash = 0;
+	uint64_t fragmentHash = 0;
+};
+
+// Owns the shader modules pipelines are built from. A shader reload replaces
+// the modules whose SPIR-V changed and keeps the others.
+class PipelineShaders {
+public:
+	UniqueShaderModule vertex;
+	UniqueShaderModule instancedVertex;
+	UniqueShaderModule fragment;
+	uint64_t vertexHash = 0;
+	uint64_t instancedVertexHash = 0;
+	uint64_t fragmentHash = 0;
+
+	PipelineShaderHandles handles() const
+	{
+		PipelineShaderHandles handles;
+		handles.vertex = vertex.get();
+		handles.instancedVertex = instancedVertex.get();
+		handles.fragment = fragment.get();
+		handles.vertexHash = vertexHash;
+		handles.instancedVertexHash = instancedVertexHash;
+		handles.fragmentHash = fragmentHash;
+		return handles;
+	}
+};
+
+// Result of a background shader reload, swapped in between frames.
+class ShaderReload {
+public:
+	// The set to build with after the swap.
+	PipelineShaderHandles shaders;
+	// Modules created by the reload, empty for the stages that kept theirs.
+	PipelineShaders newModules;
+	// Whether any stage got a new module.
+	bool changed = false;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkPipeline instancedPipeline = VK_NULL_HANDLE;
+	PipelineKey pipelineKey;
+	PipelineKey instancedPipelineKey;
+	double milliseconds = 0.0;
+};
+
+class Vertex {
+public:
+	float position[2];
+
+	static VkVertexInputBindingDescription getBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(Vertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescription;
+	}
+
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions()
+	{
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(1);
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(Vertex, position);
+		return attributeDescriptions;
+	}
+};
+
+// One vec4 per instance, both in the instance storage buffer and in the
+// compacted per-instance vertex buffer that cull.comp writes.
+class InstanceData {
+public:
+	float position[2];
+	float scale;
+	float padding;
+
+	static VkVertexInputBindingDescription getBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 1;
+		bindingDescription.stride = sizeof(InstanceData);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		return bindingDescription;
+	}
+
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions()
+	{
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(1);
+		attributeDescriptions[0].binding = 1;
+		attributeDescriptions[0].location = 1;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[0].offset = 0;
+		return attributeDescriptions;
+	}
+};
+
+// Push constants of shader.frag: indices into the bindless set.
+class DrawConstants {
+public:
+	uint32_t textureIndex;
+	uint32_t paletteIndex;
+	uint32_t colorIndex;
+};
+
+// Set 1 of shader.vert and instanced.vert. Both blocks are dynamic uniform
+// buffers in the uniform ring: FrameUniforms once per frame, ObjectUniforms
+// once per draw.
+class FrameUniforms {
+public:
+	glm::mat4 viewProjection;
+};
+
+class ObjectUniforms {
+public:
+	glm::mat4 model;
+};
+
+// Push constants of cull.comp.
+class CullParams {
+public:
+	float camera[2];
+	// Half-size of the view in world units.
+	float viewExtent[2];
+	float boundingRadius;
+	uint32_t instanceCount;
+};
+
+// Best time of each CPU culling implementation on the same frustum.
+class CullTimings {
+public:
+	double scalarAoSMs = 0.0;
+	double simdMs = 0.0;
+	double parallelMs = 0.0;
+	uint32_t visibleCount = 0;
+};
+
+class FrameContext {
+public:
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	UniqueSemaphore imageAvailable;
+	UniqueFence inFlight;
+	// Async-work semaphores this frame's submit waited on; recycled once inFlight signals.
+	std::vector<VkSemaphore> consumedSemaphores;
+	// When the input this frame was built from was sampled; measured until inFlight is seen signalled.
+	std::chrono::steady_clock::time_point inputTime;
+	bool latencyPending = false;
+};
+
+// Everything init needs to know about a physical device, captured once during
+// selection. Surface capabilities are left to be re-queried since the current
+// extent follows the window.
+class DeviceSnapshot {
+public:
+	VkPhysicalDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties properties = {};
+	VkPhysicalDeviceFeatures features = {};
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	std::vector<VkQueueFamilyProperties> queueFamilies;
+	std::vector<VkBool32> queueFamilyPresentSupport;
+	std::vector<VkExtensionProperties> extensions;
+	SwapChainSupportDetails swapChainSupport = {};
+	QueueFamilyIndices queueFamilyIndices;
+	// Left zeroed when the device lacks VK_EXT_descriptor_indexing.
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties = {};
+
+	// Descriptor indexing features that BindlessDescriptors and the runtime-sized
+	// arrays in shader.frag need but the device lacks.
+	std::vector<const char*> missingBindlessFeatures() const
+	{
+		auto& features = descriptorIndexingFeatures;
+		std::vector<const char*> missing;
+		if (!features.runtimeDescriptorArray)
+		{
+			missing.push_back("runtimeDescriptorArray");
+		}
+		if (!features.descriptorBindingPartiallyBound)
+		{
+			missing.push_back("descriptorBindingPartiallyBound");
+		}
+		if (!features.descriptorBindingSampledImageUpdateAfterBind)
+		{
+			missing.push_back("descriptorBindingSampledImageUpdateAfterBind");
+		}
+		if (!features.descriptorBindingStorageBufferUpdateAfterBind)
+		{
+			missing.push_back("descriptorBindingStorageBufferUpdateAfterBind");
+		}
+		if (!features.descriptorBindingUpdateUnusedWhilePending)
+		{
+			missing.push_back("descriptorBindingUpdateUnusedWhilePending");
+		}
+		return missing;
+	}
+
+	bool hasExtension(const char* name) const
+	{
+		for (auto& ext : extensions)
+		{
+			if (strcmp(name, ext.extensionName) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	VkDeviceSize deviceLocalHeapSize() const
+	{
+		VkDeviceSize size = 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+		{
+			if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			{
+				size += memoryProperties.memoryHeaps[i].size;
+			}
+		}
+		return size;
+	}
+};
+
 class HelloTriangleApplication {
 public:
-	const uint32_t WindowWidth = 800;
-	const uint32_t WindowHeight = 600;
 	const std::string AppName = "Vulkan Triangle";
 	const std::vector<const char*> validationLayers = {
 		"VK_LAYER_KHRONOS_validation"
@@ -38,6 +460,34 @@ public:
 	const std::vector<const char*> deviceExtensions = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME
 	};
+	const uint32_t OffscreenImageCount = 2;
+	const VkFormat OffscreenFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	const uint32_t DefaultHeadlessFrameCount = 1000;
+	const VkDeviceSize StagingRingSize = 8 * 1024 * 1024;
+	const VkDeviceSize StagingAlignment = 16;
+	const uint32_t CullWorkgroupSize = 64;
+	// Instances are scattered over [-extent, extent]^2; the view's shorter axis covers [-1, 1].
+	const float InstanceFieldExtent = 2.0f;
+	// Bounding circle of the triangle mesh at scale 1.
+	const float MeshBoundingRadius = 0.75f;
+	// Smallest batch of draws worth handing to a worker thread.
+	const uint32_t MinDrawsPerBatch = 256;
+	// Bindless slots, clamped to the device's update-after-bind limits.
+	const uint32_t BindlessTextureCapacity = 1024;
+	const uint32_t BindlessBufferCapacity = 1024;
+	// Per pool of the per-frame descriptor allocator.
+	const uint32_t FrameDescriptorSetsPerPool = 64;
+	// Smallest per-frame region of the uniform ring. --cpu-draws adds room for one
+	// ObjectUniforms per instance.
+	const VkDeviceSize UniformRingFrameSize = 64 * 1024;
+	const uint32_t CheckerTextureSize = 64;
+	const uint32_t PaletteSize = 8;
+	// Runs per implementation when timing CPU culling at exit.
+	const uint32_t CullBenchmarkRuns = 20;
+	// Latency percentiles are taken over this many recent frames.
+	const size_t LatencySampleCount = 4096;
+	// Largest ratio of p50 CPU frame time while pipelines compile to after it that counts as flat.
+	const double CompileFrameTimeTolerance = 1.5;
 
 #ifdef NDEBUG
 	const bool enableValidationLayers = false;
@@ -45,52 +495,337 @@ public:
 	const bool enableValidationLayers = true;
 #endif
 
+	HelloTriangleApplication(const ApplicationOptions& options) :
+		m_Options(options)
+	{
+		if (m_Options.maxFramesInFlight == 0)
+		{
+			throw std::runtime_error("maxFramesInFlight must be at least 1.");
+		}
+		if (m_Options.width == 0 || m_Options.height == 0)
+		{
+			throw std::runtime_error("Width and height must be at least 1.");
+		}
+		if (m_Options.headless && m_Options.frameCount == 0)
+		{
+			m_Options.frameCount = DefaultHeadlessFrameCount;
+		}
+		if (m_Options.cpuDraws && m_Options.instanceCount == 0)
+		{
+			throw std::runtime_error("--cpu-draws needs --instances.");
+		}
+		if (m_Options.cpuCull && !m_Options.cpuDraws)
+		{
+			throw std::runtime_error("--cpu-cull needs --cpu-draws.");
+		}
+		if (m_Options.samples == 0 || m_Options.samples > 64 || (m_Options.samples & (m_Options.samples - 1)) != 0)
+		{
+			throw std::runtime_error("--msaa must be a power of two from 1 to 64.");
+		}
+	}
+
 	void run() {
-		initWindow();
+		if (!m_Options.headless)
+		{
+			initWindow();
+		}
 		initVulkan();
 		mainLoop();
+		if (!m_Options.benchmarkPath.empty())
+		{
+			writeBenchmarkReport(m_Options.benchmarkPath);
+		}
 		cleanup();
+		if (!m_Options.tracePath.empty())
+		{
+			if (Tracer::instance().writeChromeTrace(m_Options.tracePath))
+			{
+				std::cout << "Wrote trace " << m_Options.tracePath << std::endl;
+			}
+			else
+			{
+				std::cout << "Can't write trace " << m_Options.tracePath << std::endl;
+			}
+		}
 	}
 
 private:
+	ApplicationOptions m_Options;
 	GLFWwindow* m_Window = nullptr;
 	VkInstance m_Instance = {};
 	VkDebugUtilsMessengerEXT m_DebugMessenger = 0;
 	VkPhysicalDevice m_PhysicalDevice = VK_NULL_HANDLE;
+	std::unique_ptr<const DeviceSnapshot> m_DeviceInfo;
 	VkDevice m_Device = nullptr;
+	std::unique_ptr<DeviceMemoryAllocator> m_Allocator;
 	VkQueue m_GraphicsQueue = nullptr;
 	VkQueue m_PresentQueue = nullptr;
+	VkQueue m_TransferQueue = nullptr;
+	VkQueue m_ComputeQueue = nullptr;
 	VkSurfaceKHR m_Surface = nullptr;
-	VkSwapchainKHR m_SwapChain = nullptr;
+	UniqueSwapchain m_SwapChain;
 	std::vector<VkImage> m_SwapChainImages;
+	std::vector<MemoryAllocation> m_OffscreenImageMemory;
 	VkFormat m_SwapChainFormat;
 	VkExtent2D m_SwapChainExtent;
-	std::vector<VkImageView> m_SwapChainImageViews;
-	VkRenderPass m_RenderPass;
-	VkPipelineLayout m_PipelineLayout;
+	std::vector<UniqueImageView> m_SwapChainImageViews;
+	std::unique_ptr<RenderGraph> m_RenderGraph;
+	RenderGraph::ResourceId m_BackbufferResource = 0;
+	RenderGraph::ResourceId m_InstanceResource = 0;
+	RenderGraph::ResourceId m_VisibleInstanceResource = 0;
+	RenderGraph::ResourceId m_DrawCommandResource = 0;
+	RenderGraph::PassId m_MainPass = 0;
+	// The main pass's render pass, owned by m_RenderGraph.
+	VkRenderPass m_RenderPass = VK_NULL_HANDLE;
+	// Attachments of the main pass besides the swap chain image.
+	VkSampleCountFlagBits m_SampleCount = VK_SAMPLE_COUNT_1_BIT;
+	VkFormat m_DepthFormat = VK_FORMAT_UNDEFINED;
+	// Recorded by recordInstanceDraws before the graph executes the main pass.
+	std::vector<VkCommandBuffer> m_InstanceDrawCommandBuffers;
+	UniquePipelineLayout m_PipelineLayout;
+	// Owns every graphics pipeline; m_Pipeline and m_InstancedPipeline are entries of it.
+	std::unique_ptr<PipelineLibrary> m_PipelineLibrary;
 	VkPipeline m_Pipeline;
+	PipelineKey m_PipelineKey;
+	// --pipeline-variants, compiling on the compile pool while frames are drawn.
+	std::vector<std::shared_future<VkPipeline>> m_PipelineVariants;
+	// Library keys of m_PipelineVariants, for evicting them when the shaders change.
+	std::vector<PipelineKey> m_PipelineVariantKeys;
+	// Which of m_PipelineVariants frames may draw with; see canDrawMeshWith.
+	std::vector<bool> m_DrawableVariants;
+	// m_PipelineVariants resolved once per frame, with m_Pipeline in place of any
+	// still compiling, so recording threads never touch the futures.
+	std::vector<VkPipeline> m_FramePipelines;
+	bool m_PipelineVariantsReady = false;
+	PipelineShaders m_Shaders;
+	// --watch-shaders. Reloads run one at a time on their own thread, so a
+	// compile never holds up the worker pool a frame may be waiting on.
+	std::unique_ptr<ShaderWatcher> m_ShaderWatcher;
+	std::unique_ptr<ThreadPool> m_ShaderReloadThread;
+	std::set<std::string> m_PendingShaderChanges;
+	std::future<ShaderReload> m_ShaderReload;
+	uint32_t m_ShaderReloadCount = 0;
+#ifdef TRIANGLE_RUNTIME_SHADERS
+	std::unique_ptr<ShaderCompiler> m_ShaderCompiler;
+#endif
+	UniquePipelineCache m_PipelineCache;
+	// Per-frame jobs. Frames wait on these, so nothing long-running goes here.
+	std::unique_ptr<ThreadPool> m_WorkerPool;
+	// Background pipeline compiles, kept off m_WorkerPool so frame jobs never
+	// queue behind them, and at a lower priority so they yield the cores.
+	std::unique_ptr<ThreadPool> m_CompilePool;
+	// One per compile thread, indexed by its worker index.
+	std::vector<UniquePipelineCache> m_WorkerPipelineCaches;
+	std::mutex m_LogMutex;
+	bool m_PipelineCacheLoaded = false;
+	bool m_HasPipelineCreationFeedback = false;
+	UniqueCommandPool m_CommandPool;
+	UniqueCommandPool m_TransferCommandPool;
+	UniqueCommandPool m_ComputeCommandPool;
+	std::unique_ptr<ParallelRecorder> m_Recorder;
+	std::unique_ptr<GpuProfiler> m_GpuProfiler;
+	PFN_vkGetPhysicalDeviceFeatures2KHR m_GetPhysicalDeviceFeatures2 = nullptr;
+	PFN_vkGetPhysicalDeviceProperties2KHR m_GetPhysicalDeviceProperties2 = nullptr;
+	std::unique_ptr<BindlessDescriptors> m_Bindless;
+	std::unique_ptr<FrameDescriptorAllocator> m_FrameDescriptors;
+	UniqueImage m_CheckerImage;
+	MemoryAllocation m_CheckerMemory;
+	UniqueImageView m_CheckerImageView;
+	UniqueSampler m_Sampler;
+	UniqueBuffer m_PaletteBuffer;
+	MemoryAllocation m_PaletteMemory;
+	uint32_t m_CheckerTextureIndex = 0;
+	uint32_t m_PaletteIndex = 0;
+	UniqueBuffer m_UniformBuffer;
+	MemoryAllocation m_UniformMemory;
+	std::unique_ptr<UniformRing> m_UniformRing;
+	UniqueDescriptorSetLayout m_UniformSetLayout;
+	UniqueDescriptorPool m_UniformDescriptorPool;
+	// Bound with dynamic offsets into the uniform ring, so one set serves every frame and draw.
+	VkDescriptorSet m_UniformSet = VK_NULL_HANDLE;
+	// FrameUniforms of the frame being recorded.
+	uint32_t m_FrameUniformOffset = 0;
+	// Total CPU time spent in recordCommandBuffer.
+	double m_RecordMs = 0.0;
+	std::deque<AsyncSubmission> m_AsyncSubmissions;
+	uint64_t m_AsyncSubmittedSerial = 0;
+	uint64_t m_AsyncCompletedSerial = 0;
+	std::vector<UniqueFence> m_FreeFences;
+	// Owns every async semaphore; the lists below and the frames' consumedSemaphores borrow them.
+	std::vector<UniqueSemaphore> m_AsyncSemaphores;
+	std::vector<VkSemaphore> m_FreeSemaphores;
+	// Waits and ownership acquires picked up by the next graphics submit.
+	std::vector<VkSemaphore> m_GraphicsWaitSemaphores;
+	std::vector<VkPipelineStageFlags> m_GraphicsWaitStages;
+	PendingAcquires m_GraphicsAcquires;
+	// One per frame slot, recorded by that slot's next cull submit. The graphics
+	// frame that released them is finished by then: the slot's fence was waited on.
+	std::vector<PendingAcquires> m_ComputeAcquires;
+	// Culling runs on m_ComputeQueue through submitCulling instead of in the render graph.
+	bool m_AsyncCompute = false;
+	UniqueBuffer m_StagingBuffer;
+	MemoryAllocation m_StagingMemory;
+	std::unique_ptr<StagingRing> m_StagingRing;
+	std::vector<PendingUpload> m_PendingUploads;
+	std::vector<PendingImageUpload> m_PendingImageUploads;
+	uint32_t m_StagingStalls = 0;
+	UniqueBuffer m_VertexBuffer;
+	MemoryAllocation m_VertexMemory;
+	UniqueBuffer m_IndexBuffer;
+	MemoryAllocation m_IndexMemory;
+	uint32_t m_IndexCount = 0;
+	// Target of --upload-kib, one region per frame in flight.
+	UniqueBuffer m_StreamBuffer;
+	MemoryAllocation m_StreamMemory;
+	std::vector<uint8_t> m_StreamSource;
+	VkPipeline m_InstancedPipeline = VK_NULL_HANDLE;
+	PipelineKey m_InstancedPipelineKey;
+	UniqueDescriptorSetLayout m_CullSetLayout;
+	UniquePipelineLayout m_CullPipelineLayout;
+	UniquePipeline m_CullPipeline;
+	UniqueBuffer m_InstanceBuffer;
+	MemoryAllocation m_InstanceMemory;
+	// CPU copy of the instances, kept for --cpu-draws.
+	InstanceStore m_InstanceStore;
+	// Instances drawn by --cpu-draws: all of them, or the result of --cpu-cull.
+	std::vector<uint32_t> m_VisibleIndices;
+	// Total CPU time spent culling with --cpu-cull.
+	double m_CullMs = 0.0;
+	CullTimings m_CullTimings;
+	UniqueBuffer m_VisibleInstanceBuffer;
+	MemoryAllocation m_VisibleInstanceMemory;
+	UniqueBuffer m_IndirectBuffer;
+	MemoryAllocation m_IndirectMemory;
+	// Set by the framebuffer size callback and by OUT_OF_DATE/SUBOPTIMAL results.
+	bool m_SwapChainOutOfDate = false;
+	// Objects replaced while frames that use them may still be in flight,
+	// keyed on m_FrameNumber and collected after each fence wait.
+	DeletionQueue m_DeletionQueue;
+	std::chrono::steady_clock::time_point m_InputTime;
+	// Ring of recent input-to-retire latencies in ms, see paceFrame.
+	std::vector<double> m_LatencySamples;
+	size_t m_LatencySampleCursor = 0;
+	// Per-frame times in ms, only kept for the benchmark report. Frame times run
+	// from one frame's start to the next; CPU times leave out the pacing wait.
+	std::vector<double> m_FrameTimes;
+	std::vector<double> m_CpuFrameTimes;
+	// m_CpuFrameTimes split by whether pipeline variants were still compiling.
+	std::vector<double> m_CompilingCpuFrameTimes;
+	std::vector<double> m_IdleCpuFrameTimes;
+	std::vector<FrameContext> m_Frames;
+	// Fence of the frame slot currently rendering to each swap chain image.
+	std::vector<VkFence> m_ImagesInFlight;
+	// Signalled by the frame drawing to each swap chain image and waited on by its present.
+	// The fence only shows rendering has finished, not that the present has consumed the
+	// semaphore; only the next acquire of the same image proves that, so each image has its own.
+	std::vector<UniqueSemaphore> m_RenderFinished;
+	// Replaced by createSwapChain. Presents queued on the old swap chain may still be
+	// waiting on its semaphores after their frames' fences have signalled, so both are
+	// kept until an image has been acquired from the new swap chain.
+	std::vector<UniqueSwapchain> m_RetiredSwapChains;
+	std::vector<UniqueSemaphore> m_RetiredRenderFinished;
+	uint32_t m_CurrentFrame = 0;
+	uint64_t m_FrameNumber = 0;
 
 	void initWindow() {
+		TRACE_SCOPE("initWindow");
 		glfwInit();
 		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-		m_Window = glfwCreateWindow(WindowWidth, WindowHeight, AppName.c_str(), nullptr, nullptr);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+		m_Window = glfwCreateWindow(m_Options.width, m_Options.height, AppName.c_str(), nullptr, nullptr);
+		glfwSetWindowUserPointer(m_Window, this);
+		glfwSetFramebufferSizeCallback(m_Window, framebufferResizeCallback);
+	}
+
+	static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
+	{
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		app->m_SwapChainOutOfDate = true;
+	}
+
+	// Runs on each compile thread, so the OS schedules frame work first when
+	// the cores are busy. Best effort; the thread keeps its priority on failure.
+	static void lowerThreadPriority()
+	{
+#if defined(_WIN32)
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__linux__)
+		// Linux applies PRIO_PROCESS with who = 0 to the calling thread only.
+		setpriority(PRIO_PROCESS, 0, 10);
+#endif
 	}
 
 	void initVulkan() {
+		TRACE_SCOPE("initVulkan");
+		m_WorkerPool = std::make_unique<ThreadPool>(m_Options.workerThreads != 0 ?
+			m_Options.workerThreads : ThreadPool::defaultThreadCount());
+		m_CompilePool = std::make_unique<ThreadPool>(m_Options.compileThreads != 0 ?
+			m_Options.compileThreads : std::max(1u, ThreadPool::defaultThreadCount() / 2), lowerThreadPriority);
 		createInstance();
 		setupDebugMessenger();
-		createSurface();
+		if (!m_Options.headless)
+		{
+			createSurface();
+		}
 		pickPhysicalDevice();
 		createLogicalDevice();
-		createSwapChain();
+		createAllocator();
+		createDescriptorAllocators();
+		createUniformRing();
+		createPipelineCache();
+		if (m_Options.headless)
+		{
+			createOffscreenImages();
+		}
+		else
+		{
+			createSwapChain();
+		}
 		createImageViews();
-		createRenderPass();
+		createRenderGraph();
 		createGraphicsPipeline();
+		if (m_Options.pipelineVariants > 0)
+		{
+			compilePipelineVariants();
+		}
+		createCommandPool();
+		createStagingRing();
+		createGeometryBuffers();
+		createMaterials();
+		if (m_Options.instanceCount > 0)
+		{
+			createInstancePipelines();
+			createInstanceBuffers();
+		}
+		if (m_Options.cpuDraws)
+		{
+			m_Recorder = std::make_unique<ParallelRecorder>(m_Device, getQueueFamily(QueueType::Graphics),
+				m_Options.maxFramesInFlight, *m_WorkerPool);
+		}
+		createGpuProfiler();
+		createFrameContexts();
+		if (!m_Options.watchShadersPath.empty())
+		{
+			m_ShaderWatcher = std::make_unique<ShaderWatcher>(m_Options.watchShadersPath);
+			m_ShaderReloadThread = std::make_unique<ThreadPool>(1);
+			std::cout << "Watching " << m_ShaderWatcher->directory().string() << " for shader changes." << std::endl;
+		}
+	}
+
+	void createGpuProfiler()
+	{
+		auto timestampValidBits = m_DeviceInfo->queueFamilies[getQueueFamily(QueueType::Graphics)].timestampValidBits;
+		if (timestampValidBits == 0)
+		{
+			std::cout << "Graphics queue doesn't support timestamps, GPU profiling disabled." << std::endl;
+		}
+		m_GpuProfiler = std::make_unique<GpuProfiler>(m_Device, m_DeviceInfo->properties.limits.timestampPeriod,
+			timestampValidBits, m_Options.maxFramesInFlight);
 	}
 
 	void pickPhysicalDevice()
 	{
+		TRACE_SCOPE("pickPhysicalDevice");
 		uint32_t deviceCount = 0;
 		vkEnumeratePhysicalDevices(m_Instance, &deviceCount, nullptr);
 		if (deviceCount <= 0)
@@ -99,91 +834,233 @@ private:
 		}
 		std::vector<VkPhysicalDevice> devices(deviceCount);
 		vkEnumeratePhysicalDevices(m_Instance, &deviceCount, devices.data());
+
+		std::vector<DeviceSnapshot> candidates;
 		for (auto& d : devices)
 		{
-			if (isDeviceSuitable(d))
+			candidates.push_back(captureDeviceSnapshot(d));
+		}
+
+		// TRIANGLE_DEVICE / --device: an index into the list above or part of the device name.
+		auto requestedDevice = m_Options.device;
+		if (requestedDevice.empty())
+		{
+			auto env = std::getenv("TRIANGLE_DEVICE");
+			requestedDevice = env != nullptr ? env : "";
+		}
+		// All digits is an index. One too large to parse matches no device.
+		std::optional<size_t> requestedIndex;
+		if (!requestedDevice.empty() && requestedDevice.find_first_not_of("0123456789") == std::string::npos)
+		{
+			size_t index = 0;
+			auto result = std::from_chars(requestedDevice.data(), requestedDevice.data() + requestedDevice.size(), index);
+			requestedIndex = result.ec == std::errc() ? index : std::numeric_limits<size_t>::max();
+		}
+
+		const DeviceSnapshot* best = nullptr;
+		int64_t bestScore = 0;
+		// Every device's reason, for the error when none is suitable.
+		std::string unsuitability;
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			auto& candidate = candidates[i];
+			auto reason = findUnsuitability(candidate);
+			auto suitable = reason.empty();
+			auto score = suitable ? scoreDevice(candidate) : 0;
+			std::cout << "Device " << i << ": " << candidate.properties.deviceName
+				<< (suitable ? " score " + std::to_string(score) : " not suitable: " + reason) << std::endl;
+			if (!suitable)
 			{
-				std::cout << "Using device " << d << std::endl;
-				m_PhysicalDevice = d;
-				break;
+				unsuitability += std::string(" ") + candidate.properties.deviceName + ": " + reason + ".";
+			}
+			if (!requestedDevice.empty())
+			{
+				auto matches = requestedIndex ? *requestedIndex == i :
+					std::string(candidate.properties.deviceName).find(requestedDevice) != std::string::npos;
+				if (matches && best == nullptr)
+				{
+					if (!suitable)
+					{
+						throw std::runtime_error("Requested device " + requestedDevice + " is not suitable: " + reason + ".");
+					}
+					best = &candidate;
+				}
+			}
+			else if (suitable && (best == nullptr || score > bestScore))
+			{
+				best = &candidate;
+				bestScore = score;
 			}
 		}
 
-		if (m_PhysicalDevice == VK_NULL_HANDLE)
+		if (best == nullptr)
 		{
-			throw std::runtime_error("No GPU is suitable.");
+			throw std::runtime_error(requestedDevice.empty() ? "No GPU is suitable." + unsuitability :
+				"No device matches " + requestedDevice + ".");
 		}
+		m_DeviceInfo = std::make_unique<const DeviceSnapshot>(*best);
+		m_PhysicalDevice = m_DeviceInfo->device;
+		std::cout << "Using device " << m_DeviceInfo->properties.deviceName << std::endl;
 	}
 
-	bool isDeviceSuitable(VkPhysicalDevice& device)
+	// Queries everything init needs from a physical device in one go, so later
+	// steps read the snapshot instead of going back to the driver.
+	DeviceSnapshot captureDeviceSnapshot(VkPhysicalDevice device)
 	{
-		VkPhysicalDeviceProperties properties;
-		vkGetPhysicalDeviceProperties(device, &properties);
+		DeviceSnapshot info;
+		info.device = device;
+		vkGetPhysicalDeviceProperties(device, &info.properties);
+		vkGetPhysicalDeviceFeatures(device, &info.features);
+		vkGetPhysicalDeviceMemoryProperties(device, &info.memoryProperties);
 		std::cout << "Device Properties:" << std::endl;
-		std::cout << "API Version " << properties.apiVersion << std::endl;
-		std::cout << "Device Name " << properties.deviceName << std::endl;
-		std::cout << "Device Type " << properties.deviceType << std::endl;
-		std::cout << "Vendor ID " << properties.vendorID << std::endl;
+		std::cout << "API Version " << info.properties.apiVersion << std::endl;
+		std::cout << "Device Name " << info.properties.deviceName << std::endl;
+		std::cout << "Device Type " << info.properties.deviceType << std::endl;
+		std::cout << "Vendor ID " << info.properties.vendorID << std::endl;
+		std::cout << "Geometry Shader " << info.features.geometryShader << std::endl;
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+		info.queueFamilies.resize(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, info.queueFamilies.data());
+		info.queueFamilyPresentSupport.assign(queueFamilyCount, VK_FALSE);
+		std::cout << "Device Queue Families:" << std::endl;
+		for (uint32_t i = 0; i < queueFamilyCount; ++i)
+		{
+			std::cout << "Count " << info.queueFamilies[i].queueCount << " Flags " << info.queueFamilies[i].queueFlags << std::endl;
+			if (!m_Options.headless &&
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &info.queueFamilyPresentSupport[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Trouble querying device for present support.");
+			}
+		}
 
-		VkPhysicalDeviceFeatures features;
-		vkGetPhysicalDeviceFeatures(device, &features);
-		std::cout << "Device Features:" << std::endl;
-		std::cout << "Geometry Shader " << features.geometryShader << std::endl;
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+		info.extensions.resize(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, info.extensions.data());
+		if (info.hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+		{
+			queryDescriptorIndexing(info);
+		}
+
+		if (!m_Options.headless)
+		{
+			info.swapChainSupport = querySwapChainSupport(device);
+		}
+		info.queueFamilyIndices = findQueueFamilies(info);
+		return info;
+	}
 
-		auto families = findQueueFamilies(device);
-		auto extensionsSupported = checkDeviceExtensionSupport(device);
-		auto swapChainSupport = querySwapChainSupport(device);
+	// Through VK_KHR_get_physical_device_properties2, since the instance targets Vulkan 1.0.
+	void queryDescriptorIndexing(DeviceSnapshot& info)
+	{
+		info.descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+		info.descriptorIndexingFeatures.pNext = nullptr;
+		VkPhysicalDeviceFeatures2KHR features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+		features.pNext = &info.descriptorIndexingFeatures;
+		m_GetPhysicalDeviceFeatures2(info.device, &features);
+
+		info.descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+		info.descriptorIndexingProperties.pNext = nullptr;
+		VkPhysicalDeviceProperties2KHR properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+		properties.pNext = &info.descriptorIndexingProperties;
+		m_GetPhysicalDeviceProperties2(info.device, &properties);
+	}
 
-		auto swapChainsAdequate = false;
-		if (extensionsSupported)
+	// Why the device can't be used, naming the missing extension, feature or
+	// queue; empty when it is suitable. Older software rasterizers usually lack
+	// descriptor indexing, which the bindless set can't do without.
+	std::string findUnsuitability(const DeviceSnapshot& info)
+	{
+		for (auto& extension : getRequiredDeviceExtensions())
+		{
+			if (!info.hasExtension(extension))
+			{
+				return std::string("missing ") + extension;
+			}
+		}
+		auto missingFeatures = info.missingBindlessFeatures();
+		if (!missingFeatures.empty())
 		{
-			SwapChainSupportDetails details = querySwapChainSupport(device);
-			swapChainsAdequate = !details.formats.empty() && !details.presentModes.empty();
+			std::string reason = "descriptor indexing lacks";
+			for (auto feature : missingFeatures)
+			{
+				reason += std::string(" ") + feature;
+			}
+			return reason;
+		}
+		if (!info.queueFamilyIndices.m_GraphicsFamily.has_value())
+		{
+			return "no graphics queue";
+		}
+		if (!info.queueFamilyIndices.m_PresentFamily.has_value())
+		{
+			return "no queue can present to the window";
+		}
+		if (!m_Options.headless &&
+			(info.swapChainSupport.formats.empty() || info.swapChainSupport.presentModes.empty()))
+		{
+			return "no swap chain formats or present modes for the window";
 		}
-		return families.isComplete() && extensionsSupported && swapChainsAdequate;
+		return std::string();
 	}
 
-	bool checkDeviceExtensionSupport(VkPhysicalDevice& device)
+	// Higher is better. Device type dominates; memory, limits and queue layout break ties.
+	int64_t scoreDevice(const DeviceSnapshot& info)
 	{
-		if (deviceExtensions.size() == 0)
+		int64_t score = 0;
+		switch (info.properties.deviceType)
 		{
-			return true;
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 4000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 3000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 2000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_CPU: score += 1000; break;
+		default: break;
 		}
 
-		uint32_t extensionCount = 0;
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
-		if (extensionCount == 0)
+		// One point per 64 MiB of device-local memory, capped below the next device type.
+		auto heapMiB = info.deviceLocalHeapSize() / (1024 * 1024);
+		score += static_cast<int64_t>(std::min<VkDeviceSize>(heapMiB / 64, 999));
+
+		score += info.properties.limits.maxImageDimension2D / 4096;
+		score += info.properties.limits.maxComputeWorkGroupInvocations / 512;
+
+		// Prefer graphics and present on one family: no concurrent sharing of swap chain images.
+		auto& indices = info.queueFamilyIndices;
+		if (indices.isComplete() && indices.m_GraphicsFamily == indices.m_PresentFamily)
 		{
-			throw std::runtime_error("No device extensions");
+			score += 8;
 		}
-		std::vector<VkExtensionProperties> extensions(extensionCount);
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
-		std::cout << "Device Extensions:" << std::endl;
-		for (auto& ext : extensions)
+		// Dedicated transfer and compute families let copies and culling overlap rendering.
+		if (indices.hasDedicatedTransfer())
+		{
+			score += 4;
+		}
+		if (indices.hasDedicatedCompute())
 		{
-			std::cout << ext.extensionName << std::endl;
+			score += 4;
 		}
+		return score;
+	}
 
-		for (auto& de : deviceExtensions)
+	std::vector<const char*> getRequiredDeviceExtensions()
+	{
+		// Descriptor indexing depends on maintenance3.
+		std::vector<const char*> extensions = {
+			VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+			VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
+		};
+		if (!m_Options.headless)
 		{
-			auto found = false;
-			for (auto& ext : extensions)
-			{
-				if (strcmp(de, ext.extensionName) == 0)
-				{
-					found = true;
-					break;
-				}
-			}
-			if (!found)
-			{
-				return false;
-			}
+			extensions.insert(extensions.end(), deviceExtensions.begin(), deviceExtensions.end());
 		}
-		return true;
+		return extensions;
 	}
 
-	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice& device)
+	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device)
 	{
 		SwapChainSupportDetails details;
 
@@ -210,6 +1087,7 @@ private:
 
 	void createInstance()
 	{
+		TRACE_SCOPE("createInstance");
 		if (enableValidationLayers && !checkValidationLayerSupport())
 		{
 			throw std::runtime_error("Validation layers requested are not available.");
@@ -267,10 +1145,18 @@ private:
 			createInfo.pNext = nullptr;
 		}
 
-		if (vkCreateInstance(&createInfo, nullptr, &m_Instance) != VK_SUCCESS)
+		if (traceCall("vkCreateInstance", [&] { return vkCreateInstance(&createInfo, nullptr, &m_Instance); }) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create Vulkan instance.");
 		}
+		m_GetPhysicalDeviceFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(m_Instance,
+			"vkGetPhysicalDeviceFeatures2KHR");
+		m_GetPhysicalDeviceProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(m_Instance,
+			"vkGetPhysicalDeviceProperties2KHR");
+		if (m_GetPhysicalDeviceFeatures2 == nullptr || m_GetPhysicalDeviceProperties2 == nullptr)
+		{
+			throw std::runtime_error("Can't load vkGetPhysicalDeviceFeatures2KHR.");
+		}
 	}
 
 	bool checkValidationLayerSupport()
@@ -308,14 +1194,19 @@ private:
 
 	std::vector<const char*> getRequiredExtensions()
 	{
-		uint32_t glfwExtensionCount = 0;
-		auto glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-		std::vector<const char*> extensions(glfwExtensions, glfwExtensions  + glfwExtensionCount);
+		std::vector<const char*> extensions;
+		if (!m_Options.headless)
+		{
+			uint32_t glfwExtensionCount = 0;
+			auto glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+			extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		}
 		if (enableValidationLayers)
 		{
 			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 		}
+		// Needed to query descriptor indexing support.
+		extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 		return extensions;
 	}
 
@@ -348,6 +1239,7 @@ private:
 
 	void setupDebugMessenger()
 	{
+		TRACE_SCOPE("setupDebugMessenger");
 		if (!enableValidationLayers) return;
 
 		VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
@@ -399,54 +1291,87 @@ private:
 		}
 	}
 
-	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device)
+	// Graphics and present family from the snapshot's queue families. A family
+	// that can do both is preferred so swap chain images need no sharing.
+	QueueFamilyIndices findQueueFamilies(const DeviceSnapshot& info)
 	{
 		QueueFamilyIndices indices;
-		uint32_t queueFamilyCount = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-		std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilyProperties.data());
-
-		std::cout << "Device Queue Families:" << std::endl;
-		for (auto& qp : queueFamilyProperties)
-		{
-			std::cout << "Count " << qp.queueCount << " Flags " << qp.queueFlags << std::endl;
-		}
-
-		int i = 0;
-		for (auto& qp : queueFamilyProperties)
+		for (uint32_t i = 0; i < info.queueFamilies.size(); ++i)
 		{
-			if (qp.queueCount > 0 && qp.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			auto& qp = info.queueFamilies[i];
+			if (qp.queueCount == 0)
+			{
+				continue;
+			}
+			auto graphics = (qp.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+			// Nothing is presented when headless; the graphics queue takes the present role.
+			auto present = m_Options.headless ? graphics : info.queueFamilyPresentSupport[i] == VK_TRUE;
+			if (graphics && present)
 			{
 				indices.m_GraphicsFamily = i;
-				std::cout << "Graphics Family = " << i << std::endl;
+				indices.m_PresentFamily = i;
+				break;
 			}
-			VkBool32 presentSupport = false;
-			if (vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport) != VK_SUCCESS)
+			if (graphics && !indices.m_GraphicsFamily.has_value())
 			{
-				throw std::runtime_error("Trouble querying device for present support.");
+				indices.m_GraphicsFamily = i;
 			}
-			if ((qp.queueCount > 0) && presentSupport)
+			if (present && !indices.m_PresentFamily.has_value())
 			{
 				indices.m_PresentFamily = i;
-				std::cout << "Present Family = " << i << std::endl;
 			}
-			if (indices.isComplete())
+		}
+
+		// Transfer-only families are usually DMA engines that copy while the
+		// graphics queue renders; compute-only families run async compute.
+		for (uint32_t i = 0; i < info.queueFamilies.size(); ++i)
+		{
+			auto& qp = info.queueFamilies[i];
+			if (qp.queueCount == 0)
 			{
-				break;
+				continue;
+			}
+			auto flags = qp.queueFlags;
+			if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+				!indices.m_TransferFamily.has_value())
+			{
+				indices.m_TransferFamily = i;
+			}
+			if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) &&
+				!indices.m_ComputeFamily.has_value())
+			{
+				indices.m_ComputeFamily = i;
 			}
-			i++;
+		}
+		if (!indices.m_TransferFamily.has_value())
+		{
+			indices.m_TransferFamily = indices.m_GraphicsFamily;
+		}
+		if (!indices.m_ComputeFamily.has_value())
+		{
+			indices.m_ComputeFamily = indices.m_GraphicsFamily;
+		}
+
+		if (indices.isComplete())
+		{
+			std::cout << "Graphics Family = " << indices.m_GraphicsFamily.value()
+				<< " Present Family = " << indices.m_PresentFamily.value()
+				<< " Transfer Family = " << indices.m_TransferFamily.value()
+				<< " Compute Family = " << indices.m_ComputeFamily.value() << std::endl;
 		}
 		return indices;
 	}
 
 	void createLogicalDevice()
 	{
-		auto indices = findQueueFamilies(m_PhysicalDevice);
+		TRACE_SCOPE("createLogicalDevice");
+		auto& indices = m_DeviceInfo->queueFamilyIndices;
 		std::vector <VkDeviceQueueCreateInfo> queueCreateInfos;
 		std::set<uint32_t> uniqueQueueFamilies = { 
 			indices.m_GraphicsFamily.value(),
-			indices.m_PresentFamily.value() 
+			indices.m_PresentFamily.value(),
+			indices.m_TransferFamily.value(),
+			indices.m_ComputeFamily.value()
 		};
 		float queuePriority = 1.0f;
 		for (auto& qFamily : uniqueQueueFamilies)
@@ -460,14 +1385,33 @@ private:
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
 
+		auto extensions = getRequiredDeviceExtensions();
+#ifdef VK_EXT_pipeline_creation_feedback
+		// Optional: lets us tell whether a pipeline was served from the cache.
+		if (m_DeviceInfo->hasExtension(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME))
+		{
+			extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+			m_HasPipelineCreationFeedback = true;
+		}
+#endif
 		VkPhysicalDeviceFeatures physicalDeviceFeatures = {};
+		// Just what BindlessDescriptors needs; findUnsuitability checked they are supported.
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+		descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+		descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		descriptorIndexingFeatures.pNext = nullptr;
 		VkDeviceCreateInfo deviceCreateInfo = {};
 		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 		deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 		deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 		deviceCreateInfo.pEnabledFeatures = &physicalDeviceFeatures;
-		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+		deviceCreateInfo.ppEnabledExtensionNames = extensions.data();
+		deviceCreateInfo.pNext = &descriptorIndexingFeatures;
 		if (enableValidationLayers)
 		{
 			deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -478,17 +1422,23 @@ private:
 			deviceCreateInfo.enabledLayerCount = 0;
 		}
 
-		if (vkCreateDevice(m_PhysicalDevice, &deviceCreateInfo, nullptr, &m_Device) != VK_SUCCESS)
+		if (traceCall("vkCreateDevice", [&] { return vkCreateDevice(m_PhysicalDevice, &deviceCreateInfo, nullptr, &m_Device); }) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Can't create logical device.");
 		}
 
 		vkGetDeviceQueue(m_Device, indices.m_GraphicsFamily.value(), 0, &m_GraphicsQueue);
 		vkGetDeviceQueue(m_Device, indices.m_PresentFamily.value(), 0, &m_PresentQueue);
+		vkGetDeviceQueue(m_Device, indices.m_TransferFamily.value(), 0, &m_TransferQueue);
+		vkGetDeviceQueue(m_Device, indices.m_ComputeFamily.value(), 0, &m_ComputeQueue);
+		m_AsyncCompute = m_Options.asyncCompute && m_Options.instanceCount > 0 && !m_Options.cpuDraws &&
+			indices.hasDedicatedCompute();
+		m_ComputeAcquires.resize(m_Options.maxFramesInFlight);
 	}
 
 	void createSurface()
 	{
+		TRACE_SCOPE("createSurface");
 		if (glfwCreateWindowSurface(m_Instance, m_Window, nullptr, &m_Surface) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Can't create window surface");
@@ -519,32 +1469,61 @@ private:
 		return sFormat;
 	}
 
+	// First mode of the policy's preference list that the surface supports. FIFO is always supported.
 	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> modes)
 	{
+		std::vector<VkPresentModeKHR> preferred;
+		switch (m_Options.presentPolicy)
+		{
+		case PresentPolicy::LowLatency: preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR }; break;
+		case PresentPolicy::Throughput: preferred = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR }; break;
+		case PresentPolicy::PowerSaving: break;
+		}
 		VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
-		for (const auto& m : modes)
+		for (auto mode : preferred)
 		{
-			if (m == VK_PRESENT_MODE_MAILBOX_KHR)
+			if (std::find(modes.begin(), modes.end(), mode) != modes.end())
 			{
-				bestMode = m;
+				bestMode = mode;
 				break;
 			}
-			else if (m == VK_PRESENT_MODE_IMMEDIATE_KHR)
-			{
-				bestMode = m;
-			}
 		}
 		std::cout << "chooseSwapPresentMode: " << bestMode << std::endl;
 		return bestMode;
 	}
 
+	// Every extra image adds a frame of VRAM and, with FIFO, a frame of queueing.
+	// MAILBOX needs three to always have a free image; throughput adds one so the
+	// GPU can start the next frame while two wait for display.
+	uint32_t chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR presentMode)
+	{
+		uint32_t imageCount = std::max(capabilities.minImageCount, 2u);
+		if (presentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+		{
+			imageCount = std::max(imageCount, 3u);
+		}
+		if (m_Options.presentPolicy == PresentPolicy::Throughput)
+		{
+			imageCount = std::max(imageCount, capabilities.minImageCount + 1);
+		}
+		if (capabilities.maxImageCount != 0)
+		{
+			imageCount = std::min(imageCount, capabilities.maxImageCount);
+		}
+		std::cout << "chooseSwapImageCount: " << imageCount << std::endl;
+		return imageCount;
+	}
+
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
 	{
 		VkExtent2D extent = capabilities.currentExtent;
 		if (capabilities.currentExtent.width == std::numeric_limits<uint32_t>::max())
 		{
 			// Can set extent to other than window resolution
-			extent = { WindowWidth, WindowHeight };
+			int width = 0;
+			int height = 0;
+			glfwGetFramebufferSize(m_Window, &width, &height);
+			extent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
 			extent.width = (extent.width < capabilities.minImageExtent.width)? 
 				capabilities.minImageExtent.width : extent.width;
 			extent.width = (extent.width > capabilities.maxImageExtent.width)? 
@@ -561,13 +1540,16 @@ private:
 
 	void createSwapChain()
 	{
-		auto swapChainSupport = querySwapChainSupport(m_PhysicalDevice);
+		TRACE_SCOPE("createSwapChain");
+		// Formats and present modes come from the device snapshot; the capabilities
+		// track the window size, so they are the one thing queried again.
+		auto swapChainSupport = m_DeviceInfo->swapChainSupport;
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(m_PhysicalDevice, m_Surface, &swapChainSupport.capabilities);
 		auto swapSurfFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
 		auto swapPresentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 		auto swapExtent = chooseSwapExtent(swapChainSupport.capabilities);
 
-		auto imageCount = (swapChainSupport.capabilities.maxImageCount == 0) ?
-			swapChainSupport.capabilities.minImageCount + 1 : swapChainSupport.capabilities.maxImageCount;
+		auto imageCount = chooseSwapImageCount(swapChainSupport.capabilities, swapPresentMode);
 
 		VkSwapchainCreateInfoKHR createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -581,12 +1563,12 @@ private:
 		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 		createInfo.pNext = nullptr;
 
-		QueueFamilyIndices indices = findQueueFamilies(m_PhysicalDevice);
+		auto& indices = m_DeviceInfo->queueFamilyIndices;
+		uint32_t queueFamilyIndices[] = { indices.m_GraphicsFamily.value(), indices.m_PresentFamily.value() };
 		if (indices.m_GraphicsFamily != indices.m_PresentFamily)
 		{
 			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
 			createInfo.queueFamilyIndexCount = 2;
-			uint32_t queueFamilyIndices[] = { indices.m_GraphicsFamily.value(), indices.m_PresentFamily.value() };
 			createInfo.pQueueFamilyIndices = queueFamilyIndices;
 		}
 		else
@@ -599,26 +1581,284 @@ private:
 		createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
 		createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 		createInfo.clipped = VK_TRUE;
-		createInfo.oldSwapchain = VK_NULL_HANDLE;
+		// On resize the old swap chain is retired into the new one and kept until the first acquire.
+		createInfo.oldSwapchain = m_SwapChain.get();
 
-		if (vkCreateSwapchainKHR(m_Device, &createInfo, nullptr, &m_SwapChain) != VK_SUCCESS)
+		VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+		if (traceCall("vkCreateSwapchainKHR", [&] { return vkCreateSwapchainKHR(m_Device, &createInfo, nullptr, &swapChain); }) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Trouble creating swap chain.");
 		}
+		if (m_SwapChain)
+		{
+			m_RetiredSwapChains.push_back(std::move(m_SwapChain));
+		}
+		m_SwapChain = UniqueSwapchain(m_Device, swapChain);
 		std::cout << "Created swap chain." << std::endl;
 
 		imageCount = 0;
-		vkGetSwapchainImagesKHR(m_Device, m_SwapChain, &imageCount, nullptr);
+		vkGetSwapchainImagesKHR(m_Device, m_SwapChain.get(), &imageCount, nullptr);
 		m_SwapChainImages.resize(imageCount);
-		vkGetSwapchainImagesKHR(m_Device, m_SwapChain, &imageCount, m_SwapChainImages.data());
+		vkGetSwapchainImagesKHR(m_Device, m_SwapChain.get(), &imageCount, m_SwapChainImages.data());
 		std::cout << "Got " << imageCount << " swap chain images" << std::endl;
+
+		for (auto& semaphore : m_RenderFinished)
+		{
+			m_RetiredRenderFinished.push_back(std::move(semaphore));
+		}
+		m_RenderFinished.clear();
+		m_RenderFinished.resize(imageCount);
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = nullptr;
+		for (auto& semaphore : m_RenderFinished)
+		{
+			if (vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, semaphore.replace(m_Device)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Trouble creating present semaphore.");
+			}
+		}
 		
 		m_SwapChainFormat = swapSurfFormat.format;
 		m_SwapChainExtent = swapExtent;
 	}
 
+	// Replaces the swap chain and its views without waiting for
+	// the GPU. The old views go to m_DeletionQueue, which destroys them
+	// once every frame using them has finished; the old swap chain and
+	// present semaphores follow after the next acquire, see drawFrame.
+	// Pipelines are unaffected since viewport and scissor are dynamic state.
+	void recreateSwapChain()
+	{
+		TRACE_SCOPE("recreateSwapChain");
+		int width = 0;
+		int height = 0;
+		glfwGetFramebufferSize(m_Window, &width, &height);
+		if (width == 0 || height == 0)
+		{
+			// Minimised: leave m_SwapChainOutOfDate set and try again once there is an area to draw to.
+			return;
+		}
+		m_SwapChainOutOfDate = false;
+
+		for (auto& iv : m_SwapChainImageViews)
+		{
+			m_DeletionQueue.push(m_FrameNumber, std::move(iv));
+		}
+		m_SwapChainImageViews.clear();
+
+		createSwapChain();
+		createImageViews();
+		// Framebuffers of the old views are released by the graph in the same way.
+		m_RenderGraph->setExtent(m_SwapChainExtent, m_FrameNumber);
+		m_ImagesInFlight.assign(m_SwapChainImages.size(), VK_NULL_HANDLE);
+	}
+
+	void createAllocator()
+	{
+		TRACE_SCOPE("createAllocator");
+		m_Allocator = std::make_unique<DeviceMemoryAllocator>(m_Device, m_DeviceInfo->memoryProperties,
+			m_DeviceInfo->properties.limits);
+	}
+
+	void createDescriptorAllocators()
+	{
+		TRACE_SCOPE("createDescriptorAllocators");
+		auto& limits = m_DeviceInfo->descriptorIndexingProperties;
+		// Both arrays are visible to every stage, so they share the per-stage resource limit.
+		auto perStageShare = limits.maxPerStageUpdateAfterBindResources / 2;
+		auto textureCapacity = std::min({ BindlessTextureCapacity, perStageShare,
+			limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+			limits.maxDescriptorSetUpdateAfterBindSampledImages, limits.maxDescriptorSetUpdateAfterBindSamplers });
+		auto bufferCapacity = std::min({ BindlessBufferCapacity, perStageShare,
+			limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers, limits.maxDescriptorSetUpdateAfterBindStorageBuffers });
+		m_Bindless = std::make_unique<BindlessDescriptors>(m_Device, textureCapacity, bufferCapacity);
+		std::cout << "Bindless set holds " << textureCapacity << " textures and " << bufferCapacity << " storage buffers." << std::endl;
+
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * FrameDescriptorSetsPerPool },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 * FrameDescriptorSetsPerPool },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * FrameDescriptorSetsPerPool }
+		};
+		m_FrameDescriptors = std::make_unique<FrameDescriptorAllocator>(m_Device, m_Options.maxFramesInFlight,
+			poolSizes, FrameDescriptorSetsPerPool);
+	}
+
+	// Transforms reach the vertex shaders through set 1: two dynamic uniform
+	// buffers whose offsets point into the uniform ring.
+	void createUniformRing()
+	{
+		TRACE_SCOPE("createUniformRing");
+		auto alignment = m_DeviceInfo->properties.limits.minUniformBufferOffsetAlignment;
+		auto objectSize = (sizeof(ObjectUniforms) + alignment - 1) / alignment * alignment;
+		// FrameUniforms plus one ObjectUniforms per draw.
+		VkDeviceSize drawCount = m_Options.cpuDraws ? m_Options.instanceCount : 1;
+		auto frameSize = std::max(UniformRingFrameSize, objectSize * (drawCount + 1));
+		// Host-visible VRAM where there is some, so the vertex shaders don't read across the bus.
+		m_UniformBuffer = createBuffer(UniformRing::getBufferSize(frameSize, m_Options.maxFramesInFlight, alignment),
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_UniformMemory);
+		m_UniformRing = std::make_unique<UniformRing>(m_UniformMemory.mapped, frameSize, m_Options.maxFramesInFlight, alignment);
+
+		VkDescriptorSetLayoutBinding bindings[2] = {};
+		for (uint32_t b = 0; b < 2; ++b)
+		{
+			bindings[b].binding = b;
+			bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			bindings[b].descriptorCount = 1;
+			bindings[b].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+			bindings[b].pImmutableSamplers = nullptr;
+		}
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = 2;
+		layoutInfo.pBindings = bindings;
+		layoutInfo.pNext = nullptr;
+		if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, m_UniformSetLayout.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create uniform descriptor set layout.");
+		}
+
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		poolSize.descriptorCount = 2;
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = 1;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+		poolInfo.pNext = nullptr;
+		if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, m_UniformDescriptorPool.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create uniform descriptor pool.");
+		}
+		auto uniformSetLayout = m_UniformSetLayout.get();
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = m_UniformDescriptorPool.get();
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &uniformSetLayout;
+		allocInfo.pNext = nullptr;
+		if (vkAllocateDescriptorSets(m_Device, &allocInfo, &m_UniformSet) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't allocate uniform descriptor set.");
+		}
+
+		VkDescriptorBufferInfo bufferInfos[2] = {
+			{ m_UniformBuffer.get(), 0, sizeof(FrameUniforms) },
+			{ m_UniformBuffer.get(), 0, sizeof(ObjectUniforms) }
+		};
+		VkWriteDescriptorSet writes[2] = {};
+		for (uint32_t b = 0; b < 2; ++b)
+		{
+			writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[b].dstSet = m_UniformSet;
+			writes[b].dstBinding = b;
+			writes[b].dstArrayElement = 0;
+			writes[b].descriptorCount = 1;
+			writes[b].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			writes[b].pBufferInfo = &bufferInfos[b];
+			writes[b].pNext = nullptr;
+		}
+		vkUpdateDescriptorSets(m_Device, 2, writes, 0, nullptr);
+	}
+
+	MemoryAllocation allocateImageMemory(VkImage image, VkMemoryPropertyFlags required,
+		VkMemoryPropertyFlags preferred = 0, bool dedicated = false)
+	{
+		VkMemoryRequirements memRequirements;
+		vkGetImageMemoryRequirements(m_Device, image, &memRequirements);
+		auto allocation = m_Allocator->allocate(memRequirements, required, preferred, ResourceKind::Optimal, dedicated);
+		if (vkBindImageMemory(m_Device, image, allocation.memory, allocation.offset) != VK_SUCCESS)
+		{
+			m_Allocator->free(allocation);
+			throw std::runtime_error("Trouble binding image memory.");
+		}
+		return allocation;
+	}
+
+	// Host-visible buffers come back persistently mapped (MemoryAllocation::mapped).
+	UniqueBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required,
+		VkMemoryPropertyFlags preferred, MemoryAllocation& allocation)
+	{
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = usage;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		bufferInfo.pNext = nullptr;
+		VkBuffer buffer;
+		if (vkCreateBuffer(m_Device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Trouble creating buffer.");
+		}
+
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(m_Device, buffer, &memRequirements);
+		allocation = m_Allocator->allocate(memRequirements, required, preferred, ResourceKind::Linear);
+		if (vkBindBufferMemory(m_Device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS)
+		{
+			m_Allocator->free(allocation);
+			vkDestroyBuffer(m_Device, buffer, nullptr);
+			throw std::runtime_error("Trouble binding buffer memory.");
+		}
+		return UniqueBuffer(m_Device, buffer);
+	}
+
+	void logMemoryStats()
+	{
+		auto stats = m_Allocator->getHeapStats();
+		for (size_t i = 0; i < stats.size(); ++i)
+		{
+			auto& heap = stats[i];
+			if (heap.peakReservedBytes == 0)
+			{
+				continue;
+			}
+			std::cout << "Memory heap " << i << ": " << heap.allocationCount << " allocations in "
+				<< heap.blockCount << " blocks + " << heap.dedicatedCount << " dedicated, "
+				<< heap.usedBytes / 1024 << " KiB used of " << heap.reservedBytes / 1024 << " KiB reserved (peak "
+				<< heap.peakReservedBytes / 1024 << " KiB), fragmentation " << heap.fragmentation() << std::endl;
+		}
+	}
+
+	void createOffscreenImages()
+	{
+		TRACE_SCOPE("createOffscreenImages");
+		m_SwapChainFormat = OffscreenFormat;
+		m_SwapChainExtent = { m_Options.width, m_Options.height };
+		m_SwapChainImages.resize(OffscreenImageCount);
+		m_OffscreenImageMemory.resize(OffscreenImageCount);
+		for (uint32_t i = 0; i < OffscreenImageCount; ++i)
+		{
+			VkImageCreateInfo createInfo = {};
+			createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			createInfo.imageType = VK_IMAGE_TYPE_2D;
+			createInfo.format = m_SwapChainFormat;
+			createInfo.extent = { m_SwapChainExtent.width, m_SwapChainExtent.height, 1 };
+			createInfo.mipLevels = 1;
+			createInfo.arrayLayers = 1;
+			createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			createInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			createInfo.pNext = nullptr;
+
+			if (vkCreateImage(m_Device, &createInfo, nullptr, &m_SwapChainImages[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Trouble creating offscreen image.");
+			}
+
+			m_OffscreenImageMemory[i] = allocateImageMemory(m_SwapChainImages[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		}
+		std::cout << "Created " << OffscreenImageCount << " offscreen images "
+			<< m_SwapChainExtent.width << "x" << m_SwapChainExtent.height << std::endl;
+	}
+
 	void createImageViews()
 	{
+		TRACE_SCOPE("createImageViews");
 		m_SwapChainImageViews.resize(m_SwapChainImages.size());
 		for (auto i = 0; i < m_SwapChainImageViews.size(); ++i)
 		{
@@ -636,10 +1876,10 @@ private:
 			createInfo.subresourceRange.baseMipLevel = 0;
 			createInfo.subresourceRange.levelCount = 1;
 			createInfo.subresourceRange.baseArrayLayer = 0;
-			createInfo.subresourceRange.layerCount = 0;
+			createInfo.subresourceRange.layerCount = 1;
 			createInfo.pNext = nullptr;
 
-			if (vkCreateImageView(m_Device, &createInfo, nullptr, &m_SwapChainImageViews[i]) != VK_SUCCESS)
+			if (vkCreateImageView(m_Device, &createInfo, nullptr, m_SwapChainImageViews[i].replace(m_Device)) != VK_SUCCESS)
 			{
 				throw std::runtime_error("Trouble creating image view");
 			}
@@ -664,76 +1904,415 @@ private:
 		return buffer;
 	}
 
-	VkShaderModule createShaderModule(const std::vector<char>& code)
+	// Shaders/ next to the executable, falling back to the working directory for
+	// runs from the IDE.
+	static std::filesystem::path getShaderDirectory()
+	{
+		auto dir = getExecutableDirectory() / "Shaders";
+		if (!std::filesystem::exists(dir))
+		{
+			dir = "Shaders";
+		}
+		return dir;
+	}
+
+	// name is the GLSL source, e.g. "shader.vert". With TRIANGLE_RUNTIME_SHADERS it
+	// is compiled (or fetched from the shader cache) at runtime; with
+	// TRIANGLE_EMBED_SHADERS the SPIR-V is compiled into the binary; otherwise the
+	// prebuilt Shaders/<name>.spv is mapped.
+	ShaderBlob loadShader(const std::string& name)
+	{
+		TRACE_SCOPE("loadShader");
+#if defined(TRIANGLE_RUNTIME_SHADERS)
+		if (!m_ShaderCompiler)
+		{
+			m_ShaderCompiler = std::make_unique<ShaderCompiler>(getShaderDirectory(),
+				getCacheDirectory() / "ShaderCache");
+		}
+		return m_ShaderCompiler->compile(name);
+#elif defined(TRIANGLE_EMBED_SHADERS)
+		if (name == "shader.vert")
+		{
+			return ShaderBlob::fromMemory(shaderVertSpv, sizeof(shaderVertSpv));
+		}
+		if (name == "shader.frag")
+		{
+			return ShaderBlob::fromMemory(shaderFragSpv, sizeof(shaderFragSpv));
+		}
+		if (name == "instanced.vert")
+		{
+			return ShaderBlob::fromMemory(instancedVertSpv, sizeof(instancedVertSpv));
+		}
+		if (name == "cull.comp")
+		{
+			return ShaderBlob::fromMemory(cullCompSpv, sizeof(cullCompSpv));
+		}
+		throw std::runtime_error("loadShader: No embedded shader " + name + ".");
+#else
+		auto path = getShaderDirectory() / (name + ".spv");
+		auto blob = ShaderBlob::map(path);
+		std::cout << "Mapped shader " << path.string() << std::endl;
+		return blob;
+#endif
+	}
+
+	VkShaderModule createShaderModule(const ShaderBlob& code)
 	{
 		VkShaderModuleCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 		createInfo.codeSize = code.size();
-		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+		createInfo.pCode = code.code();
 		createInfo.pNext = nullptr;
 
 		VkShaderModule module;
-		if (vkCreateShaderModule(m_Device, &createInfo, nullptr, &module) != VK_SUCCESS)
+		if (traceCall("vkCreateShaderModule", [&] { return vkCreateShaderModule(m_Device, &createInfo, nullptr, &module); }) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Can't create shader module");
 		}
 		return module;
 	}
 
-	void createRenderPass()
+	// Returns false for blobs written by another driver, device or cache version.
+	// Those are dropped rather than handed to vkCreatePipelineCache.
+	bool isPipelineCacheCompatible(const std::vector<char>& data)
 	{
-		VkAttachmentDescription colorAttachment = {};
-		colorAttachment.format = m_SwapChainFormat;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		// VkPipelineCacheHeaderVersionOne: length, version, vendorID, deviceID, pipelineCacheUUID.
+		const size_t headerSize = 16 + VK_UUID_SIZE;
+		if (data.size() < headerSize)
+		{
+			return false;
+		}
+		uint32_t header[4];
+		memcpy(header, data.data(), sizeof(header));
+
+		auto& properties = m_DeviceInfo->properties;
+		return header[0] >= headerSize && header[0] <= data.size() &&
+			header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			header[2] == properties.vendorID &&
+			header[3] == properties.deviceID &&
+			memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
+	void createPipelineCache()
+	{
+		TRACE_SCOPE("createPipelineCache");
+		std::vector<char> data;
+		if (!m_Options.pipelineCachePath.empty())
+		{
+			std::ifstream file(m_Options.pipelineCachePath, std::ios::ate | std::ios::binary);
+			if (file.is_open())
+			{
+				data.resize(static_cast<size_t>(file.tellg()));
+				file.seekg(0);
+				file.read(data.data(), data.size());
+			}
+		}
+		if (!data.empty() && !isPipelineCacheCompatible(data))
+		{
+			std::cout << "Discarding incompatible pipeline cache " << m_Options.pipelineCachePath << std::endl;
+			data.clear();
+		}
+		m_PipelineCacheLoaded = !data.empty();
+
+		VkPipelineCacheCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		createInfo.initialDataSize = data.size();
+		createInfo.pInitialData = data.empty() ? nullptr : data.data();
+		createInfo.pNext = nullptr;
+
+		if (traceCall("vkCreatePipelineCache", [&] { return vkCreatePipelineCache(m_Device, &createInfo, nullptr, m_PipelineCache.replace(m_Device)); }) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create pipeline cache.");
+		}
+
+		// Worker caches start from the same blob so background compiles also hit.
+		m_WorkerPipelineCaches.resize(m_CompilePool->size());
+		for (auto& workerCache : m_WorkerPipelineCaches)
+		{
+			if (vkCreatePipelineCache(m_Device, &createInfo, nullptr, workerCache.replace(m_Device)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Can't create worker pipeline cache.");
+			}
+		}
+		std::cout << "Created pipeline cache (" << (m_PipelineCacheLoaded ? "warm, " : "cold, ")
+			<< data.size() << " bytes)." << std::endl;
+	}
+
+	void savePipelineCache()
+	{
+		TRACE_SCOPE("savePipelineCache");
+		if (m_Options.pipelineCachePath.empty())
+		{
+			return;
+		}
+		size_t size = 0;
+		vkGetPipelineCacheData(m_Device, m_PipelineCache.get(), &size, nullptr);
+		std::vector<char> data(size);
+		if (size == 0 || vkGetPipelineCacheData(m_Device, m_PipelineCache.get(), &size, data.data()) != VK_SUCCESS)
+		{
+			std::cout << "No pipeline cache data to save." << std::endl;
+			return;
+		}
 
-		VkAttachmentReference attachmentRef = {};
-		attachmentRef.attachment = 0;
-		attachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		// Write to a temporary file and rename it over the old cache, so an
+		// interrupted run never leaves a truncated blob behind.
+		auto tmpPath = m_Options.pipelineCachePath + ".tmp";
+		{
+			std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+			file.write(data.data(), size);
+			if (!file)
+			{
+				std::cout << "Can't write pipeline cache " << tmpPath << std::endl;
+				return;
+			}
+		}
+		std::error_code ec;
+		std::filesystem::rename(tmpPath, m_Options.pipelineCachePath, ec);
+		if (ec)
+		{
+			std::cout << "Can't replace pipeline cache: " << ec.message() << std::endl;
+			std::filesystem::remove(tmpPath, ec);
+			return;
+		}
+		std::cout << "Saved pipeline cache (" << size << " bytes)." << std::endl;
+	}
 
-		VkSubpassDescription subpass = {};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &attachmentRef;
+	// Highest sample count up to the requested one that both colour and, if
+	// used, depth attachments support.
+	VkSampleCountFlagBits chooseSampleCount()
+	{
+		auto& limits = m_DeviceInfo->properties.limits;
+		auto supported = limits.framebufferColorSampleCounts;
+		if (m_Options.depth)
+		{
+			supported &= limits.framebufferDepthSampleCounts;
+		}
+		for (auto count = m_Options.samples; count > 1; count /= 2)
+		{
+			if ((supported & count) != 0)
+			{
+				return static_cast<VkSampleCountFlagBits>(count);
+			}
+		}
+		return VK_SAMPLE_COUNT_1_BIT;
+	}
 
-		VkRenderPassCreateInfo renderPassCreateInfo = {};
-		renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassCreateInfo.attachmentCount = 1;
-		renderPassCreateInfo.pAttachments = &colorAttachment;
-		renderPassCreateInfo.subpassCount = 1;
-		renderPassCreateInfo.pSubpasses = &subpass;
-		renderPassCreateInfo.pNext = nullptr;
+	// Prefers formats without stencil, which nothing here uses.
+	VkFormat findDepthFormat()
+	{
+		VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM,
+			VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT };
+		for (auto format : candidates)
+		{
+			VkFormatProperties properties;
+			vkGetPhysicalDeviceFormatProperties(m_PhysicalDevice, format, &properties);
+			if ((properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) != 0)
+			{
+				return format;
+			}
+		}
+		throw std::runtime_error("No supported depth format.");
+	}
 
-		if (vkCreateRenderPass(m_Device, &renderPassCreateInfo, nullptr, &m_RenderPass) != VK_SUCCESS)
+	// Declares the frame's passes. The graph derives the barriers between
+	// resetting the draw command, culling and drawing, and builds the render
+	// pass the pipelines are created against. Multisampled colour and depth are
+	// graph transients: they live only inside the render pass, so they get
+	// lazily allocated memory where the device has it and are never stored.
+	void createRenderGraph()
+	{
+		TRACE_SCOPE("createRenderGraph");
+		m_SampleCount = chooseSampleCount();
+		m_DepthFormat = m_Options.depth ? findDepthFormat() : VK_FORMAT_UNDEFINED;
+		std::cout << "Rendering with " << m_SampleCount << " samples per pixel"
+			<< (m_Options.depth ? " and a depth attachment." : ".") << std::endl;
+		m_RenderGraph = std::make_unique<RenderGraph>(m_Device, *m_Allocator);
+		auto& graph = *m_RenderGraph;
+		// The image is only ours once the acquire semaphore signals, which the
+		// submit waits for at the colour output stage.
+		m_BackbufferResource = graph.importImage("backbuffer", m_SwapChainFormat, VK_SAMPLE_COUNT_1_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			m_Options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		bool gpuCulling = m_Options.instanceCount > 0 && !m_Options.cpuDraws;
+		if (gpuCulling)
+		{
+			m_InstanceResource = graph.importBuffer("instances");
+			m_VisibleInstanceResource = graph.importBuffer("visible instances");
+			m_DrawCommandResource = graph.importBuffer("draw command");
+		}
+		// With async compute the culled buffers arrive through ownership acquires
+		// recorded before the graph, so the main pass just reads them.
+		if (gpuCulling && !m_AsyncCompute)
+		{
+			graph.addPass("reset draw command", RenderGraphPassType::Transfer, [this](VkCommandBuffer commandBuffer)
+			{
+				resetDrawCommand(commandBuffer);
+			}).write(m_DrawCommandResource, RenderGraphAccess::TransferWrite);
+			graph.addPass("cull", RenderGraphPassType::Compute, [this](VkCommandBuffer commandBuffer)
+			{
+				recordCulling(commandBuffer);
+			}).read(m_InstanceResource, RenderGraphAccess::StorageReadCompute)
+				.write(m_VisibleInstanceResource, RenderGraphAccess::StorageWriteCompute)
+				.write(m_DrawCommandResource, RenderGraphAccess::StorageWriteCompute);
+		}
+		auto main = graph.addPass("main", RenderGraphPassType::Raster, [this](VkCommandBuffer commandBuffer)
+		{
+			recordMainPass(commandBuffer);
+		});
+		VkClearColorValue clearColor = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+		if (m_SampleCount == VK_SAMPLE_COUNT_1_BIT)
+		{
+			main.clearColor(m_BackbufferResource, clearColor);
+		}
+		else
+		{
+			auto color = graph.createImage("multisampled color", m_SwapChainFormat, m_SampleCount);
+			main.clearColor(color, clearColor).resolve(color, m_BackbufferResource);
+		}
+		if (m_Options.depth)
+		{
+			main.clearDepth(graph.createImage("depth", m_DepthFormat, m_SampleCount), { 1.0f, 0 });
+		}
+		if (gpuCulling)
+		{
+			main.read(m_VisibleInstanceResource, RenderGraphAccess::VertexBuffer)
+				.read(m_DrawCommandResource, RenderGraphAccess::IndirectBuffer);
+		}
+		if (m_Options.cpuDraws)
 		{
-			throw std::runtime_error("Can't create render pass.");
+			main.secondaryCommandBuffers();
 		}
-		std::cout << "Created render pass" << std::endl;
+		m_MainPass = main.id();
+		graph.compile(m_SwapChainExtent);
+		m_RenderPass = graph.getRenderPass(m_MainPass);
 	}
 
 	void createGraphicsPipeline()
 	{
-		auto vertShader = readFile("Shaders/vert.spv");
-		auto fragShader = readFile("Shaders/frag.spv");
+		TRACE_SCOPE("createGraphicsPipeline");
+		auto vertShader = loadShader("shader.vert");
+		auto fragShader = loadShader("shader.frag");
+
+		// Kept until cleanup so pipeline variants can be compiled later from any thread.
+		m_Shaders.vertex = UniqueShaderModule(m_Device, createShaderModule(vertShader));
+		m_Shaders.fragment = UniqueShaderModule(m_Device, createShaderModule(fragShader));
+		m_Shaders.vertexHash = vertShader.hash();
+		m_Shaders.fragmentHash = fragShader.hash();
+
+		// Set 0 is the bindless set; draws pick their resources with DrawConstants.
+		// Set 1 holds the transforms.
+		VkDescriptorSetLayout setLayouts[] = { m_Bindless->getLayout(), m_UniformSetLayout.get() };
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(DrawConstants);
+		VkPipelineLayoutCreateInfo pipelineCreateInfo = {};
+		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineCreateInfo.setLayoutCount = 2;
+		pipelineCreateInfo.pSetLayouts = setLayouts;
+		pipelineCreateInfo.pushConstantRangeCount = 1;
+		pipelineCreateInfo.pPushConstantRanges = &pushConstantRange;
+		pipelineCreateInfo.pNext = nullptr;
+
+		if (vkCreatePipelineLayout(m_Device, &pipelineCreateInfo, nullptr, m_PipelineLayout.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Error creating pipeline layout.");
+		}
+
+		m_PipelineLibrary = std::make_unique<PipelineLibrary>(m_Device);
+		m_PipelineKey = makePipelineKey(PipelineDesc(), m_Shaders.handles());
+		m_Pipeline = getPipeline(PipelineDesc());
+	}
+
+	static void getVertexLayout(bool instanced, std::vector<VkVertexInputBindingDescription>& bindings,
+		std::vector<VkVertexInputAttributeDescription>& attributes)
+	{
+		bindings = { Vertex::getBindingDescription() };
+		attributes = Vertex::getAttributeDescriptions();
+		if (instanced)
+		{
+			bindings.push_back(InstanceData::getBindingDescription());
+			auto instanceAttributes = InstanceData::getAttributeDescriptions();
+			attributes.insert(attributes.end(), instanceAttributes.begin(), instanceAttributes.end());
+		}
+	}
+
+	static VkPipelineColorBlendAttachmentState getBlendAttachment(BlendMode blendMode)
+	{
+		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+		colorBlendAttachment.blendEnable = blendMode == BlendMode::Opaque ? VK_FALSE : VK_TRUE;
+		colorBlendAttachment.srcColorBlendFactor = blendMode == BlendMode::Alpha ?
+			VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.dstColorBlendFactor = blendMode == BlendMode::Alpha ?
+			VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+		colorBlendAttachment.colorWriteMask =
+			VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+			VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		return colorBlendAttachment;
+	}
 
-		auto vertShaderModule = createShaderModule(vertShader);
-		auto fragShaderModule = createShaderModule(fragShader);
+	// The state buildPipeline(desc, shaders) uses, as a PipelineLibrary key. Other
+	// render passes can't be inspected, so their handle stands in for the class.
+	PipelineKey makePipelineKey(const PipelineDesc& desc, const PipelineShaderHandles& shaders) const
+	{
+		bool mainPass = desc.renderPass == VK_NULL_HANDLE;
+		std::vector<VkVertexInputBindingDescription> bindings;
+		std::vector<VkVertexInputAttributeDescription> attributes;
+		getVertexLayout(desc.instanced, bindings, attributes);
+		auto blend = getBlendAttachment(desc.blendMode);
+
+		PipelineKey key;
+		key.vertexShader = desc.instanced ? shaders.instancedVertexHash : shaders.vertexHash;
+		key.fragmentShader = shaders.fragmentHash;
+		key.vertexLayout = PipelineKey::hashVertexLayout(bindings, attributes);
+		key.topology = desc.topology;
+		key.cullMode = desc.cullMode;
+		key.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		key.blendEnable = blend.blendEnable;
+		key.srcColorBlendFactor = blend.srcColorBlendFactor;
+		key.dstColorBlendFactor = blend.dstColorBlendFactor;
+		key.depthTestEnable = mainPass && m_DepthFormat != VK_FORMAT_UNDEFINED;
+		key.depthWriteEnable = key.depthTestEnable;
+		key.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		key.samples = mainPass ? m_SampleCount : VK_SAMPLE_COUNT_1_BIT;
+		key.renderPassClass = mainPass ? m_RenderGraph->getRenderPassCompatibility(m_MainPass) :
+			reinterpret_cast<uint64_t>(desc.renderPass);
+		key.subpass = desc.subpass;
+		key.normalize();
+		return key;
+	}
+
+	// Builds the pipeline on this thread unless the library already has an
+	// equivalent one, in which case no Vulkan call is made.
+	VkPipeline getPipeline(const PipelineDesc& desc)
+	{
+		auto shaders = m_Shaders.handles();
+		return m_PipelineLibrary->get(makePipelineKey(desc, shaders), [&]
+		{
+			return buildPipeline(desc, shaders, m_PipelineCache.get());
+		});
+	}
 
+	// Safe to call from several threads at once as long as each passes its own
+	// cache: it only reads state that is fixed after createGraphicsPipeline.
+	VkPipeline buildPipeline(const PipelineDesc& desc, const PipelineShaderHandles& shaders, VkPipelineCache cache)
+	{
+		TRACE_SCOPE("buildPipeline");
 		VkPipelineShaderStageCreateInfo vsCreateInfo = {};
 		vsCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vsCreateInfo.module = vertShaderModule;
+		vsCreateInfo.module = desc.instanced ? shaders.instancedVertex : shaders.vertex;
 		vsCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
 		vsCreateInfo.pName = "main";
 		vsCreateInfo.pNext = nullptr;
 
 		VkPipelineShaderStageCreateInfo fsCreateInfo = {};
 		fsCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fsCreateInfo.module = fragShaderModule;
+		fsCreateInfo.module = shaders.fragment;
 		fsCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		fsCreateInfo.pName = "main";
 		fsCreateInfo.pNext = nullptr;
@@ -742,45 +2321,44 @@ private:
 
 		VkPipelineVertexInputStateCreateInfo visCreateInfo = {};
 		visCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		visCreateInfo.vertexAttributeDescriptionCount = 0;
-		visCreateInfo.pVertexAttributeDescriptions = nullptr;
-		visCreateInfo.vertexBindingDescriptionCount = 0;
-		visCreateInfo.pVertexBindingDescriptions = nullptr;
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+		getVertexLayout(desc.instanced, bindingDescriptions, attributeDescriptions);
+		visCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+		visCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+		visCreateInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+		visCreateInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 		visCreateInfo.pNext = nullptr;
 
 		VkPipelineInputAssemblyStateCreateInfo iasCreateInfo = {};
 		iasCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		iasCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		iasCreateInfo.topology = desc.topology;
 		iasCreateInfo.primitiveRestartEnable = VK_FALSE;
 		iasCreateInfo.pNext = nullptr;
 
-		VkViewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = static_cast<float>(m_SwapChainExtent.width);
-		viewport.height = static_cast<float>(m_SwapChainExtent.height);
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-
-		VkRect2D scissor = {};
-		scissor.offset = { 0, 0 };
-		scissor.extent = m_SwapChainExtent;
-		
+		// Viewport and scissor are set at record time, so pipelines survive a resize.
 		VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
 		viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 		viewportStateCreateInfo.viewportCount = 1;
-		viewportStateCreateInfo.pViewports = &viewport;
+		viewportStateCreateInfo.pViewports = nullptr;
 		viewportStateCreateInfo.scissorCount = 1;
-		viewportStateCreateInfo.pScissors = &scissor;
+		viewportStateCreateInfo.pScissors = nullptr;
 		viewportStateCreateInfo.pNext = nullptr;
 
+		VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
+		dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicStateCreateInfo.dynamicStateCount = 2;
+		dynamicStateCreateInfo.pDynamicStates = dynamicStates;
+		dynamicStateCreateInfo.pNext = nullptr;
+
 		VkPipelineRasterizationStateCreateInfo rasterCreateInfo = {};
 		rasterCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 		rasterCreateInfo.depthClampEnable = VK_FALSE;
 		rasterCreateInfo.rasterizerDiscardEnable = VK_FALSE;
 		rasterCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
 		rasterCreateInfo.lineWidth = 1.0f;
-		rasterCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
+		rasterCreateInfo.cullMode = desc.cullMode;
 		rasterCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 		rasterCreateInfo.depthBiasEnable = VK_FALSE;
 		rasterCreateInfo.depthBiasClamp = 0.0f;
@@ -788,9 +2366,11 @@ private:
 		rasterCreateInfo.depthBiasSlopeFactor = 0.0f;
 		rasterCreateInfo.pNext = nullptr;
 
+		// Other render passes are assumed to be single-sampled without depth.
+		bool mainPass = desc.renderPass == VK_NULL_HANDLE;
 		VkPipelineMultisampleStateCreateInfo msCreateInfo = {};
 		msCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		msCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		msCreateInfo.rasterizationSamples = mainPass ? m_SampleCount : VK_SAMPLE_COUNT_1_BIT;
 		msCreateInfo.sampleShadingEnable = VK_FALSE;
 		msCreateInfo.alphaToCoverageEnable = VK_FALSE;
 		msCreateInfo.alphaToOneEnable = VK_FALSE;
@@ -798,11 +2378,7 @@ private:
 		msCreateInfo.pSampleMask = nullptr;
 		msCreateInfo.pNext = nullptr;
 
-		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-		colorBlendAttachment.blendEnable = VK_FALSE;
-		colorBlendAttachment.colorWriteMask =
-			VK_COLOR_COMPONENT_R_BIT || VK_COLOR_COMPONENT_G_BIT ||
-			VK_COLOR_COMPONENT_B_BIT || VK_COLOR_COMPONENT_A_BIT;
+		auto colorBlendAttachment = getBlendAttachment(desc.blendMode);
 
 		VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo = {};
 		colorBlendCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -811,18 +2387,15 @@ private:
 		colorBlendCreateInfo.logicOpEnable = VK_FALSE;
 		colorBlendCreateInfo.pNext = nullptr;
 
-		VkPipelineLayoutCreateInfo pipelineCreateInfo = {};
-		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineCreateInfo.setLayoutCount = 0;
-		pipelineCreateInfo.pSetLayouts = nullptr;
-		pipelineCreateInfo.pushConstantRangeCount = 0;
-		pipelineCreateInfo.pPushConstantRanges = nullptr;
-		pipelineCreateInfo.pNext = nullptr;
-
-		if (vkCreatePipelineLayout(m_Device, &pipelineCreateInfo, nullptr, &m_PipelineLayout) != VK_SUCCESS)
-		{
-			throw std::runtime_error("Error creating pipeline layout.");
-		}
+		// Everything is drawn at the same depth; LESS_OR_EQUAL keeps later draws on top.
+		VkPipelineDepthStencilStateCreateInfo dsCreateInfo = {};
+		dsCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		dsCreateInfo.depthTestEnable = VK_TRUE;
+		dsCreateInfo.depthWriteEnable = VK_TRUE;
+		dsCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		dsCreateInfo.depthBoundsTestEnable = VK_FALSE;
+		dsCreateInfo.stencilTestEnable = VK_FALSE;
+		dsCreateInfo.pNext = nullptr;
 
 		VkGraphicsPipelineCreateInfo gpCreateInfo = {};
 		gpCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -830,60 +2403,2246 @@ private:
 		gpCreateInfo.pStages = shaderStages;
 		gpCreateInfo.pVertexInputState = &visCreateInfo;
 		gpCreateInfo.pColorBlendState = &colorBlendCreateInfo;
-		gpCreateInfo.pDepthStencilState = nullptr;
-		gpCreateInfo.pDynamicState = nullptr;
+		gpCreateInfo.pDepthStencilState = mainPass && m_DepthFormat != VK_FORMAT_UNDEFINED ? &dsCreateInfo : nullptr;
+		gpCreateInfo.pDynamicState = &dynamicStateCreateInfo;
 		gpCreateInfo.pInputAssemblyState = &iasCreateInfo;
 		gpCreateInfo.pMultisampleState = &msCreateInfo;
 		gpCreateInfo.pRasterizationState = &rasterCreateInfo;
 		gpCreateInfo.pViewportState = &viewportStateCreateInfo;
-		gpCreateInfo.layout = m_PipelineLayout;
-		gpCreateInfo.renderPass = m_RenderPass;
-		gpCreateInfo.subpass = 0;
+		gpCreateInfo.layout = m_PipelineLayout.get();
+		gpCreateInfo.renderPass = desc.renderPass != VK_NULL_HANDLE ? desc.renderPass : m_RenderPass;
+		gpCreateInfo.subpass = desc.subpass;
 		gpCreateInfo.pNext = nullptr;
 		gpCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
 		gpCreateInfo.basePipelineIndex = -1;
-		if (vkCreateGraphicsPipelines(m_Device, VK_NULL_HANDLE, 1, &gpCreateInfo, nullptr, &m_Pipeline) != VK_SUCCESS)
+
+#ifdef VK_EXT_pipeline_creation_feedback
+		VkPipelineCreationFeedbackEXT pipelineFeedback = {};
+		VkPipelineCreationFeedbackEXT stageFeedback[2] = {};
+		VkPipelineCreationFeedbackCreateInfoEXT feedbackCreateInfo = {};
+		feedbackCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+		feedbackCreateInfo.pPipelineCreationFeedback = &pipelineFeedback;
+		feedbackCreateInfo.pipelineStageCreationFeedbackCount = 2;
+		feedbackCreateInfo.pPipelineStageCreationFeedbacks = stageFeedback;
+		feedbackCreateInfo.pNext = nullptr;
+		if (m_HasPipelineCreationFeedback)
 		{
-			throw std::runtime_error("Can't create graphics pipeline.");
+			gpCreateInfo.pNext = &feedbackCreateInfo;
 		}
-		std::cout << "Created graphics pipeline." << std::endl;
-
-		vkDestroyShaderModule(m_Device, fragShaderModule, nullptr);
-		vkDestroyShaderModule(m_Device, vertShaderModule, nullptr);
-	}
+#endif
 
-	void mainLoop() {
-		while (!glfwWindowShouldClose(m_Window))
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		auto compileStart = std::chrono::steady_clock::now();
+		if (traceCall("vkCreateGraphicsPipelines", [&] { return vkCreateGraphicsPipelines(m_Device, cache, 1, &gpCreateInfo, nullptr, &pipeline); }) != VK_SUCCESS)
 		{
-			glfwPollEvents();
+			throw std::runtime_error("Can't create graphics pipeline.");
 		}
-	}
+		std::chrono::duration<double, std::milli> compileTime = std::chrono::steady_clock::now() - compileStart;
 
-	void cleanup() {
-		vkDestroyPipeline(m_Device, m_Pipeline, nullptr);
-		vkDestroyRenderPass(m_Device, m_RenderPass, nullptr);
-		vkDestroyPipelineLayout(m_Device, m_PipelineLayout, nullptr);
-		for (auto& iv : m_SwapChainImageViews)
+		// Without creation feedback the best we can report is whether a valid blob was loaded.
+		auto cacheResult = m_PipelineCacheLoaded ? "warm cache" : "cold cache";
+#ifdef VK_EXT_pipeline_creation_feedback
+		if (m_HasPipelineCreationFeedback && (pipelineFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT))
 		{
-			vkDestroyImageView(m_Device, iv, nullptr);
+			cacheResult = (pipelineFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) ?
+				"cache hit" : "cache miss";
 		}
-		vkDestroySwapchainKHR(m_Device, m_SwapChain, nullptr);
+#endif
+		std::lock_guard<std::mutex> lock(m_LogMutex);
+		std::cout << "Created graphics pipeline in " << compileTime.count() << " ms (" << cacheResult << ")." << std::endl;
+		return pipeline;
+	}
+
+	// Compiles a batch of pipelines on the compile pool. Each worker uses its own
+	// VkPipelineCache; they are folded into the main cache by mergeWorkerPipelineCaches.
+	// The futures become ready one by one, so callers can draw with the finished
+	// pipelines while the rest compile. Descs equivalent to a pipeline the library
+	// already has, or to an earlier desc, are not compiled again. The library owns
+	// the returned pipelines.
+	std::vector<std::shared_future<VkPipeline>> compilePipelines(const std::vector<PipelineDesc>& descs)
+	{
+		std::vector<std::shared_future<VkPipeline>> pipelines;
+		auto shaders = m_Shaders.handles();
+		for (auto& desc : descs)
+		{
+			pipelines.push_back(m_PipelineLibrary->request(makePipelineKey(desc, shaders), [&]
+			{
+				return m_CompilePool->submit([this, desc, shaders](uint32_t workerIndex)
+				{
+					return buildPipeline(desc, shaders, m_WorkerPipelineCaches[workerIndex].get());
+				}).share();
+			}));
+		}
+		return pipelines;
+	}
+
+	// Starts compiling --pipeline-variants with the current shaders. Any of
+	// retiredKeys not among the new keys is evicted into the deletion queue,
+	// since frames before m_FrameNumber may still draw with it. Only called
+	// while no variant is compiling, so evicting never waits.
+	void compilePipelineVariants(const std::vector<PipelineKey>* retiredKeys = nullptr)
+	{
+		auto descs = makePipelineVariants(m_Options.pipelineVariants);
+		auto shaders = m_Shaders.handles();
+		m_PipelineVariantKeys.clear();
+		m_DrawableVariants.clear();
+		for (auto& desc : descs)
+		{
+			m_PipelineVariantKeys.push_back(makePipelineKey(desc, shaders));
+			m_DrawableVariants.push_back(canDrawMeshWith(desc));
+		}
+		if (retiredKeys)
+		{
+			for (auto& key : *retiredKeys)
+			{
+				if (key == m_PipelineKey || key == m_InstancedPipelineKey ||
+					std::find(m_PipelineVariantKeys.begin(), m_PipelineVariantKeys.end(), key) != m_PipelineVariantKeys.end())
+				{
+					continue;
+				}
+				// Keys shared by several variants, or with the old m_Pipeline, come back empty after the first eviction.
+				m_DeletionQueue.push(m_FrameNumber, UniquePipeline(m_Device, m_PipelineLibrary->evict(key)));
+			}
+		}
+		m_PipelineVariants = compilePipelines(descs);
+		m_PipelineVariantsReady = false;
+	}
+
+	// Returns the pipeline if it has finished compiling, VK_NULL_HANDLE if it is
+	// still compiling or failed to.
+	static VkPipeline getPipelineIfReady(const std::shared_future<VkPipeline>& pipeline)
+	{
+		if (pipeline.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			return VK_NULL_HANDLE;
+		}
+		try
+		{
+			return pipeline.get();
+		}
+		catch (const std::exception&)
+		{
+			return VK_NULL_HANDLE;
+		}
+	}
+
+	// Whether a variant draws the triangle mesh exactly as m_Pipeline does, so
+	// frames can use it without changing the picture a benchmark measures. The
+	// index buffer is a triangle list, and every triangle faces the camera.
+	static bool canDrawMeshWith(const PipelineDesc& desc)
+	{
+		return desc.topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST && desc.blendMode == BlendMode::Opaque &&
+			(desc.cullMode & VK_CULL_MODE_FRONT_BIT) == 0;
+	}
+
+	// Picks this frame's pipeline for each drawable variant without waiting for any.
+	void updateFramePipelines()
+	{
+		m_FramePipelines.clear();
+		uint32_t readyCount = 0;
+		for (size_t i = 0; i < m_PipelineVariants.size(); ++i)
+		{
+			auto pipeline = getPipelineIfReady(m_PipelineVariants[i]);
+			readyCount += pipeline != VK_NULL_HANDLE;
+			if (m_DrawableVariants[i])
+			{
+				m_FramePipelines.push_back(pipeline != VK_NULL_HANDLE ? pipeline : m_Pipeline);
+			}
+		}
+		if (m_FramePipelines.empty())
+		{
+			m_FramePipelines.push_back(m_Pipeline);
+		}
+		if (!m_PipelineVariantsReady && !m_PipelineVariants.empty() && readyCount == m_PipelineVariants.size())
+		{
+			m_PipelineVariantsReady = true;
+			std::cout << "All " << readyCount << " pipeline variants ready at frame " << m_FrameNumber << "." << std::endl;
+		}
+	}
+
+	void mergeWorkerPipelineCaches()
+	{
+		// Worker caches must not be in use while they are merged.
+		m_CompilePool->waitIdle();
+		std::vector<VkPipelineCache> workerCaches;
+		for (auto& workerCache : m_WorkerPipelineCaches)
+		{
+			workerCaches.push_back(workerCache.get());
+		}
+		if (vkMergePipelineCaches(m_Device, m_PipelineCache.get(),
+			static_cast<uint32_t>(workerCaches.size()), workerCaches.data()) != VK_SUCCESS)
+		{
+			std::cout << "Can't merge worker pipeline caches." << std::endl;
+		}
+	}
+
+	// Called between frames with --watch-shaders. Queues changed shaders, swaps in
+	// a finished reload and starts the next one. Never waits for a compile, so
+	// frames keep using the current pipelines until the new ones are ready.
+	void updateShaderReload()
+	{
+		for (auto& name : m_ShaderWatcher->poll())
+		{
+			if (name == "shader.vert" || name == "shader.frag" ||
+				(name == "instanced.vert" && m_Shaders.instancedVertex))
+			{
+				m_PendingShaderChanges.insert(name);
+			}
+		}
+		// The old modules are destroyed after the swap, so wait until no pipeline
+		// is still compiling from them, such as startup variants.
+		if (m_ShaderReload.valid() && m_ShaderReload.wait_for(std::chrono::seconds(0)) == std::future_status::ready &&
+			!m_PipelineLibrary->isBuilding())
+		{
+			applyShaderReload();
+		}
+		if (!m_ShaderReload.valid() && !m_PendingShaderChanges.empty())
+		{
+			std::vector<std::string> names(m_PendingShaderChanges.begin(), m_PendingShaderChanges.end());
+			m_PendingShaderChanges.clear();
+			m_ShaderReload = m_ShaderReloadThread->submit([this, names, shaders = m_Shaders.handles()](uint32_t)
+			{
+				return reloadShaders(names, shaders);
+			});
+		}
+	}
+
+	// Runs on m_ShaderReloadThread. Compiles the named shaders into a copy of
+	// shaders and builds the pipelines drawn with. The library returns the
+	// current pipeline for any of them the changed shaders don't affect.
+	ShaderReload reloadShaders(const std::vector<std::string>& names, PipelineShaderHandles shaders)
+	{
+		TRACE_SCOPE("reloadShaders");
+		auto start = std::chrono::steady_clock::now();
+		// If anything throws, the new modules go with reload. Pipelines built
+		// before the failure stay in the library, which owns them.
+		ShaderReload reload;
+		for (auto& name : names)
+		{
+			auto blob = compileWatchedShader(name);
+			auto module = name == "shader.vert" ? &shaders.vertex : name == "shader.frag" ? &shaders.fragment : &shaders.instancedVertex;
+			auto hash = name == "shader.vert" ? &shaders.vertexHash : name == "shader.frag" ? &shaders.fragmentHash : &shaders.instancedVertexHash;
+			auto owner = name == "shader.vert" ? &reload.newModules.vertex : name == "shader.frag" ? &reload.newModules.fragment :
+				&reload.newModules.instancedVertex;
+			// Saved without a change that reaches the SPIR-V.
+			if (*hash == blob.hash())
+			{
+				continue;
+			}
+			*owner = UniqueShaderModule(m_Device, createShaderModule(blob));
+			*module = owner->get();
+			*hash = blob.hash();
+			reload.changed = true;
+		}
+		reload.shaders = shaders;
+		if (!reload.changed)
+		{
+			return reload;
+		}
+		// Built without a pipeline cache: the worker caches belong to the pool's
+		// threads, and edited shaders aren't worth keeping in the saved cache.
+		PipelineDesc desc;
+		reload.pipelineKey = makePipelineKey(desc, shaders);
+		reload.pipeline = m_PipelineLibrary->get(reload.pipelineKey, [&]
+		{
+			return buildPipeline(desc, shaders, VK_NULL_HANDLE);
+		});
+		if (shaders.instancedVertex != VK_NULL_HANDLE)
+		{
+			desc.instanced = true;
+			reload.instancedPipelineKey = makePipelineKey(desc, shaders);
+			reload.instancedPipeline = m_PipelineLibrary->get(reload.instancedPipelineKey, [&]
+			{
+				return buildPipeline(desc, shaders, VK_NULL_HANDLE);
+			});
+		}
+		reload.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return reload;
+	}
+
+	// Runs program, looked up on the PATH, with args and waits for it to exit.
+	// No shell is involved, so the arguments are passed through as they are.
+	// Returns the exit code, or -1 if the program couldn't be run.
+	static int runProcess(const std::filesystem::path& program, const std::vector<std::filesystem::path>& args)
+	{
+#ifdef _WIN32
+		// CreateProcess takes one command line, which the child splits again
+		// with the CommandLineToArgvW rules: quote everything, and escape quotes
+		// and the backslashes in front of them.
+		std::wstring commandLine;
+		for (size_t i = 0; i <= args.size(); ++i)
+		{
+			auto arg = i == 0 ? program.wstring() : args[i - 1].wstring();
+			commandLine += i == 0 ? L"\"" : L" \"";
+			size_t backslashes = 0;
+			for (auto c : arg)
+			{
+				if (c == L'\\')
+				{
+					++backslashes;
+					continue;
+				}
+				commandLine.append(c == L'"' ? 2 * backslashes + 1 : backslashes, L'\\');
+				commandLine += c;
+				backslashes = 0;
+			}
+			commandLine.append(2 * backslashes, L'\\');
+			commandLine += L'"';
+		}
+		STARTUPINFOW startupInfo = {};
+		startupInfo.cb = sizeof(startupInfo);
+		PROCESS_INFORMATION processInfo = {};
+		if (!CreateProcessW(nullptr, commandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr,
+			&startupInfo, &processInfo))
+		{
+			return -1;
+		}
+		WaitForSingleObject(processInfo.hProcess, INFINITE);
+		DWORD exitCode = 0;
+		auto gotExitCode = GetExitCodeProcess(processInfo.hProcess, &exitCode);
+		CloseHandle(processInfo.hThread);
+		CloseHandle(processInfo.hProcess);
+		return gotExitCode ? static_cast<int>(exitCode) : -1;
+#else
+		std::vector<std::string> strings = { program.string() };
+		for (auto& arg : args)
+		{
+			strings.push_back(arg.string());
+		}
+		std::vector<char*> argv;
+		for (auto& s : strings)
+		{
+			argv.push_back(s.data());
+		}
+		argv.push_back(nullptr);
+		pid_t pid = 0;
+		if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0)
+		{
+			return -1;
+		}
+		int status = 0;
+		while (waitpid(pid, &status, 0) < 0)
+		{
+			if (errno != EINTR)
+			{
+				return -1;
+			}
+		}
+		return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+	}
+
+	// GLSL from the watched directory to SPIR-V. Uses shaderc when it is linked in,
+	// glslangValidator from the PATH otherwise. Output goes to the per-user cache
+	// directory, as the executable's may be read-only.
+	ShaderBlob compileWatchedShader(const std::string& name)
+	{
+#if defined(TRIANGLE_RUNTIME_SHADERS)
+		ShaderCompiler compiler(m_ShaderWatcher->directory(), getCacheDirectory() / "ShaderCache");
+		return compiler.compile(name);
+#else
+		auto outputDir = getCacheDirectory() / "ShaderReload";
+		std::filesystem::create_directories(outputDir);
+		auto output = outputDir / (name + ".spv");
+		if (runProcess("glslangValidator", { "-V", "-o", output, m_ShaderWatcher->directory() / name }) != 0)
+		{
+			throw std::runtime_error("Can't compile " + name + " with glslangValidator.");
+		}
+		return ShaderBlob::map(output);
+#endif
+	}
+
+	// Swaps in the result of m_ShaderReload. The replaced pipelines and modules
+	// are retired until the frames recorded with them have finished. A failed
+	// reload is reported and the current shaders are kept.
+	void applyShaderReload()
+	{
+		ShaderReload reload;
+		try
+		{
+			reload = m_ShaderReload.get();
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "Shader reload failed: " << e.what() << std::endl;
+			return;
+		}
+		if (!reload.changed)
+		{
+			return;
+		}
+
+		// Frames before m_FrameNumber may still use the old pipelines and modules.
+		std::pair<UniqueShaderModule*, UniqueShaderModule*> modules[] = {
+			{ &m_Shaders.vertex, &reload.newModules.vertex },
+			{ &m_Shaders.instancedVertex, &reload.newModules.instancedVertex },
+			{ &m_Shaders.fragment, &reload.newModules.fragment }
+		};
+		for (auto& module : modules)
+		{
+			if (*module.second)
+			{
+				m_DeletionQueue.push(m_FrameNumber, std::move(*module.first));
+				*module.first = std::move(*module.second);
+			}
+		}
+		if (reload.pipeline != m_Pipeline)
+		{
+			m_DeletionQueue.push(m_FrameNumber, UniquePipeline(m_Device, m_PipelineLibrary->evict(m_PipelineKey)));
+			m_Pipeline = reload.pipeline;
+			m_PipelineKey = reload.pipelineKey;
+		}
+		if (reload.instancedPipeline != m_InstancedPipeline)
+		{
+			m_DeletionQueue.push(m_FrameNumber, UniquePipeline(m_Device, m_PipelineLibrary->evict(m_InstancedPipelineKey)));
+			m_InstancedPipeline = reload.instancedPipeline;
+			m_InstancedPipelineKey = reload.instancedPipelineKey;
+		}
+		m_Shaders.vertexHash = reload.shaders.vertexHash;
+		m_Shaders.instancedVertexHash = reload.shaders.instancedVertexHash;
+		m_Shaders.fragmentHash = reload.shaders.fragmentHash;
+		// Variants built from the old shaders are retired like the pipelines above;
+		// draws use m_Pipeline until their replacements are ready. Variants the
+		// changed shaders don't affect keep their keys and stay in the library.
+		if (!m_PipelineVariants.empty())
+		{
+			auto oldKeys = std::move(m_PipelineVariantKeys);
+			compilePipelineVariants(&oldKeys);
+		}
+		++m_ShaderReloadCount;
+		std::cout << "Reloaded shaders in " << reload.milliseconds << " ms." << std::endl;
+	}
+
+	// Every topology / cull mode / blend mode combination, truncated to count.
+	// No point lists: shader.vert doesn't write gl_PointSize, which they need.
+	std::vector<PipelineDesc> makePipelineVariants(uint32_t count)
+	{
+		const BlendMode blendModes[] = { BlendMode::Opaque, BlendMode::Alpha, BlendMode::Additive };
+		const VkCullModeFlags cullModes[] = { VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_NONE, VK_CULL_MODE_FRONT_BIT };
+		const VkPrimitiveTopology topologies[] = {
+			VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+			VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+			VK_PRIMITIVE_TOPOLOGY_LINE_LIST
+		};
+		std::vector<PipelineDesc> descs;
+		for (auto topology : topologies)
+		{
+			for (auto cullMode : cullModes)
+			{
+				for (auto blendMode : blendModes)
+				{
+					if (descs.size() == count)
+					{
+						return descs;
+					}
+					PipelineDesc desc;
+					desc.topology = topology;
+					desc.cullMode = cullMode;
+					desc.blendMode = blendMode;
+					descs.push_back(desc);
+				}
+			}
+		}
+		return descs;
+	}
+
+	void createCommandPool()
+	{
+		TRACE_SCOPE("createCommandPool");
+		auto& indices = m_DeviceInfo->queueFamilyIndices;
+
+		VkCommandPoolCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		createInfo.queueFamilyIndex = indices.m_GraphicsFamily.value();
+		// Command buffers are re-recorded every frame.
+		createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		createInfo.pNext = nullptr;
+
+		if (vkCreateCommandPool(m_Device, &createInfo, nullptr, m_CommandPool.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create command pool.");
+		}
+
+		// Async submissions are short-lived one-shot command buffers.
+		createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		createInfo.queueFamilyIndex = indices.m_TransferFamily.value();
+		if (vkCreateCommandPool(m_Device, &createInfo, nullptr, m_TransferCommandPool.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create transfer command pool.");
+		}
+		createInfo.queueFamilyIndex = indices.m_ComputeFamily.value();
+		if (vkCreateCommandPool(m_Device, &createInfo, nullptr, m_ComputeCommandPool.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create compute command pool.");
+		}
+	}
+
+	void createFrameContexts()
+	{
+		TRACE_SCOPE("createFrameContexts");
+		m_Frames.resize(m_Options.maxFramesInFlight);
+		m_ImagesInFlight.assign(m_SwapChainImages.size(), VK_NULL_HANDLE);
+
+		std::vector<VkCommandBuffer> commandBuffers(m_Frames.size());
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = m_CommandPool.get();
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+		allocInfo.pNext = nullptr;
+		if (vkAllocateCommandBuffers(m_Device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't allocate command buffers.");
+		}
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = nullptr;
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		// Signalled so the first wait on each slot returns immediately.
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		fenceInfo.pNext = nullptr;
+
+		for (size_t i = 0; i < m_Frames.size(); ++i)
+		{
+			auto& frame = m_Frames[i];
+			frame.commandBuffer = commandBuffers[i];
+			if (vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, frame.imageAvailable.replace(m_Device)) != VK_SUCCESS ||
+				vkCreateFence(m_Device, &fenceInfo, nullptr, frame.inFlight.replace(m_Device)) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Can't create frame synchronization objects.");
+			}
+		}
+		std::cout << "Created " << m_Frames.size() << " frames in flight." << std::endl;
+	}
+
+	VkQueue getQueue(QueueType type)
+	{
+		switch (type)
+		{
+		case QueueType::Transfer: return m_TransferQueue;
+		case QueueType::Compute: return m_ComputeQueue;
+		default: return m_GraphicsQueue;
+		}
+	}
+
+	uint32_t getQueueFamily(QueueType type)
+	{
+		auto& indices = m_DeviceInfo->queueFamilyIndices;
+		switch (type)
+		{
+		case QueueType::Transfer: return indices.m_TransferFamily.value();
+		case QueueType::Compute: return indices.m_ComputeFamily.value();
+		default: return indices.m_GraphicsFamily.value();
+		}
+	}
+
+	// Records work with record() and submits it on the transfer or compute queue.
+	// With a non-zero graphicsWaitStage the next frame's graphics submit waits on
+	// it at that stage. Returns a serial for isAsyncWorkComplete.
+	uint64_t submitAsync(QueueType type, const std::function<void(VkCommandBuffer)>& record,
+		VkPipelineStageFlags graphicsWaitStage = 0)
+	{
+		if (type == QueueType::Graphics)
+		{
+			throw std::runtime_error("submitAsync: Graphics work goes through drawFrame.");
+		}
+		AsyncSubmission submission;
+		submission.pool = type == QueueType::Transfer ? m_TransferCommandPool.get() : m_ComputeCommandPool.get();
+		submission.serial = ++m_AsyncSubmittedSerial;
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = submission.pool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		allocInfo.pNext = nullptr;
+		if (vkAllocateCommandBuffers(m_Device, &allocInfo, &submission.commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't allocate async command buffer.");
+		}
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pNext = nullptr;
+		vkBeginCommandBuffer(submission.commandBuffer, &beginInfo);
+		record(submission.commandBuffer);
+		if (vkEndCommandBuffer(submission.commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't record async command buffer.");
+		}
+
+		submission.fence = acquireFence();
+		VkSemaphore signalSemaphore = VK_NULL_HANDLE;
+		if (graphicsWaitStage != 0)
+		{
+			signalSemaphore = acquireSemaphore();
+			m_GraphicsWaitSemaphores.push_back(signalSemaphore);
+			m_GraphicsWaitStages.push_back(graphicsWaitStage);
+		}
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &submission.commandBuffer;
+		submitInfo.signalSemaphoreCount = signalSemaphore != VK_NULL_HANDLE ? 1 : 0;
+		submitInfo.pSignalSemaphores = &signalSemaphore;
+		submitInfo.pNext = nullptr;
+		if (vkQueueSubmit(getQueue(type), 1, &submitInfo, submission.fence.get()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't submit async work.");
+		}
+		m_AsyncSubmissions.push_back(std::move(submission));
+		return submission.serial;
+	}
+
+	bool isAsyncWorkComplete(uint64_t serial)
+	{
+		return serial <= m_AsyncCompletedSerial;
+	}
+
+	// Recycles the command buffers and fences of finished async submissions.
+	// Submissions on different queues may finish out of order; the completed
+	// serial only advances past ones that are all done.
+	void retireAsyncSubmissions(bool waitAll)
+	{
+		for (auto& submission : m_AsyncSubmissions)
+		{
+			if (!submission.fence)
+			{
+				continue;
+			}
+			auto fence = submission.fence.get();
+			if (waitAll)
+			{
+				vkWaitForFences(m_Device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+			}
+			else if (vkGetFenceStatus(m_Device, fence) != VK_SUCCESS)
+			{
+				continue;
+			}
+			vkFreeCommandBuffers(m_Device, submission.pool, 1, &submission.commandBuffer);
+			vkResetFences(m_Device, 1, &fence);
+			m_FreeFences.push_back(std::move(submission.fence));
+		}
+		while (!m_AsyncSubmissions.empty() && !m_AsyncSubmissions.front().fence)
+		{
+			m_AsyncCompletedSerial = m_AsyncSubmissions.front().serial;
+			m_AsyncSubmissions.pop_front();
+		}
+		if (m_StagingRing)
+		{
+			m_StagingRing->reclaim(m_AsyncCompletedSerial);
+		}
+	}
+
+	// Where the acquire half of a transfer to this queue waits to be recorded.
+	// Graphics picks it up at the start of the next frame, compute in the next
+	// cull submit on the current frame slot.
+	PendingAcquires& getPendingAcquires(QueueType to)
+	{
+		return to == QueueType::Compute ? m_ComputeAcquires[m_CurrentFrame] : m_GraphicsAcquires;
+	}
+
+	// Hands [offset, offset + size) of a buffer written on one queue family to
+	// another. The release half is recorded into commandBuffer (on the source
+	// queue); the matching acquire waits in getPendingAcquires(to). The caller
+	// makes the release happen before the acquire, with a semaphore or a fence
+	// wait. Same-family handoffs need neither barrier: that wait already orders
+	// and makes the writes visible.
+	void releaseBuffer(VkCommandBuffer commandBuffer, QueueType from, QueueType to, VkBuffer buffer,
+		VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess,
+		VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE)
+	{
+		auto srcFamily = getQueueFamily(from);
+		auto dstFamily = getQueueFamily(to);
+		if (srcFamily == dstFamily)
+		{
+			return;
+		}
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = srcFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+		barrier.buffer = buffer;
+		barrier.offset = offset;
+		barrier.size = size;
+		barrier.pNext = nullptr;
+		vkCmdPipelineBarrier(commandBuffer, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, 1, &barrier, 0, nullptr);
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = dstAccess;
+		auto& acquires = getPendingAcquires(to);
+		acquires.buffers.push_back(barrier);
+		acquires.stages |= dstStage;
+	}
+
+	// Image counterpart of releaseBuffer for graphics reads, which also moves the image
+	// from oldLayout to newLayout. Same-family handoffs only need the transition.
+	void releaseImageToGraphics(VkCommandBuffer commandBuffer, QueueType from, VkImage image,
+		VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkImageLayout oldLayout, VkImageLayout newLayout,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+	{
+		auto srcFamily = getQueueFamily(from);
+		auto dstFamily = getQueueFamily(QueueType::Graphics);
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = 0;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = srcFamily == dstFamily ? VK_QUEUE_FAMILY_IGNORED : srcFamily;
+		barrier.dstQueueFamilyIndex = srcFamily == dstFamily ? VK_QUEUE_FAMILY_IGNORED : dstFamily;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.pNext = nullptr;
+		vkCmdPipelineBarrier(commandBuffer, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+		if (srcFamily == dstFamily)
+		{
+			return;
+		}
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = dstAccess;
+		m_GraphicsAcquires.images.push_back(barrier);
+		m_GraphicsAcquires.stages |= dstStage;
+	}
+
+	// Records the acquire half of every ownership transfer in acquires.
+	void recordPendingAcquires(VkCommandBuffer commandBuffer, PendingAcquires& acquires)
+	{
+		if (acquires.buffers.empty() && acquires.images.empty())
+		{
+			return;
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, acquires.stages, 0,
+			0, nullptr, static_cast<uint32_t>(acquires.buffers.size()), acquires.buffers.data(),
+			static_cast<uint32_t>(acquires.images.size()), acquires.images.data());
+		acquires = PendingAcquires();
+	}
+
+	UniqueFence acquireFence()
+	{
+		if (!m_FreeFences.empty())
+		{
+			auto fence = std::move(m_FreeFences.back());
+			m_FreeFences.pop_back();
+			return fence;
+		}
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.pNext = nullptr;
+		UniqueFence fence;
+		if (vkCreateFence(m_Device, &fenceInfo, nullptr, fence.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create fence.");
+		}
+		return fence;
+	}
+
+	VkSemaphore acquireSemaphore()
+	{
+		if (!m_FreeSemaphores.empty())
+		{
+			auto semaphore = m_FreeSemaphores.back();
+			m_FreeSemaphores.pop_back();
+			return semaphore;
+		}
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = nullptr;
+		UniqueSemaphore semaphore;
+		if (vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, semaphore.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create semaphore.");
+		}
+		m_AsyncSemaphores.push_back(std::move(semaphore));
+		return m_AsyncSemaphores.back().get();
+	}
+
+	void createStagingRing()
+	{
+		TRACE_SCOPE("createStagingRing");
+		VkDeviceSize streamSize = static_cast<VkDeviceSize>(m_Options.uploadKiB) * 1024;
+		// Room for every frame in flight plus the one being recorded, so streaming never waits.
+		auto ringSize = std::max(StagingRingSize, streamSize * (m_Options.maxFramesInFlight + 1));
+		m_StagingBuffer = createBuffer(ringSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, m_StagingMemory);
+		m_StagingRing = std::make_unique<StagingRing>(m_StagingMemory.mapped, ringSize);
+
+		if (streamSize > 0)
+		{
+			m_StreamBuffer = createBuffer(streamSize * m_Options.maxFramesInFlight,
+				VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, m_StreamMemory);
+			m_StreamSource.resize(streamSize);
+			for (size_t i = 0; i < m_StreamSource.size(); ++i)
+			{
+				m_StreamSource[i] = static_cast<uint8_t>(i);
+			}
+		}
+	}
+
+	void createGeometryBuffers()
+	{
+		TRACE_SCOPE("createGeometryBuffers");
+		const std::vector<Vertex> vertices = {
+			{ { 0.0f, -0.5f } },
+			{ { 0.5f, 0.5f } },
+			{ { -0.5f, 0.5f } }
+		};
+		const std::vector<uint16_t> indices = { 0, 1, 2 };
+
+		VkDeviceSize vertexSize = sizeof(vertices[0]) * vertices.size();
+		m_VertexBuffer = createBuffer(vertexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, m_VertexMemory);
+		uploadToBuffer(m_VertexBuffer.get(), 0, vertices.data(), vertexSize);
+
+		VkDeviceSize indexSize = sizeof(indices[0]) * indices.size();
+		m_IndexBuffer = createBuffer(indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, m_IndexMemory);
+		uploadToBuffer(m_IndexBuffer.get(), 0, indices.data(), indexSize);
+		m_IndexCount = static_cast<uint32_t>(indices.size());
+	}
+
+	// A checker texture and a colour palette in the bindless set. Draws select
+	// them, and a palette entry, through DrawConstants.
+	void createMaterials()
+	{
+		TRACE_SCOPE("createMaterials");
+		std::vector<uint32_t> texels(CheckerTextureSize * CheckerTextureSize);
+		for (uint32_t y = 0; y < CheckerTextureSize; ++y)
+		{
+			for (uint32_t x = 0; x < CheckerTextureSize; ++x)
+			{
+				// RGBA8 read as a little-endian word: alpha is the top byte.
+				texels[y * CheckerTextureSize + x] = (x / 8 + y / 8) % 2 == 0 ? 0xffffffff : 0xff808080;
+			}
+		}
+
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+		imageInfo.extent = { CheckerTextureSize, CheckerTextureSize, 1 };
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.pNext = nullptr;
+		if (vkCreateImage(m_Device, &imageInfo, nullptr, m_CheckerImage.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Trouble creating checker texture.");
+		}
+		m_CheckerMemory = allocateImageMemory(m_CheckerImage.get(), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		uploadToImage(m_CheckerImage.get(), { CheckerTextureSize, CheckerTextureSize }, texels.data(),
+			sizeof(texels[0]) * texels.size());
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = m_CheckerImage.get();
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = imageInfo.format;
+		viewInfo.components = {
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY };
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		viewInfo.pNext = nullptr;
+		if (vkCreateImageView(m_Device, &viewInfo, nullptr, m_CheckerImageView.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Trouble creating checker texture view.");
+		}
+
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_NEAREST;
+		samplerInfo.minFilter = VK_FILTER_NEAREST;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.maxLod = 0.0f;
+		samplerInfo.pNext = nullptr;
+		if (vkCreateSampler(m_Device, &samplerInfo, nullptr, m_Sampler.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Trouble creating sampler.");
+		}
+		m_CheckerTextureIndex = m_Bindless->addTexture(m_CheckerImageView.get(), m_Sampler.get());
+
+		const float palette[][4] = {
+			{ 1.0f, 0.0f, 0.0f, 1.0f },
+			{ 0.0f, 1.0f, 0.0f, 1.0f },
+			{ 0.0f, 0.0f, 1.0f, 1.0f },
+			{ 1.0f, 1.0f, 0.0f, 1.0f },
+			{ 0.0f, 1.0f, 1.0f, 1.0f },
+			{ 1.0f, 0.0f, 1.0f, 1.0f },
+			{ 1.0f, 0.5f, 0.0f, 1.0f },
+			{ 1.0f, 1.0f, 1.0f, 1.0f }
+		};
+		static_assert(sizeof(palette) / sizeof(palette[0]) == 8, "PaletteSize must match the palette.");
+		m_PaletteBuffer = createBuffer(sizeof(palette), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, m_PaletteMemory);
+		uploadToBuffer(m_PaletteBuffer.get(), 0, palette, sizeof(palette),
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		m_PaletteIndex = m_Bindless->addStorageBuffer(m_PaletteBuffer.get());
+	}
+
+	// Copies data into the staging ring and queues a copy to dst for the next
+	// flushUploads(). Only blocks if the whole ring is still in flight.
+	// dstQueue, dstStage and dstAccess describe the first read of dst.
+	void uploadToBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size,
+		VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		VkAccessFlags dstAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT,
+		QueueType dstQueue = QueueType::Graphics)
+	{
+		if (size > m_StagingRing->capacity())
+		{
+			throw std::runtime_error("Upload of " + std::to_string(size) + " bytes is larger than the staging ring.");
+		}
+		VkDeviceSize offset = 0;
+		while (!m_StagingRing->allocate(size, StagingAlignment, offset))
+		{
+			++m_StagingStalls;
+			flushUploads();
+			retireAsyncSubmissions(true);
+		}
+		memcpy(m_StagingRing->data(offset), data, static_cast<size_t>(size));
+
+		PendingUpload upload;
+		upload.buffer = dst;
+		upload.region.srcOffset = offset;
+		upload.region.dstOffset = dstOffset;
+		upload.region.size = size;
+		upload.dstQueue = dstQueue;
+		upload.dstStage = dstStage;
+		upload.dstAccess = dstAccess;
+		m_PendingUploads.push_back(upload);
+	}
+
+	// Like uploadToBuffer, for the whole of mip 0 of a 2D color image created
+	// with TRANSFER_DST usage. The image ends up SHADER_READ_ONLY_OPTIMAL.
+	void uploadToImage(VkImage dst, VkExtent2D extent, const void* data, VkDeviceSize size,
+		VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+	{
+		if (size > m_StagingRing->capacity())
+		{
+			throw std::runtime_error("Upload of " + std::to_string(size) + " bytes is larger than the staging ring.");
+		}
+		VkDeviceSize offset = 0;
+		while (!m_StagingRing->allocate(size, StagingAlignment, offset))
+		{
+			++m_StagingStalls;
+			flushUploads();
+			retireAsyncSubmissions(true);
+		}
+		memcpy(m_StagingRing->data(offset), data, static_cast<size_t>(size));
+
+		PendingImageUpload upload;
+		upload.image = dst;
+		upload.region.bufferOffset = offset;
+		upload.region.bufferRowLength = 0;
+		upload.region.bufferImageHeight = 0;
+		upload.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		upload.region.imageSubresource.mipLevel = 0;
+		upload.region.imageSubresource.baseArrayLayer = 0;
+		upload.region.imageSubresource.layerCount = 1;
+		upload.region.imageOffset = { 0, 0, 0 };
+		upload.region.imageExtent = { extent.width, extent.height, 1 };
+		upload.dstStage = dstStage;
+		m_PendingImageUploads.push_back(upload);
+	}
+
+	// Submits every queued upload as one transfer-queue batch, which the next
+	// graphics submit waits on at the earliest stage reading any of them. The
+	// compute queue waits on no semaphores, so uploads it reads first are waited
+	// for here; only the instance buffer at startup is one.
+	void flushUploads()
+	{
+		if (m_PendingUploads.empty() && m_PendingImageUploads.empty())
+		{
+			return;
+		}
+		std::stable_sort(m_PendingUploads.begin(), m_PendingUploads.end(),
+			[](const PendingUpload& a, const PendingUpload& b) { return a.buffer < b.buffer; });
+		VkPipelineStageFlags waitStages = 0;
+		bool computeReads = false;
+		for (auto& upload : m_PendingUploads)
+		{
+			if (upload.dstQueue == QueueType::Compute)
+			{
+				computeReads = true;
+			}
+			else
+			{
+				waitStages |= upload.dstStage;
+			}
+		}
+		for (auto& upload : m_PendingImageUploads)
+		{
+			waitStages |= upload.dstStage;
+		}
+		auto serial = submitAsync(QueueType::Transfer, [this](VkCommandBuffer commandBuffer)
+		{
+			std::vector<VkBufferCopy> regions;
+			for (size_t i = 0; i < m_PendingUploads.size(); ++i)
+			{
+				auto& upload = m_PendingUploads[i];
+				regions.push_back(upload.region);
+				if (i + 1 < m_PendingUploads.size() && m_PendingUploads[i + 1].buffer == upload.buffer)
+				{
+					continue;
+				}
+				vkCmdCopyBuffer(commandBuffer, m_StagingBuffer.get(), upload.buffer, static_cast<uint32_t>(regions.size()), regions.data());
+				releaseBuffer(commandBuffer, QueueType::Transfer, upload.dstQueue, upload.buffer,
+					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, upload.dstStage, upload.dstAccess);
+				regions.clear();
+			}
+			for (auto& upload : m_PendingImageUploads)
+			{
+				// The whole image is overwritten, so its old contents can be discarded.
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.image = upload.image;
+				barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				barrier.subresourceRange.baseMipLevel = 0;
+				barrier.subresourceRange.levelCount = 1;
+				barrier.subresourceRange.baseArrayLayer = 0;
+				barrier.subresourceRange.layerCount = 1;
+				barrier.pNext = nullptr;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+					0, nullptr, 0, nullptr, 1, &barrier);
+				vkCmdCopyBufferToImage(commandBuffer, m_StagingBuffer.get(), upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					1, &upload.region);
+				releaseImageToGraphics(commandBuffer, QueueType::Transfer, upload.image,
+					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					upload.dstStage, VK_ACCESS_SHADER_READ_BIT);
+			}
+		}, waitStages);
+		m_StagingRing->submit(serial);
+		m_PendingUploads.clear();
+		m_PendingImageUploads.clear();
+		if (computeReads)
+		{
+			retireAsyncSubmissions(true);
+		}
+	}
+
+	void createInstancePipelines()
+	{
+		TRACE_SCOPE("createInstancePipelines");
+		auto instancedVertShader = loadShader("instanced.vert");
+		m_Shaders.instancedVertex = UniqueShaderModule(m_Device, createShaderModule(instancedVertShader));
+		m_Shaders.instancedVertexHash = instancedVertShader.hash();
+		PipelineDesc desc;
+		desc.instanced = true;
+		m_InstancedPipelineKey = makePipelineKey(desc, m_Shaders.handles());
+		m_InstancedPipeline = getPipeline(desc);
+
+		std::vector<VkDescriptorSetLayoutBinding> bindings(3);
+		for (uint32_t i = 0; i < bindings.size(); ++i)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			bindings[i].pImmutableSamplers = nullptr;
+		}
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+		layoutInfo.pNext = nullptr;
+		if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, m_CullSetLayout.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Error creating cull descriptor set layout.");
+		}
+
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(CullParams);
+		auto cullSetLayout = m_CullSetLayout.get();
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &cullSetLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		pipelineLayoutInfo.pNext = nullptr;
+		if (vkCreatePipelineLayout(m_Device, &pipelineLayoutInfo, nullptr, m_CullPipelineLayout.replace(m_Device)) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Error creating cull pipeline layout.");
+		}
+
+		UniqueShaderModule cullShader(m_Device, createShaderModule(loadShader("cull.comp")));
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = cullShader.get();
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.stage.pNext = nullptr;
+		pipelineInfo.layout = m_CullPipelineLayout.get();
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		pipelineInfo.basePipelineIndex = -1;
+		pipelineInfo.pNext = nullptr;
+		auto result = traceCall("vkCreateComputePipelines", [&] { return vkCreateComputePipelines(m_Device, m_PipelineCache.get(), 1, &pipelineInfo, nullptr, m_CullPipeline.replace(m_Device)); });
+		cullShader.reset();
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't create cull pipeline.");
+		}
+	}
+
+	void createInstanceBuffers()
+	{
+		TRACE_SCOPE("createInstanceBuffers");
+		auto instanceCount = m_Options.instanceCount;
+		VkDeviceSize instanceSize = sizeof(InstanceData) * instanceCount;
+		m_InstanceBuffer = createBuffer(instanceSize,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, m_InstanceMemory);
+		m_VisibleInstanceBuffer = createBuffer(getVisibleSlotSize() * m_Options.maxFramesInFlight,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, m_VisibleInstanceMemory);
+		m_IndirectBuffer = createBuffer(getIndirectSlotSize() * m_Options.maxFramesInFlight,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, m_IndirectMemory);
+
+		// Random placement with a fixed seed, so runs are comparable. Denser scenes get smaller instances.
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> position(-InstanceFieldExtent, InstanceFieldExtent);
+		auto baseScale = std::min(0.25f, 2.0f / std::sqrt(static_cast<float>(instanceCount)));
+		std::uniform_real_distribution<float> scale(0.5f * baseScale, baseScale);
+
+		if (m_Options.cpuDraws)
+		{
+			m_InstanceStore.reserve(instanceCount);
+		}
+		// Uploaded in chunks so any instance count fits through the staging ring.
+		auto chunkCount = static_cast<uint32_t>(m_StagingRing->capacity() / 2 / sizeof(InstanceData));
+		std::vector<InstanceData> chunk;
+		for (uint32_t first = 0; first < instanceCount; first += chunkCount)
+		{
+			chunk.resize(std::min(chunkCount, instanceCount - first));
+			for (auto& instance : chunk)
+			{
+				instance.position[0] = position(rng);
+				instance.position[1] = position(rng);
+				instance.scale = scale(rng);
+				instance.padding = 0.0f;
+			}
+			uploadToBuffer(m_InstanceBuffer.get(), sizeof(InstanceData) * first, chunk.data(), sizeof(InstanceData) * chunk.size(),
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+				m_AsyncCompute ? QueueType::Compute : QueueType::Graphics);
+			if (m_Options.cpuDraws)
+			{
+				for (auto& instance : chunk)
+				{
+					glm::vec3 position(instance.position[0], instance.position[1], 0.0f);
+					auto transform = glm::translate(glm::mat4(1.0f), position);
+					transform = glm::scale(transform, glm::vec3(instance.scale, instance.scale, 1.0f));
+					m_InstanceStore.add(position, MeshBoundingRadius * instance.scale, transform);
+				}
+			}
+		}
+		if (m_Options.cpuDraws && !m_Options.cpuCull)
+		{
+			m_VisibleIndices.resize(instanceCount);
+			for (uint32_t i = 0; i < instanceCount; ++i)
+			{
+				m_VisibleIndices[i] = i;
+			}
+		}
+		std::cout << "Created " << instanceCount << " instances." << std::endl;
+	}
+
+	// Per-frame-slot regions of the visible list and draw command buffers are
+	// bound as storage buffers, so their offsets must be aligned.
+	VkDeviceSize alignStorageOffset(VkDeviceSize size)
+	{
+		auto alignment = m_DeviceInfo->properties.limits.minStorageBufferOffsetAlignment;
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	VkDeviceSize getVisibleSlotSize()
+	{
+		return alignStorageOffset(sizeof(InstanceData) * m_Options.instanceCount);
+	}
+
+	VkDeviceSize getIndirectSlotSize()
+	{
+		return alignStorageOffset(sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+	// Points a set from the frame descriptor allocator at this slot's visible
+	// list and draw command.
+	void writeCullDescriptorSet(VkDescriptorSet set)
+	{
+		VkDescriptorBufferInfo bufferInfos[3] = {
+			{ m_InstanceBuffer.get(), 0, VK_WHOLE_SIZE },
+			{ m_VisibleInstanceBuffer.get(), getVisibleSlotSize() * m_CurrentFrame, sizeof(InstanceData) * m_Options.instanceCount },
+			{ m_IndirectBuffer.get(), getIndirectSlotSize() * m_CurrentFrame, sizeof(VkDrawIndexedIndirectCommand) }
+		};
+		std::vector<VkWriteDescriptorSet> writes(3);
+		for (uint32_t b = 0; b < writes.size(); ++b)
+		{
+			writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[b].dstSet = set;
+			writes[b].dstBinding = b;
+			writes[b].dstArrayElement = 0;
+			writes[b].descriptorCount = 1;
+			writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[b].pBufferInfo = &bufferInfos[b];
+			writes[b].pNext = nullptr;
+		}
+		vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	}
+
+	// Zeroes the instance count of this slot's draw command before culling.
+	void resetDrawCommand(VkCommandBuffer commandBuffer)
+	{
+		VkDrawIndexedIndirectCommand drawCommand = {};
+		drawCommand.indexCount = m_IndexCount;
+		drawCommand.instanceCount = 0;
+		drawCommand.firstIndex = 0;
+		drawCommand.vertexOffset = 0;
+		drawCommand.firstInstance = 0;
+		vkCmdUpdateBuffer(commandBuffer, m_IndirectBuffer.get(), getIndirectSlotSize() * m_CurrentFrame,
+			sizeof(drawCommand), &drawCommand);
+	}
+
+	// Culls every instance into this slot's visible list and counts them into
+	// its draw command. The CPU cost is the same few commands whatever the
+	// instance count. Barriers on either side come from the render graph, or
+	// from submitCulling.
+	void recordCulling(VkCommandBuffer commandBuffer)
+	{
+		CullParams params = {};
+		auto camera = getCameraOffset();
+		params.camera[0] = camera.x;
+		params.camera[1] = camera.y;
+		auto viewExtent = getViewExtent();
+		params.viewExtent[0] = viewExtent.x;
+		params.viewExtent[1] = viewExtent.y;
+		params.boundingRadius = MeshBoundingRadius;
+		params.instanceCount = m_Options.instanceCount;
+		auto cullSet = m_FrameDescriptors->allocate(m_CullSetLayout.get());
+		writeCullDescriptorSet(cullSet);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_CullPipeline.get());
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_CullPipelineLayout.get(), 0,
+			1, &cullSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, m_CullPipelineLayout.get(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+		vkCmdDispatch(commandBuffer, (m_Options.instanceCount + CullWorkgroupSize - 1) / CullWorkgroupSize, 1, 1);
+	}
+
+	// Resets and culls this slot on the compute queue, then hands the results to
+	// the graphics queue, whose next submit waits for them where the draw reads
+	// them. Overlaps the culling with the tail of the previous frame.
+	void submitCulling()
+	{
+		submitAsync(QueueType::Compute, [this](VkCommandBuffer commandBuffer)
+		{
+			recordPendingAcquires(commandBuffer, m_ComputeAcquires[m_CurrentFrame]);
+			resetDrawCommand(commandBuffer);
+			VkDeviceSize indirectOffset = getIndirectSlotSize() * m_CurrentFrame;
+			VkBufferMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = m_IndirectBuffer.get();
+			barrier.offset = indirectOffset;
+			barrier.size = getIndirectSlotSize();
+			barrier.pNext = nullptr;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+				0, nullptr, 1, &barrier, 0, nullptr);
+			recordCulling(commandBuffer);
+			releaseBuffer(commandBuffer, QueueType::Compute, QueueType::Graphics, m_VisibleInstanceBuffer.get(),
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+				getVisibleSlotSize() * m_CurrentFrame, getVisibleSlotSize());
+			releaseBuffer(commandBuffer, QueueType::Compute, QueueType::Graphics, m_IndirectBuffer.get(),
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+				indirectOffset, getIndirectSlotSize());
+		}, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+	}
+
+	void setViewportAndScissor(VkCommandBuffer commandBuffer)
+	{
+		VkViewport viewport = {};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = static_cast<float>(m_SwapChainExtent.width);
+		viewport.height = static_cast<float>(m_SwapChainExtent.height);
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor = {};
+		scissor.offset = { 0, 0 };
+		scissor.extent = m_SwapChainExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	}
+
+	// Half-size of the view in world units: the shorter axis spans [-1, 1] and
+	// the longer one keeps pixels square.
+	glm::vec2 getViewExtent()
+	{
+		auto width = static_cast<float>(m_SwapChainExtent.width);
+		auto height = static_cast<float>(m_SwapChainExtent.height);
+		return glm::vec2(std::max(1.0f, width / height), std::max(1.0f, height / width));
+	}
+
+	// Slowly pans the camera so the visible set changes from frame to frame. The
+	// GPU-driven and CPU paths both draw and cull from this position.
+	glm::vec2 getCameraOffset()
+	{
+		return glm::vec2(0.5f * std::sin(m_FrameNumber * 0.010f), 0.5f * std::cos(m_FrameNumber * 0.013f));
+	}
+
+	// Aspect correction only. On the GPU-driven path cull.comp makes instance
+	// positions relative to the camera; the CPU paths apply getView instead.
+	glm::mat4 getViewProjection()
+	{
+		auto viewExtent = getViewExtent();
+		return glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / viewExtent.x, 1.0f / viewExtent.y, 1.0f));
+	}
+
+	// Moves world positions relative to the camera, as cull.comp does.
+	glm::mat4 getView()
+	{
+		return glm::translate(glm::mat4(1.0f), glm::vec3(-getCameraOffset(), 0.0f));
+	}
+
+	// Binds set 1 with this frame's FrameUniforms and a draw's ObjectUniforms.
+	void bindUniforms(VkCommandBuffer commandBuffer, uint32_t objectOffset)
+	{
+		uint32_t dynamicOffsets[] = { m_FrameUniformOffset, objectOffset };
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout.get(), 1,
+			1, &m_UniformSet, 2, dynamicOffsets);
+	}
+
+	// Binds the bindless set; each draw then only pushes its DrawConstants.
+	void bindMaterials(VkCommandBuffer commandBuffer)
+	{
+		auto set = m_Bindless->getSet();
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout.get(), 0,
+			1, &set, 0, nullptr);
+	}
+
+	void pushDrawConstants(VkCommandBuffer commandBuffer, uint32_t colorIndex)
+	{
+		DrawConstants constants = {};
+		constants.textureIndex = m_CheckerTextureIndex;
+		constants.paletteIndex = m_PaletteIndex;
+		constants.colorIndex = colorIndex % PaletteSize;
+		vkCmdPushConstants(commandBuffer, m_PipelineLayout.get(), VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+	}
+
+	// One direct draw per visible instance, split across the worker pool. Each
+	// draw writes its transform into the uniform ring and rebinds set 1 at that
+	// offset. The draws are split into equal ranges, one per drawable pipeline variant.
+	// Culling and transforms use the same panning camera as the GPU-driven path.
+	std::vector<VkCommandBuffer> recordInstanceDraws()
+	{
+		VkCommandBufferInheritanceInfo inheritance = {};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.renderPass = m_RenderGraph->getRenderPass(m_MainPass);
+		inheritance.subpass = m_RenderGraph->getSubpass(m_MainPass);
+		inheritance.framebuffer = m_RenderGraph->getFramebuffer(m_MainPass);
+		inheritance.pNext = nullptr;
+		if (m_Options.cpuCull)
+		{
+			auto start = std::chrono::steady_clock::now();
+			FrustumCuller::cullParallel(m_InstanceStore, Frustum::fromViewProjection(getViewProjection() * getView()),
+				*m_WorkerPool, m_VisibleIndices);
+			m_CullMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		auto view = getView();
+		return m_Recorder->record(inheritance, static_cast<uint32_t>(m_VisibleIndices.size()), MinDrawsPerBatch,
+			[this, view](VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t endDraw)
+		{
+			auto vertexBuffer = m_VertexBuffer.get();
+			VkDeviceSize vertexOffset = 0;
+			// Secondary command buffers don't inherit dynamic state.
+			setViewportAndScissor(commandBuffer);
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &vertexOffset);
+			vkCmdBindIndexBuffer(commandBuffer, m_IndexBuffer.get(), 0, VK_INDEX_TYPE_UINT16);
+			bindMaterials(commandBuffer);
+			auto drawCount = m_VisibleIndices.size();
+			VkPipeline boundPipeline = VK_NULL_HANDLE;
+			for (auto draw = firstDraw; draw < endDraw; ++draw)
+			{
+				auto pipeline = m_FramePipelines[draw * m_FramePipelines.size() / drawCount];
+				if (pipeline != boundPipeline)
+				{
+					vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+					boundPipeline = pipeline;
+				}
+				auto instance = m_VisibleIndices[draw];
+				ObjectUniforms object;
+				object.model = view * m_InstanceStore.transforms[instance];
+				bindUniforms(commandBuffer, m_UniformRing->push(object));
+				pushDrawConstants(commandBuffer, instance);
+				vkCmdDrawIndexed(commandBuffer, m_IndexCount, 1, 0, 0, 0);
+			}
+		});
+	}
+
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+	{
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr;
+		beginInfo.pNext = nullptr;
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't begin command buffer.");
+		}
+		recordPendingAcquires(commandBuffer, m_GraphicsAcquires);
+		FrameUniforms frameUniforms;
+		frameUniforms.viewProjection = getViewProjection();
+		m_FrameUniformOffset = m_UniformRing->push(frameUniforms);
+		m_GpuProfiler->beginFrame(commandBuffer, m_CurrentFrame);
+		auto frameScope = m_GpuProfiler->beginScope(commandBuffer, "frame");
+		m_RenderGraph->bindImage(m_BackbufferResource, m_SwapChainImages[imageIndex], m_SwapChainImageViews[imageIndex].get());
+		if (m_Options.instanceCount > 0 && !m_Options.cpuDraws)
+		{
+			m_RenderGraph->bindBuffer(m_InstanceResource, m_InstanceBuffer.get());
+			m_RenderGraph->bindBuffer(m_VisibleInstanceResource, m_VisibleInstanceBuffer.get(),
+				getVisibleSlotSize() * m_CurrentFrame, sizeof(InstanceData) * m_Options.instanceCount);
+			m_RenderGraph->bindBuffer(m_DrawCommandResource, m_IndirectBuffer.get(),
+				getIndirectSlotSize() * m_CurrentFrame, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		updateFramePipelines();
+		if (m_Options.cpuDraws)
+		{
+			m_InstanceDrawCommandBuffers = recordInstanceDraws();
+		}
+		m_RenderGraph->execute(commandBuffer, m_GpuProfiler.get());
+		m_GpuProfiler->endScope(commandBuffer, frameScope);
+		if (m_AsyncCompute)
+		{
+			// Back to compute for this slot's next cull, once the draw has read them.
+			releaseBuffer(commandBuffer, QueueType::Graphics, QueueType::Compute, m_VisibleInstanceBuffer.get(),
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				getVisibleSlotSize() * m_CurrentFrame, getVisibleSlotSize());
+			releaseBuffer(commandBuffer, QueueType::Graphics, QueueType::Compute, m_IndirectBuffer.get(),
+				VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+				getIndirectSlotSize() * m_CurrentFrame, getIndirectSlotSize());
+		}
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't record command buffer.");
+		}
+	}
+
+	// Draws into the backbuffer: the secondaries from recordInstanceDraws, the
+	// GPU-culled instances, or the single spinning triangle.
+	void recordMainPass(VkCommandBuffer commandBuffer)
+	{
+		if (m_Options.cpuDraws)
+		{
+			vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(m_InstanceDrawCommandBuffers.size()),
+				m_InstanceDrawCommandBuffers.data());
+			return;
+		}
+		setViewportAndScissor(commandBuffer);
+		auto vertexBuffer = m_VertexBuffer.get();
+		VkDeviceSize vertexOffset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &vertexOffset);
+		vkCmdBindIndexBuffer(commandBuffer, m_IndexBuffer.get(), 0, VK_INDEX_TYPE_UINT16);
+		bindMaterials(commandBuffer);
+		pushDrawConstants(commandBuffer, 0);
+		if (m_Options.instanceCount > 0)
+		{
+			auto instanceBuffer = m_VisibleInstanceBuffer.get();
+			VkDeviceSize instanceOffset = getVisibleSlotSize() * m_CurrentFrame;
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_InstancedPipeline);
+			vkCmdBindVertexBuffers(commandBuffer, 1, 1, &instanceBuffer, &instanceOffset);
+			// instanced.vert doesn't read ObjectUniforms; any valid offset will do.
+			bindUniforms(commandBuffer, m_FrameUniformOffset);
+			vkCmdDrawIndexedIndirect(commandBuffer, m_IndirectBuffer.get(), getIndirectSlotSize() * m_CurrentFrame,
+				1, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			ObjectUniforms object;
+			object.model = glm::rotate(glm::mat4(1.0f), m_FrameNumber * 0.01f, glm::vec3(0.0f, 0.0f, 1.0f));
+			// Cycles through the drawable pipeline variants, a second of frames each.
+			auto variant = (m_FrameNumber / 60) % m_FramePipelines.size();
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_FramePipelines[variant]);
+			bindUniforms(commandBuffer, m_UniformRing->push(object));
+			vkCmdDrawIndexed(commandBuffer, m_IndexCount, 1, 0, 0, 0);
+		}
+	}
+
+	// Blocks before input is sampled, so each frame starts from the freshest
+	// input the policy allows. Low latency waits for the previous frame to finish
+	// on the GPU; the other policies only wait for this slot's fence and let
+	// maxFramesInFlight frames queue up. Also collects input-to-retire samples.
+	void paceFrame()
+	{
+		auto frameCount = m_Options.maxFramesInFlight;
+		auto& frame = m_Frames[m_CurrentFrame];
+		auto& previous = m_Frames[(m_CurrentFrame + frameCount - 1) % frameCount];
+		auto& waitFrame = m_Options.presentPolicy == PresentPolicy::LowLatency ? previous : frame;
+		auto waitFence = waitFrame.inFlight.get();
+		vkWaitForFences(m_Device, 1, &waitFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+
+		// A frame is retired when this check first sees its fence signalled. Only
+		// the waited-on fence is seen as it signals; others may have signalled up
+		// to a frame earlier. So the sample is an upper bound on input-to-render-end
+		// time, and display scan-out is not included.
+		auto now = std::chrono::steady_clock::now();
+		for (auto& f : m_Frames)
+		{
+			if (f.latencyPending && vkGetFenceStatus(m_Device, f.inFlight.get()) == VK_SUCCESS)
+			{
+				f.latencyPending = false;
+				auto latency = std::chrono::duration<double, std::milli>(now - f.inputTime).count();
+				if (m_LatencySamples.size() < LatencySampleCount)
+				{
+					m_LatencySamples.push_back(latency);
+				}
+				else
+				{
+					m_LatencySamples[m_LatencySampleCursor] = latency;
+					m_LatencySampleCursor = (m_LatencySampleCursor + 1) % LatencySampleCount;
+				}
+			}
+		}
+	}
+
+	static double average(const std::vector<double>& samples)
+	{
+		double sum = 0.0;
+		for (auto s : samples)
+		{
+			sum += s;
+		}
+		return samples.empty() ? 0.0 : sum / samples.size();
+	}
+
+	static double percentile(std::vector<double> samples, double fraction)
+	{
+		if (samples.empty())
+		{
+			return 0.0;
+		}
+		auto index = static_cast<size_t>(fraction * (samples.size() - 1) + 0.5);
+		std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+		return samples[index];
+	}
+
+	void drawFrame()
+	{
+		if (m_SwapChainOutOfDate)
+		{
+			recreateSwapChain();
+			if (m_SwapChainOutOfDate)
+			{
+				// Minimised; sleep until the window changes instead of spinning.
+				glfwWaitEvents();
+				return;
+			}
+		}
+		auto& frame = m_Frames[m_CurrentFrame];
+		auto inFlight = frame.inFlight.get();
+
+		// Only blocks when the GPU is more than maxFramesInFlight frames behind.
+		vkWaitForFences(m_Device, 1, &inFlight, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		m_FreeSemaphores.insert(m_FreeSemaphores.end(), frame.consumedSemaphores.begin(), frame.consumedSemaphores.end());
+		frame.consumedSemaphores.clear();
+		retireAsyncSubmissions(false);
+		m_FrameDescriptors->beginFrame(m_CurrentFrame);
+		m_UniformRing->beginFrame(m_CurrentFrame);
+		// The fence also covers every earlier frame, up to this slot's previous one.
+		if (m_FrameNumber >= m_Options.maxFramesInFlight)
+		{
+			m_Bindless->reclaim(m_FrameNumber - m_Options.maxFramesInFlight);
+			m_RenderGraph->collect(m_FrameNumber - m_Options.maxFramesInFlight);
+			m_DeletionQueue.collect(m_FrameNumber - m_Options.maxFramesInFlight);
+		}
+		if (m_ShaderWatcher)
+		{
+			updateShaderReload();
+		}
+		if (m_Recorder)
+		{
+			m_Recorder->beginFrame(m_CurrentFrame);
+		}
+
+		uint32_t imageIndex = 0;
+		if (m_Options.headless)
+		{
+			imageIndex = static_cast<uint32_t>(m_FrameNumber % m_SwapChainImages.size());
+		}
+		else
+		{
+			auto result = vkAcquireNextImageKHR(m_Device, m_SwapChain.get(), std::numeric_limits<uint64_t>::max(),
+				frame.imageAvailable.get(), VK_NULL_HANDLE, &imageIndex);
+			if (result == VK_ERROR_OUT_OF_DATE_KHR)
+			{
+				// Nothing was acquired or signalled; recreate and retry on the next call.
+				m_SwapChainOutOfDate = true;
+				return;
+			}
+			// SUBOPTIMAL still acquired an image: draw this frame, recreate after present.
+			if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+			{
+				throw std::runtime_error("Can't acquire swap chain image.");
+			}
+			m_SwapChainOutOfDate |= result == VK_SUBOPTIMAL_KHR;
+			retireOldSwapChains();
+		}
+
+		// The image may still be in use by an older slot when there are fewer
+		// images than frames in flight, or when images are acquired out of order.
+		if (m_ImagesInFlight[imageIndex] != VK_NULL_HANDLE)
+		{
+			vkWaitForFences(m_Device, 1, &m_ImagesInFlight[imageIndex], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		}
+		m_ImagesInFlight[imageIndex] = inFlight;
+
+		// This slot's region of the stream buffer was last read by the frame waited on above.
+		if (!m_StreamSource.empty())
+		{
+			VkDeviceSize streamSize = m_StreamSource.size();
+			uploadToBuffer(m_StreamBuffer.get(), streamSize * m_CurrentFrame, m_StreamSource.data(), streamSize);
+		}
+		flushUploads();
+		if (m_AsyncCompute)
+		{
+			submitCulling();
+		}
+
+		vkResetCommandBuffer(frame.commandBuffer, 0);
+		auto recordStart = std::chrono::steady_clock::now();
+		recordCommandBuffer(frame.commandBuffer, imageIndex);
+		m_RecordMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+
+		// Wait for the swap chain image plus any async work handed to graphics since the last frame.
+		std::vector<VkSemaphore> waitSemaphores;
+		std::vector<VkPipelineStageFlags> waitStages;
+		if (!m_Options.headless)
+		{
+			waitSemaphores.push_back(frame.imageAvailable.get());
+			waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		}
+		waitSemaphores.insert(waitSemaphores.end(), m_GraphicsWaitSemaphores.begin(), m_GraphicsWaitSemaphores.end());
+		waitStages.insert(waitStages.end(), m_GraphicsWaitStages.begin(), m_GraphicsWaitStages.end());
+		frame.consumedSemaphores.swap(m_GraphicsWaitSemaphores);
+		m_GraphicsWaitStages.clear();
+
+		auto renderFinished = m_Options.headless ? VK_NULL_HANDLE : m_RenderFinished[imageIndex].get();
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
+		if (!m_Options.headless)
+		{
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &renderFinished;
+		}
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &frame.commandBuffer;
+		submitInfo.pNext = nullptr;
+
+		vkResetFences(m_Device, 1, &inFlight);
+		if (vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, inFlight) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Can't submit draw command buffer.");
+		}
+		frame.inputTime = m_InputTime;
+		frame.latencyPending = true;
+
+		if (!m_Options.headless)
+		{
+			VkPresentInfoKHR presentInfo = {};
+			presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+			presentInfo.waitSemaphoreCount = 1;
+			presentInfo.pWaitSemaphores = &renderFinished;
+			auto swapChain = m_SwapChain.get();
+			presentInfo.swapchainCount = 1;
+			presentInfo.pSwapchains = &swapChain;
+			presentInfo.pImageIndices = &imageIndex;
+			presentInfo.pResults = nullptr;
+			presentInfo.pNext = nullptr;
+			auto result = vkQueuePresentKHR(m_PresentQueue, &presentInfo);
+			if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+			{
+				m_SwapChainOutOfDate = true;
+			}
+			else if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Can't present swap chain image.");
+			}
+		}
+
+		m_CurrentFrame = (m_CurrentFrame + 1) % m_Options.maxFramesInFlight;
+		++m_FrameNumber;
+	}
+
+	// Called once an image has been acquired from the current swap chain, which
+	// shows the presents queued on the ones it replaced are no longer waiting on
+	// their semaphores. They are destroyed once this frame's fence has signalled.
+	void retireOldSwapChains()
+	{
+		for (auto& semaphore : m_RetiredRenderFinished)
+		{
+			m_DeletionQueue.push(m_FrameNumber + 1, std::move(semaphore));
+		}
+		m_RetiredRenderFinished.clear();
+		for (auto& swapChain : m_RetiredSwapChains)
+		{
+			m_DeletionQueue.push(m_FrameNumber + 1, std::move(swapChain));
+		}
+		m_RetiredSwapChains.clear();
+	}
+
+	bool shouldKeepRunning()
+	{
+		if (m_Options.frameCount != 0 && m_FrameNumber >= m_Options.frameCount)
+		{
+			return false;
+		}
+		return m_Options.headless || !glfwWindowShouldClose(m_Window);
+	}
+
+	void mainLoop() {
+		TRACE_SCOPE("mainLoop");
+		auto start = std::chrono::steady_clock::now();
+		auto benchmark = !m_Options.benchmarkPath.empty();
+		if (benchmark)
+		{
+			m_FrameTimes.reserve(m_Options.frameCount);
+			m_CpuFrameTimes.reserve(m_Options.frameCount);
+		}
+		while (shouldKeepRunning())
+		{
+			auto frameStart = std::chrono::steady_clock::now();
+			paceFrame();
+			if (!m_Options.headless)
+			{
+				glfwPollEvents();
+			}
+			m_InputTime = std::chrono::steady_clock::now();
+			auto compiling = !m_PipelineVariants.empty() && !m_PipelineVariantsReady;
+			drawFrame();
+			if (benchmark)
+			{
+				auto frameEnd = std::chrono::steady_clock::now();
+				auto cpuMs = std::chrono::duration<double, std::milli>(frameEnd - m_InputTime).count();
+				m_FrameTimes.push_back(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+				m_CpuFrameTimes.push_back(cpuMs);
+				(compiling ? m_CompilingCpuFrameTimes : m_IdleCpuFrameTimes).push_back(cpuMs);
+			}
+		}
+		vkDeviceWaitIdle(m_Device);
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "Rendered " << m_FrameNumber << " frames in " << elapsed.count() << " s ("
+			<< (elapsed.count() > 0.0 ? m_FrameNumber / elapsed.count() : 0.0) << " fps) with "
+			<< m_Options.maxFramesInFlight << " frames in flight." << std::endl;
+		std::cout << "Recording took " << (m_FrameNumber > 0 ? m_RecordMs / m_FrameNumber : 0.0) << " ms per frame"
+			<< (m_Recorder ? " on " + std::to_string(m_WorkerPool->size()) + " worker threads." : std::string(".")) << std::endl;
+		if (!m_LatencySamples.empty())
+		{
+			std::cout << "Input-to-retire latency (input poll until the CPU sees the frame's fence): avg " << average(m_LatencySamples) << " ms, p50 "
+				<< percentile(m_LatencySamples, 0.5) << " ms, p99 " << percentile(m_LatencySamples, 0.99)
+				<< " ms over the last " << m_LatencySamples.size() << " frames." << std::endl;
+		}
+		if (m_Options.uploadKiB > 0 || m_StagingStalls > 0)
+		{
+			std::cout << "Streamed " << m_Options.uploadKiB << " KiB per frame through a "
+				<< m_StagingRing->capacity() / 1024 << " KiB staging ring with " << m_StagingStalls << " stalls." << std::endl;
+		}
+		if (m_Options.cpuCull)
+		{
+			m_CullTimings = measureCpuCulling();
+			std::cout << "CPU culling took " << m_CullMs / std::max<uint64_t>(m_FrameNumber, 1) << " ms per frame. Best of "
+				<< CullBenchmarkRuns << " runs, " << m_CullTimings.visibleCount << " of " << m_InstanceStore.size()
+				<< " visible: scalar AoS " << m_CullTimings.scalarAoSMs << " ms, " << FrustumCuller::instructionSet()
+				<< " SoA " << m_CullTimings.simdMs << " ms, " << FrustumCuller::instructionSet() << " SoA on "
+				<< m_WorkerPool->size() << " threads " << m_CullTimings.parallelMs << " ms." << std::endl;
+		}
+		if (!m_CompilingCpuFrameTimes.empty() && !m_IdleCpuFrameTimes.empty())
+		{
+			// Compiles run on their own lower-priority pool, so frames while they
+			// run should cost about the same as frames after.
+			auto compilingMs = percentile(m_CompilingCpuFrameTimes, 0.5);
+			auto idleMs = percentile(m_IdleCpuFrameTimes, 0.5);
+			std::cout << "CPU frame time p50 " << compilingMs << " ms over " << m_CompilingCpuFrameTimes.size()
+				<< " frames while pipelines compiled, " << idleMs << " ms over " << m_IdleCpuFrameTimes.size() << " after." << std::endl;
+			if (compilingMs > CompileFrameTimeTolerance * idleMs)
+			{
+				std::cout << "Warning: frames slowed down while pipelines compiled." << std::endl;
+			}
+		}
+		std::cout << "Uniform ring: peak " << m_UniformRing->peakFrameBytes() << " of "
+			<< m_UniformRing->frameSize() << " bytes per frame." << std::endl;
+		std::cout << "Pipeline library: " << m_PipelineLibrary->size() << " pipelines for "
+			<< m_PipelineLibrary->hits() + m_PipelineLibrary->misses() << " requests ("
+			<< m_PipelineLibrary->hits() << " shared)." << std::endl;
+		if (m_ShaderWatcher)
+		{
+			std::cout << "Reloaded shaders " << m_ShaderReloadCount << " times." << std::endl;
+		}
+		for (auto& scope : m_GpuProfiler->getStats())
+		{
+			std::cout << "GPU " << scope.name << ": min " << scope.minMs << " ms, avg " << scope.avgMs
+				<< " ms, p99 " << scope.p99Ms << " ms over the last " << scope.sampleCount << " frames." << std::endl;
+		}
+	}
+
+	static uint64_t getPeakHostMemoryBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters = {};
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return counters.PeakWorkingSetSize;
+		}
+		return 0;
+#else
+		rusage usage = {};
+		getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+		// macOS reports bytes.
+		return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+		// Linux reports KiB.
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+	}
+
+	// Culls the current view with the scalar AoS baseline, the SIMD SoA path on
+	// one thread and the same path on the worker pool, and checks they agree.
+	CullTimings measureCpuCulling()
+	{
+		std::vector<AoSInstance> aos(m_InstanceStore.size());
+		for (uint32_t i = 0; i < aos.size(); ++i)
+		{
+			aos[i].position = glm::vec3(m_InstanceStore.x[i], m_InstanceStore.y[i], m_InstanceStore.z[i]);
+			aos[i].radius = m_InstanceStore.radius[i];
+			aos[i].transform = m_InstanceStore.transforms[i];
+		}
+		auto frustum = Frustum::fromViewProjection(getViewProjection() * getView());
+		auto best = [this](const std::function<void()>& cull)
+		{
+			double bestMs = std::numeric_limits<double>::max();
+			for (uint32_t run = 0; run < CullBenchmarkRuns; ++run)
+			{
+				auto start = std::chrono::steady_clock::now();
+				cull();
+				bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+			}
+			return bestMs;
+		};
+
+		CullTimings timings;
+		std::vector<uint32_t> scalarVisible;
+		std::vector<uint32_t> simdVisible(m_InstanceStore.size());
+		std::vector<uint32_t> parallelVisible;
+		timings.scalarAoSMs = best([&] { FrustumCuller::cullScalar(aos, frustum, scalarVisible); });
+		uint32_t simdCount = 0;
+		timings.simdMs = best([&] { simdCount = FrustumCuller::cull(m_InstanceStore, frustum, 0, m_InstanceStore.size(), simdVisible.data()); });
+		simdVisible.resize(simdCount);
+		timings.parallelMs = best([&] { FrustumCuller::cullParallel(m_InstanceStore, frustum, *m_WorkerPool, parallelVisible); });
+		if (simdVisible != scalarVisible || parallelVisible != scalarVisible)
+		{
+			throw std::runtime_error("CPU culling implementations disagree.");
+		}
+		timings.visibleCount = static_cast<uint32_t>(scalarVisible.size());
+		return timings;
+	}
+
+	static void writeTimeStats(std::ostream& out, const std::vector<double>& samples)
+	{
+		out << "{\"avg\": " << average(samples)
+			<< ", \"p50\": " << percentile(samples, 0.5)
+			<< ", \"p90\": " << percentile(samples, 0.9)
+			<< ", \"p99\": " << percentile(samples, 0.99)
+			<< ", \"max\": " << (samples.empty() ? 0.0 : *std::max_element(samples.begin(), samples.end())) << "}";
+	}
+
+	// Startup phases are the outermost spans inside initVulkan (and initWindow)
+	// on the main thread. Pipeline compile time sums every pipeline creation
+	// span, including variants compiled on the compile pool.
+	void writeBenchmarkReport(const std::string& path)
+	{
+		m_CompilePool->waitIdle();
+		auto events = Tracer::instance().events();
+		std::sort(events.begin(), events.end(), [](const Tracer::Event& a, const Tracer::Event& b)
+		{
+			return a.beginNs < b.beginNs;
+		});
+		auto init = std::find_if(events.begin(), events.end(), [](const Tracer::Event& event)
+		{
+			return strcmp(event.name, "initVulkan") == 0;
+		});
+		if (init == events.end())
+		{
+			throw std::runtime_error("Benchmark report needs the initVulkan trace span.");
+		}
+		auto mainThread = init->threadIndex;
+		auto startupBegin = init->beginNs;
+		std::vector<Tracer::Event> phases;
+		double pipelineMs = 0.0;
+		double pipelineMaxMs = 0.0;
+		uint32_t pipelineCount = 0;
+		for (auto& event : events)
+		{
+			auto ms = (event.endNs - event.beginNs) / 1e6;
+			if (strcmp(event.name, "vkCreateGraphicsPipelines") == 0 || strcmp(event.name, "vkCreateComputePipelines") == 0)
+			{
+				pipelineMs += ms;
+				pipelineMaxMs = std::max(pipelineMaxMs, ms);
+				++pipelineCount;
+			}
+			if (strcmp(event.name, "initWindow") == 0)
+			{
+				startupBegin = std::min(startupBegin, event.beginNs);
+				phases.push_back(event);
+			}
+			else if (event.threadIndex == mainThread && event.beginNs >= init->beginNs && event.endNs <= init->endNs &&
+				&event != &*init && (phases.empty() || event.beginNs >= phases.back().endNs))
+			{
+				phases.push_back(event);
+			}
+		}
+
+		std::ofstream file(path, std::ios::trunc);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Can't write benchmark report " + path + ".");
+		}
+		file.setf(std::ios::fixed);
+		file.precision(3);
+		file << "{\n";
+		file << "  \"device\": \"" << Tracer::escape(m_DeviceInfo->properties.deviceName) << "\",\n";
+		file << "  \"scene\": {\"width\": " << m_Options.width << ", \"height\": " << m_Options.height
+			<< ", \"instances\": " << m_Options.instanceCount << ", \"cpuDraws\": " << (m_Options.cpuDraws ? "true" : "false")
+			<< ", \"cpuCull\": " << (m_Options.cpuCull ? "true" : "false")
+			<< ", \"asyncCompute\": " << (m_AsyncCompute ? "true" : "false")
+			<< ", \"samples\": " << m_SampleCount << ", \"depth\": " << (m_Options.depth ? "true" : "false")
+			<< ", \"pipelineVariants\": " << m_Options.pipelineVariants << ", \"frames\": " << m_FrameNumber
+			<< ", \"framesInFlight\": " << m_Options.maxFramesInFlight << ", \"workerThreads\": " << m_WorkerPool->size()
+			<< ", \"compileThreads\": " << m_CompilePool->size() << "},\n";
+		file << "  \"startupMs\": {\"total\": " << (init->endNs - startupBegin) / 1e6 << ", \"phases\": [";
+		for (size_t i = 0; i < phases.size(); ++i)
+		{
+			file << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << Tracer::escape(phases[i].name) << "\", \"ms\": "
+				<< (phases[i].endNs - phases[i].beginNs) / 1e6 << "}";
+		}
+		file << "\n  ]},\n";
+		file << "  \"frameTimeMs\": ";
+		writeTimeStats(file, m_FrameTimes);
+		file << ",\n  \"cpuFrameTimeMs\": ";
+		writeTimeStats(file, m_CpuFrameTimes);
+		file << ",\n  \"cpuFrameTimeWhileCompilingMs\": ";
+		writeTimeStats(file, m_CompilingCpuFrameTimes);
+		file << ",\n  \"cpuFrameTimeAfterCompilingMs\": ";
+		writeTimeStats(file, m_IdleCpuFrameTimes);
+		file << ",\n  \"pipelineCompile\": {\"count\": " << pipelineCount << ", \"totalMs\": " << pipelineMs
+			<< ", \"maxMs\": " << pipelineMaxMs << ", \"libraryRequests\": " << m_PipelineLibrary->hits() + m_PipelineLibrary->misses()
+			<< ", \"libraryHits\": " << m_PipelineLibrary->hits() << "},\n";
+		file << "  \"gpuMs\": {";
+		auto gpuStats = m_GpuProfiler->getStats();
+		for (size_t i = 0; i < gpuStats.size(); ++i)
+		{
+			file << (i == 0 ? "\n" : ",\n") << "    \"" << Tracer::escape(gpuStats[i].name) << "\": {\"min\": " << gpuStats[i].minMs
+				<< ", \"avg\": " << gpuStats[i].avgMs << ", \"p99\": " << gpuStats[i].p99Ms << "}";
+		}
+		file << (gpuStats.empty() ? "},\n" : "\n  },\n");
+		if (m_Options.cpuCull)
+		{
+			file << "  \"cpuCullMs\": {\"instructionSet\": \"" << FrustumCuller::instructionSet() << "\", \"visible\": "
+				<< m_CullTimings.visibleCount << ", \"perFrame\": " << m_CullMs / std::max<uint64_t>(m_FrameNumber, 1)
+				<< ", \"scalarAoS\": " << m_CullTimings.scalarAoSMs << ", \"simdSoA\": " << m_CullTimings.simdMs
+				<< ", \"simdSoAParallel\": " << m_CullTimings.parallelMs << "},\n";
+		}
+		file << "  \"memory\": {\"peakHostBytes\": " << getPeakHostMemoryBytes()
+			<< ", \"peakDeviceBytes\": " << m_Allocator->getPeakReservedBytes() << "}\n";
+		file << "}\n";
+		if (!file)
+		{
+			throw std::runtime_error("Can't write benchmark report " + path + ".");
+		}
+		std::cout << "Wrote benchmark report " << path << std::endl;
+	}
+
+	void cleanup() {
+		TRACE_SCOPE("cleanup");
+		retireAsyncSubmissions(true);
+		logMemoryStats();
+		m_Frames.clear();
+		m_ImagesInFlight.clear();
+		m_GraphicsWaitSemaphores.clear();
+		m_FreeSemaphores.clear();
+		m_AsyncSemaphores.clear();
+		m_FreeFences.clear();
+		m_RenderFinished.clear();
+		m_RetiredRenderFinished.clear();
+		m_Recorder.reset();
+		m_GpuProfiler.reset();
+		m_ComputeCommandPool.reset();
+		m_TransferCommandPool.reset();
+		m_CommandPool.reset();
+		m_IndirectBuffer.reset();
+		m_Allocator->free(m_IndirectMemory);
+		m_VisibleInstanceBuffer.reset();
+		m_Allocator->free(m_VisibleInstanceMemory);
+		m_InstanceBuffer.reset();
+		m_Allocator->free(m_InstanceMemory);
+		m_CullPipeline.reset();
+		m_CullPipelineLayout.reset();
+		m_CullSetLayout.reset();
+		m_StreamBuffer.reset();
+		m_Allocator->free(m_StreamMemory);
+		m_PaletteBuffer.reset();
+		m_Allocator->free(m_PaletteMemory);
+		m_Sampler.reset();
+		m_CheckerImageView.reset();
+		m_CheckerImage.reset();
+		m_Allocator->free(m_CheckerMemory);
+		m_IndexBuffer.reset();
+		m_Allocator->free(m_IndexMemory);
+		m_VertexBuffer.reset();
+		m_Allocator->free(m_VertexMemory);
+		m_StagingRing.reset();
+		m_StagingBuffer.reset();
+		m_Allocator->free(m_StagingMemory);
+		mergeWorkerPipelineCaches();
+		// Nothing draws any more, so a last reload doesn't need its variants compiled.
+		m_PipelineVariants.clear();
+		if (m_ShaderReload.valid())
+		{
+			applyShaderReload();
+		}
+		// The device is idle, so everything retired can go now.
+		m_DeletionQueue.flush();
+		m_PipelineLibrary.reset();
+		m_Shaders.instancedVertex.reset();
+		m_Shaders.fragment.reset();
+		m_Shaders.vertex.reset();
+		savePipelineCache();
+		m_WorkerPipelineCaches.clear();
+		m_PipelineCache.reset();
+		m_RenderGraph.reset();
+		m_PipelineLayout.reset();
+		m_UniformDescriptorPool.reset();
+		m_UniformSetLayout.reset();
+		m_UniformRing.reset();
+		m_UniformBuffer.reset();
+		m_Allocator->free(m_UniformMemory);
+		m_SwapChainImageViews.clear();
+		if (m_Options.headless)
+		{
+			for (size_t i = 0; i < m_SwapChainImages.size(); ++i)
+			{
+				vkDestroyImage(m_Device, m_SwapChainImages[i], nullptr);
+				m_Allocator->free(m_OffscreenImageMemory[i]);
+			}
+		}
+		m_RetiredSwapChains.clear();
+		m_SwapChain.reset();
 		if (enableValidationLayers)
 		{
 			DestroyDebugUtilsMessengerEXT(m_Instance, nullptr, m_DebugMessenger);
 		}
-		vkDestroySurfaceKHR(m_Instance, m_Surface, nullptr);
+		if (!m_Options.headless)
+		{
+			vkDestroySurfaceKHR(m_Instance, m_Surface, nullptr);
+		}
+		m_FrameDescriptors.reset();
+		m_Bindless.reset();
+		m_Allocator.reset();
 		vkDestroyDevice(m_Device, nullptr);
 		vkDestroyInstance(m_Instance, nullptr);
-		glfwDestroyWindow(m_Window);
-		glfwTerminate();
+		if (!m_Options.headless)
+		{
+			glfwDestroyWindow(m_Window);
+			glfwTerminate();
+		}
 	}
 };
 
-int main() {
-	HelloTriangleApplication app;
+// Parses the value of a numeric flag. from_chars takes no sign and the whole
+// value must parse, so "-1", "12k" and anything above UINT32_MAX are errors.
+uint32_t parseUint32(const std::string& flag, const char* text)
+{
+	uint32_t value = 0;
+	auto end = text + strlen(text);
+	auto result = std::from_chars(text, end, value);
+	if (result.ec != std::errc() || result.ptr != end)
+	{
+		throw std::runtime_error(flag + " needs a whole number from 0 to " +
+			std::to_string(std::numeric_limits<uint32_t>::max()) + ", not \"" + text + "\".");
+	}
+	return value;
+}
+
+ApplicationOptions parseOptions(int argc, char** argv)
+{
+	ApplicationOptions options;
+#ifdef TRIANGLE_BENCHMARK
+	// TriangleBench renders offscreen and compiles every pipeline from scratch,
+	// so runs on the same machine start from the same state.
+	options.headless = true;
+	options.pipelineCachePath.clear();
+	options.benchmarkPath = "benchmark.json";
+#endif
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--headless")
+		{
+			options.headless = true;
+		}
+		else if (arg == "--frames-in-flight" && i + 1 < argc)
+		{
+			options.maxFramesInFlight = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--width" && i + 1 < argc)
+		{
+			options.width = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--height" && i + 1 < argc)
+		{
+			options.height = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--frames" && i + 1 < argc)
+		{
+			options.frameCount = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--pipeline-cache" && i + 1 < argc)
+		{
+			options.pipelineCachePath = argv[++i];
+		}
+		else if (arg == "--worker-threads" && i + 1 < argc)
+		{
+			options.workerThreads = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--compile-threads" && i + 1 < argc)
+		{
+			options.compileThreads = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--pipeline-variants" && i + 1 < argc)
+		{
+			options.pipelineVariants = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			options.tracePath = argv[++i];
+		}
+		else if (arg == "--device" && i + 1 < argc)
+		{
+			options.device = argv[++i];
+		}
+		else if (arg == "--upload-kib" && i + 1 < argc)
+		{
+			options.uploadKiB = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--instances" && i + 1 < argc)
+		{
+			options.instanceCount = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--benchmark-json" && i + 1 < argc)
+		{
+			options.benchmarkPath = argv[++i];
+		}
+		else if (arg == "--cpu-draws")
+		{
+			options.cpuDraws = true;
+		}
+		else if (arg == "--cpu-cull")
+		{
+			options.cpuCull = true;
+		}
+		else if (arg == "--no-async-compute")
+		{
+			options.asyncCompute = false;
+		}
+		else if (arg == "--msaa" && i + 1 < argc)
+		{
+			options.samples = parseUint32(arg, argv[++i]);
+		}
+		else if (arg == "--depth")
+		{
+			options.depth = true;
+		}
+		else if (arg == "--watch-shaders" && i + 1 < argc)
+		{
+			options.watchShadersPath = argv[++i];
+		}
+		else if (arg == "--present-policy" && i + 1 < argc)
+		{
+			std::string policy = argv[++i];
+			if (policy == "low-latency")
+			{
+				options.presentPolicy = PresentPolicy::LowLatency;
+			}
+			else if (policy == "throughput")
+			{
+				options.presentPolicy = PresentPolicy::Throughput;
+			}
+			else if (policy == "power-saving")
+			{
+				options.presentPolicy = PresentPolicy::PowerSaving;
+			}
+			else
+			{
+				throw std::runtime_error("Unknown present policy " + policy + ".");
+			}
+		}
+		else
+		{
+			throw std::runtime_error("Unknown argument " + arg + ".");
+		}
+	}
+	return options;
+}
 
+int main(int argc, char** argv) {
 	try {
+		HelloTriangleApplication app(parseOptions(argc, argv));
 		app.run();
 	}
 	catch (const std::exception& e) {
@@ -892,4 +4651,4 @@ int main() {
 	}
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Bump allocator over a persistently mapped uniform buffer bound with dynamic
+// offsets. Each frame in flight owns a fixed region of frameSize bytes, and
+// beginFrame() rewinds the slot's region once its previous submission has
+// completed. Allocations are rounded up to minUniformBufferOffsetAlignment, so
+// every offset is a valid dynamic offset, and take a single atomic add, so
+// workers recording secondary command buffers can write at the same time.
+// The memory must be host-coherent; nothing is flushed.
+class UniformRing {
+public:
+	UniformRing(void* mapped, VkDeviceSize frameSize, uint32_t frameCount, VkDeviceSize alignment) :
+		m_Mapped(static_cast<uint8_t*>(mapped)),
+		m_Alignment(alignment),
+		m_FrameSize(alignUp(frameSize)),
+		m_FrameCount(frameCount)
+	{
+	}
+
+	UniformRing(const UniformRing&) = delete;
+	UniformRing& operator=(const UniformRing&) = delete;
+
+	// Size of the buffer backing the ring.
+	static VkDeviceSize getBufferSize(VkDeviceSize frameSize, uint32_t frameCount, VkDeviceSize alignment)
+	{
+		return (frameSize + alignment - 1) / alignment * alignment * frameCount;
+	}
+
+	// Call once the frame's previous submission has completed.
+	void beginFrame(uint32_t frameIndex)
+	{
+		if (frameIndex >= m_FrameCount)
+		{
+			throw std::runtime_error("Uniform ring has no frame " + std::to_string(frameIndex) + ".");
+		}
+		m_PeakFrameBytes = std::max(m_PeakFrameBytes, m_Head.load() - m_FrameBase);
+		m_FrameBase = m_FrameSize * frameIndex;
+		m_Head = m_FrameBase;
+	}
+
+	// Returns the offset of size bytes valid until the next beginFrame() for this slot.
+	uint32_t allocate(VkDeviceSize size)
+	{
+		auto offset = m_Head.fetch_add(alignUp(size));
+		if (offset + size > m_FrameBase + m_FrameSize)
+		{
+			throw std::runtime_error("Uniform ring frame of " + std::to_string(m_FrameSize) + " bytes is full.");
+		}
+		return static_cast<uint32_t>(offset);
+	}
+
+	// Copies value into the ring and returns its dynamic offset.
+	template<typename T>
+	uint32_t push(const T& value)
+	{
+		auto offset = allocate(sizeof(T));
+		memcpy(m_Mapped + offset, &value, sizeof(T));
+		return offset;
+	}
+
+	VkDeviceSize frameSize() const
+	{
+		return m_FrameSize;
+	}
+
+	// Most bytes, including alignment padding, used by one frame so far.
+	VkDeviceSize peakFrameBytes() const
+	{
+		return std::max(m_PeakFrameBytes, m_Head.load() - m_FrameBase);
+	}
+
+private:
+	uint8_t* m_Mapped;
+	VkDeviceSize m_Alignment;
+	VkDeviceSize m_FrameSize;
+	uint32_t m_FrameCount;
+	VkDeviceSize m_FrameBase = 0;
+	std::atomic<VkDeviceSize> m_Head{ 0 };
+	VkDeviceSize m_PeakFrameBytes = 0;
+
+	VkDeviceSize alignUp(VkDeviceSize size) const
+	{
+		return (size + m_Alignment - 1) / m_Alignment * m_Alignment;
+	}
+};
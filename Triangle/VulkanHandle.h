@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <utility>
+
+// Move-only owner of a device-level Vulkan handle, destroyed with Destroy when
+// the owner is reset, reassigned or goes out of scope. Handles that must outlive
+// the frames still using them are moved into a DeletionQueue instead.
+template<typename Handle, void (VKAPI_PTR* Destroy)(VkDevice, Handle, const VkAllocationCallbacks*)>
+class UniqueHandle {
+public:
+	UniqueHandle() = default;
+
+	UniqueHandle(VkDevice device, Handle handle) :
+		m_Device(device),
+		m_Handle(handle)
+	{
+	}
+
+	UniqueHandle(const UniqueHandle&) = delete;
+	UniqueHandle& operator=(const UniqueHandle&) = delete;
+
+	UniqueHandle(UniqueHandle&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	UniqueHandle& operator=(UniqueHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			m_Device = std::exchange(other.m_Device, VkDevice());
+			m_Handle = std::exchange(other.m_Handle, Handle());
+		}
+		return *this;
+	}
+
+	~UniqueHandle()
+	{
+		reset();
+	}
+
+	Handle get() const
+	{
+		return m_Handle;
+	}
+
+	VkDevice getDevice() const
+	{
+		return m_Device;
+	}
+
+	explicit operator bool() const
+	{
+		return m_Handle != Handle();
+	}
+
+	// Destroys the current handle and returns the slot a vkCreate* call should
+	// write the new one to.
+	Handle* replace(VkDevice device)
+	{
+		reset();
+		m_Device = device;
+		return &m_Handle;
+	}
+
+	void reset()
+	{
+		if (m_Handle != Handle())
+		{
+			Destroy(m_Device, m_Handle, nullptr);
+			m_Handle = Handle();
+		}
+	}
+
+	// Gives up ownership without destroying the handle.
+	Handle release()
+	{
+		return std::exchange(m_Handle, Handle());
+	}
+
+private:
+	VkDevice m_Device = VkDevice();
+	Handle m_Handle = Handle();
+};
+
+using UniqueBuffer = UniqueHandle<VkBuffer, vkDestroyBuffer>;
+using UniqueImage = UniqueHandle<VkImage, vkDestroyImage>;
+using UniqueImageView = UniqueHandle<VkImageView, vkDestroyImageView>;
+using UniqueSampler = UniqueHandle<VkSampler, vkDestroySampler>;
+using UniqueFramebuffer = UniqueHandle<VkFramebuffer, vkDestroyFramebuffer>;
+using UniquePipeline = UniqueHandle<VkPipeline, vkDestroyPipeline>;
+using UniquePipelineLayout = UniqueHandle<VkPipelineLayout, vkDestroyPipelineLayout>;
+using UniquePipelineCache = UniqueHandle<VkPipelineCache, vkDestroyPipelineCache>;
+using UniqueShaderModule = UniqueHandle<VkShaderModule, vkDestroyShaderModule>;
+using UniqueDescriptorSetLayout = UniqueHandle<VkDescriptorSetLayout, vkDestroyDescriptorSetLayout>;
+using UniqueDescriptorPool = UniqueHandle<VkDescriptorPool, vkDestroyDescriptorPool>;
+using UniqueCommandPool = UniqueHandle<VkCommandPool, vkDestroyCommandPool>;
+using UniqueSwapchain = UniqueHandle<VkSwapchainKHR, vkDestroySwapchainKHR>;
+using UniqueSemaphore = UniqueHandle<VkSemaphore, vkDestroySemaphore>;
+using UniqueFence = UniqueHandle<VkFence, vkDestroyFence>;